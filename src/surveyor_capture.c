@@ -0,0 +1,412 @@
+/*
+ * surveyor_capture.c
+ *
+ * Recording of serial traffic, and the transport that replays it.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_capture.h"
+#include "surveyor_comms.h"
+#include "surveyor_log.h"
+#include "surveyor_sched.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_MAX 65535
+
+srv1_capture_t *
+srv1_capture_create(const char *path)
+{
+   srv1_capture_header_t hdr;
+   srv1_capture_t *c = (srv1_capture_t *) calloc(1, sizeof(srv1_capture_t));
+   if (c == NULL)
+      {
+         return NULL;
+      }
+   c->f = fopen(path, "wb");
+   if (c->f == NULL)
+      {
+         perror("srv1_capture_create():fopen()");
+         free(c);
+         return NULL;
+      }
+   setvbuf(c->f, NULL, _IOFBF, SRV1_CAPTURE_BUFFER);
+
+   memset(&hdr, 0, sizeof(hdr));
+   strncpy(hdr.magic, SRV1_CAPTURE_MAGIC, sizeof(hdr.magic));
+   hdr.version = SRV1_CAPTURE_VERSION;
+   hdr.start = srv1_sched_now();
+   c->last = hdr.start;
+   if (fwrite(&hdr, sizeof(hdr), 1, c->f) != 1)
+      {
+         perror("srv1_capture_create():fwrite()");
+         fclose(c->f);
+         free(c);
+         return NULL;
+      }
+   return c;
+}
+
+srv1_capture_t *
+srv1_capture_open(const char *path)
+{
+   srv1_capture_header_t hdr;
+   srv1_capture_t *c = (srv1_capture_t *) calloc(1, sizeof(srv1_capture_t));
+   if (c == NULL)
+      {
+         return NULL;
+      }
+   c->f = fopen(path, "rb");
+   if (c->f == NULL)
+      {
+         perror("srv1_capture_open():fopen()");
+         free(c);
+         return NULL;
+      }
+   if (fread(&hdr, sizeof(hdr), 1, c->f) != 1 || strncmp(hdr.magic,
+         SRV1_CAPTURE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version
+         != SRV1_CAPTURE_VERSION)
+      {
+         printf("srv1_capture_open(): %s is not an SRV-1 capture\n", path);
+         fclose(c->f);
+         free(c);
+         return NULL;
+      }
+   return c;
+}
+
+void
+srv1_capture_close(srv1_capture_t *c)
+{
+   if (c == NULL)
+      {
+         return;
+      }
+   fclose(c->f);
+   free(c);
+}
+
+static void
+put_record(srv1_capture_t *c, uint32_t delta, int dir, const void *data,
+      uint16_t len)
+{
+   srv1_capture_record_t rec;
+   rec.delta = delta;
+   rec.len = len;
+   rec.dir = (uint8_t) dir;
+   rec.reserved = 0;
+   if (fwrite(&rec, sizeof(rec), 1, c->f) != 1 || (len > 0 && fwrite(data,
+         len, 1, c->f) != 1))
+      {
+         SRV1_LOG0(SRV1_LOG_ERROR, "srv1: capture write failed, stopping\n");
+         c->failed = 1;
+         return;
+      }
+   c->records++;
+}
+
+void
+srv1_capture_write(srv1_capture_t *c, int dir, const void *data,
+      uint32_t len, int64_t now)
+{
+   const char *p = (const char *) data;
+   int64_t delta = now - c->last;
+
+   if (c->failed)
+      {
+         return;
+      }
+   if (delta < 0)
+      {
+         delta = 0;
+      }
+   c->last = now;
+
+   // Long silences take empty records to carry the time.
+   while (delta > UINT32_MAX && !c->failed)
+      {
+         put_record(c, UINT32_MAX, dir, NULL, 0);
+         delta -= UINT32_MAX;
+      }
+   do
+      {
+         uint16_t n = (uint16_t) (len > RECORD_MAX ? RECORD_MAX : len);
+         put_record(c, (uint32_t) delta, dir, p, n);
+         delta = 0;
+         p += n;
+         len -= n;
+      }
+   while (len > 0 && !c->failed);
+}
+
+int
+srv1_capture_read(srv1_capture_t *c, srv1_capture_record_t *rec, void *buf)
+{
+   size_t got = fread(rec, 1, sizeof(*rec), c->f);
+   if (got == 0 && feof(c->f))
+      {
+         return 0;
+      }
+   if (got != sizeof(*rec) || rec->dir > SRV1_CAPTURE_TX || (rec->len > 0
+         && fread(buf, rec->len, 1, c->f) != 1))
+      {
+         return -1;
+      }
+   c->last += rec->delta;
+   c->records++;
+   return 1;
+}
+
+/* ---- replay ---- */
+
+/*
+ * Replay state of one robot. The received bytes of a capture come back on
+ * the capture's own timeline, scaled by speed; what the driver writes is
+ * thrown away. x->fd is a timer that becomes readable when the next bytes
+ * are due, so the reactor can poll it like a port.
+ */
+typedef struct
+{
+      srv1_capture_t *cap; ///< Open while attached
+      double speed; ///< 1 = as recorded, 2 = twice as fast, 0 = no waiting
+      int64_t start; ///< Monotonic usec the replay started
+      srv1_capture_record_t rec; ///< Received record being handed out
+      unsigned char buf[RECORD_MAX]; ///< Its bytes
+      uint32_t off; ///< Bytes of it already handed out
+      int64_t due; ///< When it may be handed out (monotonic usec)
+      int have; ///< rec holds bytes not handed out yet
+      int eof; ///< No records left
+} replay_io_t;
+
+static void
+sleep_until(int64_t when)
+{
+   struct timespec ts;
+   ts.tv_sec = when / 1000000;
+   ts.tv_nsec = (when % 1000000) * 1000;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      {
+      }
+}
+
+/* Makes st->rec the next received record, if there is one. */
+static void
+next_rx(replay_io_t *st)
+{
+   while (!st->have && !st->eof)
+      {
+         int res = srv1_capture_read(st->cap, &st->rec, st->buf);
+         if (res <= 0)
+            {
+               if (res < 0)
+                  {
+                     SRV1_LOG1(SRV1_LOG_WARN,
+                           "srv1: capture damaged after %u records\n",
+                           st->cap->records);
+                  }
+               st->eof = 1;
+               break;
+            }
+         if (st->rec.dir == SRV1_CAPTURE_RX && st->rec.len > 0)
+            {
+               st->have = 1;
+               st->off = 0;
+               st->due = (st->speed > 0.0) ? st->start + (int64_t) (st->cap->last
+                     / st->speed) : 0;
+            }
+      }
+}
+
+static int
+replay_open(srv1_comm_t *x)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+
+   st->cap = srv1_capture_open(x->port);
+   if (st->cap == NULL)
+      {
+         return 0;
+      }
+   x->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (x->fd < 0)
+      {
+         perror("replay_open():timerfd_create()");
+         srv1_capture_close(st->cap);
+         st->cap = NULL;
+         return 0;
+      }
+   st->start = srv1_sched_now();
+   st->have = 0;
+   st->eof = 0;
+   return 1;
+}
+
+static int
+replay_attach(srv1_comm_t *x)
+{
+   return 1;
+}
+
+static void
+replay_detach(srv1_comm_t *x)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+   srv1_capture_close(st->cap);
+   st->cap = NULL;
+   st->eof = 1;
+   st->have = 0;
+}
+
+static int
+replay_read(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+
+   next_rx(st);
+   if (!st->have || st->due > srv1_sched_now())
+      {
+         errno = EAGAIN;
+         return -1;
+      }
+   uint32_t n = st->rec.len - st->off;
+   if (n > len)
+      {
+         n = len;
+      }
+   memcpy(buf, st->buf + st->off, n);
+   st->off += n;
+   if (st->off == st->rec.len)
+      {
+         st->have = 0;
+      }
+   return n;
+}
+
+static int
+replay_write(srv1_comm_t *x, const void *buf, uint32_t len, int64_t deadline)
+{
+   // The recording already has the robot's answers.
+   return len;
+}
+
+static int
+replay_wait(srv1_comm_t *x, int64_t deadline)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+
+   next_rx(st);
+   if (st->have && st->due <= deadline)
+      {
+         sleep_until(st->due);
+         return 1;
+      }
+   sleep_until(deadline);
+   return 0;
+}
+
+static void
+replay_prefetch(srv1_comm_t *x, void *buf, uint32_t len)
+{
+}
+
+static void
+replay_cancel(srv1_comm_t *x)
+{
+   // Nothing is in flight; undelivered bytes stay where they are.
+}
+
+static int
+replay_poll_fd(srv1_comm_t *x)
+{
+   return x->fd;
+}
+
+static int
+replay_flush(srv1_comm_t *x)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+   struct itimerspec its;
+   uint64_t expirations;
+
+   // Rearm the timer for the next bytes; ready() covers ones due already.
+   if (read(x->fd, &expirations, sizeof(expirations)) < 0)
+      {
+         // Not expired; nothing to clear.
+      }
+   memset(&its, 0, sizeof(its));
+   next_rx(st);
+   if (st->have && st->due > srv1_sched_now())
+      {
+         its.it_value.tv_sec = st->due / 1000000;
+         its.it_value.tv_nsec = (st->due % 1000000) * 1000;
+      }
+   return timerfd_settime(x->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int
+replay_ready(srv1_comm_t *x)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+   next_rx(st);
+   return st->have && st->due <= srv1_sched_now();
+}
+
+const srv1_transport_t srv1_replay_transport =
+   { "replay", replay_attach, replay_detach, replay_read, replay_write,
+         replay_wait, replay_prefetch, replay_cancel, replay_poll_fd,
+         replay_flush, replay_ready, replay_open };
+
+int
+srv1_use_replay(srv1_comm_t *x, double speed)
+{
+   if (x->fd != -1 || speed < 0.0)
+      {
+         return 0;
+      }
+
+   replay_io_t *st = (replay_io_t *) calloc(1, sizeof(replay_io_t));
+   if (st == NULL)
+      {
+         return 0;
+      }
+   st->speed = speed;
+   st->eof = 1;
+
+   free(x->io_state);
+   x->io_state = st;
+   x->io = &srv1_replay_transport;
+   return 1;
+}
+
+int
+srv1_replay_finished(srv1_comm_t *x)
+{
+   replay_io_t *st = (replay_io_t *) x->io_state;
+   if (x->io != &srv1_replay_transport)
+      {
+         return 0;
+      }
+   next_rx(st);
+   return !st->have && st->eof;
+}
@@ -0,0 +1,130 @@
+/*
+ * surveyor_capture.h
+ *
+ * Recording of serial traffic, and the transport that replays it.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_CAPTURE_H_
+#define SURVEYOR_CAPTURE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Capture file layout, in host byte order:
+ *
+ *   srv1_capture_header_t
+ *   srv1_capture_record_t, then len bytes    (repeated)
+ *
+ * Each record holds bytes that went one way in one read() or write(),
+ * split if longer than 65535, and the time since the record before it.
+ */
+#define SRV1_CAPTURE_MAGIC "SRV1CAP"
+#define SRV1_CAPTURE_VERSION 1
+
+/* Directions of a record. */
+#define SRV1_CAPTURE_RX 0
+#define SRV1_CAPTURE_TX 1
+
+/* Buffered before it reaches the file, so the link rarely waits on it. */
+#define SRV1_CAPTURE_BUFFER (256 * 1024)
+
+   /**
+    * @brief Start of a capture file.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         char magic[8]; ///< SRV1_CAPTURE_MAGIC, NUL padded
+         uint32_t version; ///< SRV1_CAPTURE_VERSION
+         uint32_t reserved; ///< 0
+         int64_t start; ///< Monotonic usec when recording started
+   } srv1_capture_header_t;
+
+   /**
+    * @brief Header of one record.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         uint32_t delta; ///< Usec since the previous record (or the start)
+         uint16_t len; ///< Bytes that follow
+         uint8_t dir; ///< SRV1_CAPTURE_RX or SRV1_CAPTURE_TX
+         uint8_t reserved; ///< 0
+   } srv1_capture_record_t;
+
+   /**
+    * @brief An open capture file, for writing or reading.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         FILE *f; ///< The file
+         int64_t last; ///< Monotonic usec of the last record (writing) or
+                       ///< its time since the start (reading)
+         uint32_t records; ///< Records written or read
+         int failed; ///< Writing failed; nothing more is recorded
+   } srv1_capture_t;
+
+   /*
+    * Creates (or truncates) a capture file at path.
+    * \return the capture, or NULL on error.
+    */
+   srv1_capture_t *
+   srv1_capture_create(const char *path);
+
+   /*
+    * Opens a capture file at path for reading and checks its header.
+    * \return the capture, or NULL on error.
+    */
+   srv1_capture_t *
+   srv1_capture_open(const char *path);
+
+   /*
+    * Flushes and closes c. Accepts NULL.
+    */
+   void
+   srv1_capture_close(srv1_capture_t *c);
+
+   /*
+    * Appends len bytes that went in direction dir at monotonic time now.
+    */
+   void
+   srv1_capture_write(srv1_capture_t *c, int dir, const void *data,
+         uint32_t len, int64_t now);
+
+   /*
+    * Reads the next record into buf, which must hold 65535 bytes; c->last
+    * becomes its time since the start of the recording.
+    * \return 1 for a record, 0 at the end of the file, -1 on a damaged file.
+    */
+   int
+   srv1_capture_read(srv1_capture_t *c, srv1_capture_record_t *rec,
+         void *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_CAPTURE_H_ */
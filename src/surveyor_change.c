@@ -0,0 +1,86 @@
+/*
+ * surveyor_change.c
+ *
+ * Detects camera frames that barely differ from the last one published.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_change.h"
+#include "surveyor_decode.h"
+
+#include <string.h>
+
+void
+srv1_change_init(srv1_change_t *c, double threshold, int64_t max_gap)
+{
+   memset(c, 0, sizeof(*c));
+   c->threshold = threshold;
+   c->max_gap = max_gap;
+}
+
+/* A plain loop GCC recognises as a sum of absolute differences and
+ * vectorises (psadbw on x86). */
+uint32_t
+srv1_sad(const unsigned char *a, const unsigned char *b, uint32_t n)
+{
+   uint32_t sum = 0;
+   uint32_t i;
+
+   for (i = 0; i < n; i++)
+      {
+         int d = a[i] - b[i];
+         sum += (uint32_t) (d < 0 ? -d : d);
+      }
+   return sum;
+}
+
+int
+srv1_change_test(srv1_change_t *c, const unsigned char *jpeg,
+      uint32_t size, int64_t now)
+{
+   unsigned char thumb[SRV1_CHANGE_THUMB_MAX];
+   uint32_t width, height, n;
+
+   if (!srv1_decode_thumbnail(jpeg, size, thumb, sizeof(thumb), &width,
+         &height))
+      {
+         c->valid = 0;
+         c->published++;
+         return 1;
+      }
+   n = width * height;
+
+   if (c->valid && width == c->width && height == c->height
+         && (c->max_gap == 0 || now - c->last_time < c->max_gap)
+         && srv1_sad(thumb, c->last, n) < c->threshold * n)
+      {
+         c->suppressed++;
+         return 0;
+      }
+
+   /* The reference only moves when a frame goes out, so a slow drift
+    * still adds up to a change. */
+   memcpy(c->last, thumb, n);
+   c->width = width;
+   c->height = height;
+   c->last_time = now;
+   c->valid = 1;
+   c->published++;
+   return 1;
+}
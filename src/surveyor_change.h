@@ -0,0 +1,82 @@
+/*
+ * surveyor_change.h
+ *
+ * Detects camera frames that barely differ from the last one published.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_CHANGE_H_
+#define SURVEYOR_CHANGE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/* Largest thumbnail compared, in pixels: a 1/8 scale 640x480 frame. */
+#define SRV1_CHANGE_THUMB_MAX (80 * 60)
+
+   /**
+    * @brief Decides which frames of a robot are worth publishing: those whose
+    * 1/8 scale greyscale thumbnail differs enough from the one last published,
+    * and in any case one every max_gap.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         double threshold; ///< Mean absolute difference per pixel that counts as a change
+         int64_t max_gap; ///< Longest time without publishing (usec; 0 = no limit)
+         unsigned char last[SRV1_CHANGE_THUMB_MAX]; ///< Thumbnail last published
+         uint32_t width; ///< Its width
+         uint32_t height; ///< Its height
+         int64_t last_time; ///< When it was published (monotonic usec)
+         int valid; ///< last holds a thumbnail
+         uint32_t published; ///< Frames let through
+         uint32_t suppressed; ///< Frames found unchanged
+   } srv1_change_t;
+
+   /*
+    * Sets the threshold (mean absolute difference per pixel, 0 to 255) and
+    * the longest gap between frames let through (usec; 0 = no limit).
+    */
+   void
+   srv1_change_init(srv1_change_t *c, double threshold, int64_t max_gap);
+
+   /*
+    * \return the sum of absolute differences of n bytes.
+    */
+   uint32_t
+   srv1_sad(const unsigned char *a, const unsigned char *b, uint32_t n);
+
+   /*
+    * Compares a JPEG taken at monotonic time now with the frame last let
+    * through. Frames that can't be compared (not decodable, or a new size)
+    * count as changed.
+    * \return 1 if the frame should be published, 0 if it should be dropped.
+    */
+   int
+   srv1_change_test(srv1_change_t *c, const unsigned char *jpeg,
+         uint32_t size, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_CHANGE_H_ */
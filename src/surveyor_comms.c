@@ -23,12 +23,15 @@
  */
 
 #include "surveyor_comms.h"
+#include "surveyor_log.h"
+#include "surveyor_lut.h"
 
 #include <errno.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <termios.h>
 #include <math.h>
 #include <stdio.h>
@@ -45,107 +48,367 @@ srv1_comm_t *
 srv1_create(const char *port)
 {
    srv1_comm_t *ret = (srv1_comm_t *) malloc(sizeof(srv1_comm_t));
+   if (ret == NULL)
+      {
+         return NULL;
+      }
+
+   // Every image buffer is allocated now; capturing never allocates.
+   if (!srv1_frame_pool_init(&ret->frames))
+      {
+         free(ret);
+         return NULL;
+      }
+
+   srv1_lut_init();
 
    ret->fd = -1;
+   ret->baud = SRV1_DEFAULT_BAUD;
    ret->image_mode = SRV1_IMAGE_OFF;
    ret->set_image_mode = SRV1_IMAGE_OFF;
    ret->need_ir = 0;
 
-   ret->frame_size = 0;
-
    ret->vx = 0.0;
    ret->va = 0.0;
+   ret->motor_left = 0;
+   ret->motor_right = 0;
+   ret->motors_known = 0;
+   ret->motors_acked = 0;
+   ret->motor_keepalive = 0;
 
    ret->frame = NULL;
+   ret->frame_seq = 0;
+   ret->pipeline = 0;
+   ret->image_pending = 0;
+   ret->image_sent = 0;
+
+   srv1_ring_reset(&ret->rx);
+   memset(&ret->parser, 0, sizeof(ret->parser));
+   srv1_parser_reset(&ret->parser);
+   ret->rx_frame = NULL;
+   ret->io = &srv1_posix_transport;
+   ret->io_state = NULL;
+   ret->io_calls = 0;
+   ret->capture = NULL;
+   ret->txn = SRV1_TXN_NONE;
+   ret->txn_want = SRV1_REPLY_NONE;
+   ret->txn_deadline = 0;
+   ret->txn_tries = 0;
+   ret->txn_seq = 0;
+   ret->txn_start = 0;
+   ret->txn_left = 0;
+   ret->txn_right = 0;
+   ret->image_follows = 0;
+   srv1_stats_reset(&ret->stats);
 
    strncpy(ret->port, port, sizeof(ret->port) - 1);
 
    return ret;
 }
 
-/* 
- * Flips non-blocking bit.
+/*
+ * Microseconds on the monotonic clock. Unlike gettimeofday() this never
+ * jumps when the wall clock is adjusted, so deadlines stay honest.
  */
-int
-flip_nonblock(int fd)
+static int64_t
+now_usec(void)
 {
-   int flags;
-   if ((flags = fcntl(fd, F_GETFL)) < 0)
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*
+ * Reads from the port through the transport, recording what arrives.
+ * \return like read().
+ */
+static int
+read_port(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   int readresult = x->io->read(x, buf, len);
+   if (x->capture != NULL && readresult > 0)
       {
-         perror("surveyor_flip_nonblock():fcntl():");
-         close(fd);
-         return -1;
+         srv1_capture_write(x->capture, SRV1_CAPTURE_RX, buf, readresult,
+               now_usec());
       }
+   return readresult;
+}
 
-   if (fcntl(fd, F_SETFL, flags ^ O_NONBLOCK) < 0)
+/*
+ * Pulls whatever the kernel has buffered for x->fd into the receive ring.
+ * \return bytes added (0 if nothing was waiting), -1 on error.
+ */
+static int
+fill_ring(srv1_comm_t *x)
+{
+   uint32_t space;
+   unsigned char *span = srv1_ring_write_span(&x->rx, &space);
+   if (space == 0)
       {
-         perror("surveyor_flip_nonblock():fcntl():");
-         close(fd);
+         return 0;
+      }
+
+   int readresult = read_port(x, span, space);
+   if (readresult < 0)
+      {
+         if (errno == EAGAIN || errno == EINTR)
+            {
+               return 0;
+            }
+         perror("fill_ring():read()");
          return -1;
       }
 
-   return 0;
+   srv1_ring_commit(&x->rx, readresult);
+   return readresult;
 }
 
-int32_t
-msecsub(struct timeval a, struct timeval b)
+/*
+ * Writes all of buf to the robot, waiting for room in the output queue if
+ * the port is backed up.
+ * \return bytes written, or -1 on error or timeout.
+ */
+int
+write_limited(srv1_comm_t *x, const char *buf, int bytes, int microsecs)
 {
-   return ((a.tv_sec - b.tv_sec) * 1000000) + (a.tv_usec - b.tv_usec);
+   // Every request is followed by reading its reply; transports that can
+   // start that read along with the write do so.
+   char *dst;
+   if (srv1_parser_payload_room(&x->parser, &dst) == 0)
+      {
+         uint32_t space;
+         unsigned char *span = srv1_ring_write_span(&x->rx, &space);
+         if (space > 0)
+            {
+               x->io->prefetch(x, span, space);
+            }
+      }
+
+   int written = x->io->write(x, buf, bytes, now_usec() + microsecs);
+   if (x->capture != NULL && written > 0)
+      {
+         srv1_capture_write(x->capture, SRV1_CAPTURE_TX, buf, written,
+               now_usec());
+      }
+   return written;
 }
 
-/* 
- * Reads b bytes from fd.  times out in s seconds, returning 0.
- * Buf needs to have enough space in it (non-checking)
+/*
+ * Bookkeeping for a reply the parser just completed, whoever was waiting for
+ * it: images get a pooled buffer and are committed, IR readings are stored.
+ * \return the reply type.
  */
-int
-read_limited(int fd, char *buf, int bytes, int microsecs)
+static int
+handle_reply(srv1_comm_t *x, srv1_reply_t *reply)
 {
-   flip_nonblock(fd);
+   switch (reply->type)
+      {
+   case SRV1_REPLY_IMAGE_START:
+      {
+         x->image_pending = 0;
+         srv1_frame_unref(x->rx_frame);
+         x->rx_frame = NULL;
+         if (reply->size > SRV1_FRAME_CAPACITY)
+            {
+               SRV1_LOG1(SRV1_LOG_WARN,
+                     "srv1: %u byte image exceeds frame buffer, dropping\n",
+                     reply->size);
+               break;
+            }
+         x->rx_frame = srv1_frame_acquire(&x->frames);
+         if (x->rx_frame == NULL)
+            {
+               SRV1_LOG0(SRV1_LOG_WARN,
+                     "srv1: no free frame buffer, dropping image\n");
+               break;
+            }
+         // The payload goes straight from the ring into the pooled buffer.
+         srv1_parser_set_sink(&x->parser, x->rx_frame->data, reply->size);
+         break;
+      }
+   case SRV1_REPLY_IMAGE:
+      if (x->rx_frame != NULL && reply->stored == reply->size
+            && !srv1_frame_is_jpeg(x->rx_frame->data, reply->size))
+         {
+            // Right length, wrong contents: bytes went missing and the
+            // length was made up from whatever followed.
+            srv1_stats_count(&x->stats.bad_frames, 1);
+            SRV1_LOG1(SRV1_LOG_WARN,
+                  "srv1: %u byte image isn't a whole JPEG, dropping\n",
+                  reply->size);
+            srv1_frame_unref(x->rx_frame);
+         }
+      else if (x->rx_frame != NULL && reply->stored == reply->size)
+         {
+            x->rx_frame->size = reply->size;
+            x->rx_frame->mode = x->set_image_mode;
+            x->rx_frame->seq = x->frame_seq++;
+            // The receive reference becomes the "latest frame" reference.
+            srv1_frame_unref(x->frame);
+            x->frame = x->rx_frame;
+         }
+      else
+         {
+            srv1_frame_unref(x->rx_frame);
+         }
+      x->rx_frame = NULL;
+      break;
+   case SRV1_REPLY_IR:
+      memcpy(x->bouncedir, reply->bouncedir, sizeof(x->bouncedir));
+      break;
+      }
 
-   struct timeval begin, now;
-   gettimeofday(&begin, NULL);
+   return reply->type;
+}
 
-   int needtoread = bytes;
-   int readresult;
+/*
+ * Gives up on the image whose body is being received. The rest of the body
+ * is drained as it arrives instead of parsed, so it can't pass for replies.
+ */
+static void
+abandon_image(srv1_comm_t *x)
+{
+   x->io->cancel(x);
+   uint32_t left = srv1_parser_drain(&x->parser);
+   x->drain_deadline = now_usec() + SRV1_DRAIN_USEC;
+   srv1_frame_unref(x->rx_frame);
+   x->rx_frame = NULL;
+   srv1_stats_count(&x->stats.truncated_frames, 1);
+   srv1_stats_count(&x->stats.drained_bytes, left);
+   SRV1_LOG1(SRV1_LOG_WARN, "srv1: image body timed out, draining %u bytes\n",
+         left);
+}
 
-   for (;;)
+/*
+ * Called when a reply doesn't come. Replies sent after an abandoned image
+ * queue up behind the rest of it, so that is expected for a while; but if
+ * the parser is still draining after SRV1_DRAIN_USEC, the rest isn't coming
+ * (or some of it got lost and the drain is eating what followed): start
+ * afresh.
+ */
+static void
+stop_draining(srv1_comm_t *x)
+{
+   if (x->parser.draining && now_usec() >= x->drain_deadline)
       {
-         gettimeofday(&now, NULL);
-         if (msecsub(now, begin) > microsecs)
-            {
-               printf(
-                     "read_limited():Warning: CARLOS timed out (%d microsecs).\n",
-                     msecsub(now, begin));
-               flip_nonblock(fd);
-               return (bytes - needtoread);
-            }
+         SRV1_LOG0(SRV1_LOG_WARN, "srv1: gave up draining an image\n");
+         srv1_parser_reset(&x->parser);
+      }
+}
+
+/*
+ * One non-blocking step of reading: feeds buffered bytes to the parser, or
+ * reads an image payload straight from the port into its frame buffer, or
+ * refills the receive ring. reply->type is set if a reply completed.
+ * \return 1 if progress was made, 0 if the port has nothing for us right
+ * now, -1 on error.
+ */
+static int
+pump(srv1_comm_t *x, srv1_reply_t *reply)
+{
+   uint32_t len;
+   const unsigned char *span = srv1_ring_read_span(&x->rx, &len);
+   char *dst;
+   uint32_t room;
+
+   reply->type = SRV1_REPLY_NONE;
+
+   if (len > 0)
+      {
+         srv1_ring_consume(&x->rx, srv1_parser_feed(&x->parser, span, len,
+               reply));
+         return 1;
+      }
 
-         if ((readresult = read(fd, buf + (bytes - needtoread), needtoread))
-               < 0)
+   if ((room = srv1_parser_payload_room(&x->parser, &dst)) > 0)
+      {
+         int readresult = read_port(x, dst, room);
+         if (readresult < 0)
             {
-               if (errno != EAGAIN)
+               if (errno != EAGAIN && errno != EINTR)
                   {
-                     perror("read_limited():read()");
-                     flip_nonblock(fd);
+                     perror("pump():read()");
                      return -1;
                   }
+               return 0;
             }
-         else
+         if (readresult > 0 && !srv1_parser_payload_commit(&x->parser,
+               readresult, reply))
             {
-               needtoread = needtoread - readresult;
-               if (needtoread == 0)
-                  {
-                     break;
-                  }
+               reply->type = SRV1_REPLY_NONE;
+            }
+         return readresult > 0;
+      }
+
+   int readresult = fill_ring(x);
+   return readresult < 0 ? -1 : readresult > 0;
+}
+
+/*
+ * Reads from the robot until a reply of type want completes or the deadline
+ * passes. Other replies met on the way are still handled (a pipelined image
+ * is kept, for instance), and garbage is skipped by the parser.
+ *
+ * The descriptor stays non-blocking; between reads we sleep in the
+ * transport's wait() until the port has data or the deadline passes.
+ *
+ * \return 1 if reply holds the wanted reply, 0 on timeout, -1 on error.
+ */
+static int
+await_reply(srv1_comm_t *x, int want, srv1_reply_t *reply, int microsecs)
+{
+   int64_t deadline = now_usec() + microsecs;
+   uint32_t skipped = x->parser.skipped;
+   int result = 0;
+
+   for (;;)
+      {
+         int progress = pump(x, reply);
+         if (progress < 0)
+            {
+               result = -1;
+               break;
+            }
+
+         if (reply->type != SRV1_REPLY_NONE && handle_reply(x, reply) == want)
+            {
+               result = 1;
+               break;
             }
 
-         usleep(20);
+         if (progress > 0 && now_usec() < deadline)
+            {
+               continue;
+            }
+
+         int ready = x->io->wait(x, deadline);
+         if (ready <= 0)
+            {
+               result = ready;
+               break;
+            }
       }
 
-   flip_nonblock(fd);
-   return bytes;
+   if (x->parser.skipped != skipped)
+      {
+         srv1_stats_count(&x->stats.skipped_bytes, x->parser.skipped - skipped);
+         SRV1_LOG1(SRV1_LOG_WARN, "srv1: resynchronized, skipped %u bytes\n",
+               x->parser.skipped - skipped);
+      }
+   if (result == 0)
+      {
+         stop_draining(x);
+         srv1_stats_count(&x->stats.timeouts, 1);
+         SRV1_LOG1(SRV1_LOG_WARN,
+               "await_reply():Warning: CARLOS timed out (%d microsecs).\n",
+               microsecs);
+      }
+   return result;
 }
 
+static void
+settle_link(srv1_comm_t *x);
+
 /* 
  * Flushes input buffer.
  * \return number of bytes discarded.
@@ -153,12 +416,64 @@ read_limited(int fd, char *buf, int bytes, int microsecs)
 int
 srv1_flush_input(srv1_comm_t *x)
 {
-   int res;
+   int res = 0;
    ioctl(x->fd, TIOCINQ, (char *) &res);
+   x->io->cancel(x);
    tcflush(x->fd, TCIFLUSH);
+   srv1_parser_reset(&x->parser);
+   srv1_frame_unref(x->rx_frame);
+   x->rx_frame = NULL;
+   res += srv1_ring_discard(&x->rx);
+   srv1_stats_count(&x->stats.flushed_bytes, res);
    return res;
 }
 
+/* Line rates the serial port can be set to, fastest first: the order
+ * srv1_init() probes them in. */
+static const struct
+{
+      long baud;
+      speed_t speed;
+} line_rates[] =
+   {
+#ifdef B921600
+      { 921600, B921600 },
+#endif
+#ifdef B460800
+      { 460800, B460800 },
+#endif
+#ifdef B230400
+      { 230400, B230400 },
+#endif
+      { 115200, B115200 } };
+
+#define NUM_LINE_RATES (sizeof(line_rates) / sizeof(line_rates[0]))
+
+/*
+ * Looks up the termios speed for baud.
+ * \return 1 if the port supports it, 0 if not.
+ */
+static int
+line_speed(long baud, speed_t *speed)
+{
+   for (size_t i = 0; i < NUM_LINE_RATES; i++)
+      {
+         if (line_rates[i].baud == baud)
+            {
+               *speed = line_rates[i].speed;
+               return 1;
+            }
+      }
+   return 0;
+}
+
+int
+srv1_baud_supported(long baud)
+{
+   speed_t speed;
+   return line_speed(baud, &speed);
+}
+
 int
 srv1_open(srv1_comm_t *x)
 {
@@ -166,9 +481,28 @@ srv1_open(srv1_comm_t *x)
    struct termios term;
    //	int flags;
    int fd;
+   speed_t speed;
 
    printf("Opening connection to Surveyor on %s...", x->port);
 
+   // Not a serial port: the transport knows what to open.
+   if (x->io->open != NULL)
+      {
+         if (!x->io->open(x) || !x->io->attach(x))
+            {
+               return 0;
+            }
+         puts("Done.");
+         return 1;
+      }
+
+   // Probing starts at the default rate; srv1_init() moves on from there.
+   if (!line_speed(x->baud != 0 ? x->baud : SRV1_DEFAULT_BAUD, &speed))
+      {
+         printf("surveyor_open(): %ld baud is not supported!\n", x->baud);
+         return 0;
+      }
+
    // CARLOS: this was wrong, so it's corrected now:
    //   if ((fd = open(x->port, O_RDWR | O_NONBLOCK, S_IRUSR, S_IWUSR)) < 0)
    if ((fd = open(x->port, O_RDWR | O_NONBLOCK, 00644)) < 0)
@@ -192,8 +526,8 @@ srv1_open(srv1_comm_t *x)
       }
 
    cfmakeraw(&term);
-   cfsetispeed(&term, B115200);
-   cfsetospeed(&term, B115200);
+   cfsetispeed(&term, speed);
+   cfsetospeed(&term, speed);
 
    if (tcsetattr(fd, TCSAFLUSH, &term) < 0)
       {
@@ -202,13 +536,20 @@ srv1_open(srv1_comm_t *x)
          return 0;
       }
 
-   /* Let's set blocking for now. */
-   flip_nonblock(fd);
-
-   puts("Done.");
+   // The port stays non-blocking: await_reply() and write_limited() wait
+   // in poll() (or io_uring) instead.
 
    x->fd = fd;
 
+   if (!x->io->attach(x))
+      {
+         printf("can't use the %s transport, falling back to posix...",
+               x->io->name);
+         x->io = &srv1_posix_transport;
+      }
+
+   puts("Done.");
+
    return 1;
 }
 
@@ -218,106 +559,170 @@ srv1_close(srv1_comm_t *x)
    printf("\nNow closing: srv1_close()\n");
    srv1_set_speed(x, 0, 0);
 
+   x->io->detach(x);
    close(x->fd);
+   x->fd = -1;
 }
 
 void
 srv1_destroy(srv1_comm_t *x)
 {
-   if (x->frame != NULL)
-      {
-         free(x->frame);
-      }
-
    if (x->fd != -1)
       {
          srv1_close(x);
       }
 
+   srv1_frame_unref(x->rx_frame);
+   srv1_frame_unref(x->frame);
+   srv1_frame_pool_destroy(&x->frames);
+   free(x->io_state);
+   srv1_capture_close(x->capture);
+
    free(x);
    return;
 }
 
 int
-srv1_init(srv1_comm_t *x)
+srv1_record(srv1_comm_t *x, const char *path)
 {
-   assert(x);
+   srv1_capture_t *c = srv1_capture_create(path);
+   if (c == NULL)
+      {
+         return 0;
+      }
+   srv1_capture_close(x->capture);
+   x->capture = c;
+   return 1;
+}
 
-   if (srv1_open(x) == 0)
+/*
+ * Switches the open serial port to baud, throwing away anything received
+ * at the old rate.
+ * \return 1 for success, 0 for failure.
+ */
+static int
+set_line_rate(srv1_comm_t *x, long baud)
+{
+   struct termios term;
+   speed_t speed;
+
+   if (!line_speed(baud, &speed))
       {
-         // Error. srv1_open handles half-open closing.
          return 0;
       }
+   if (tcgetattr(x->fd, &term) < 0)
+      {
+         perror("set_line_rate():tcgetattr():");
+         return 0;
+      }
+   cfsetispeed(&term, speed);
+   cfsetospeed(&term, speed);
+   // TCSADRAIN: whatever was written at the old rate goes out at it.
+   if (tcsetattr(x->fd, TCSADRAIN, &term) < 0)
+      {
+         perror("set_line_rate():tcsetattr():");
+         return 0;
+      }
+   srv1_flush_input(x);
+   return 1;
+}
 
-   // Check to see that we can communicate by sending a #V
-   char buf[256];
-   if (write(x->fd, "V", 1) < 0)
+/*
+ * Sends 'V' and waits up to microsecs for the version line.
+ * \return 1 if it arrived, 0 for failure.
+ */
+static int
+query_version(srv1_comm_t *x, srv1_reply_t *reply, int microsecs)
+{
+   if (write_limited(x, "V", 1, 500000) < 0)
       {
          printf("srv1_init(): can't write to port %s!\n", x->port);
          return 0;
       }
+   return await_reply(x, SRV1_REPLY_VERSION, reply, microsecs) == 1;
+}
 
-   int spot = 0;
-   memset(buf, 0, 256);
-   //	while(buf[spot-1] != '\n') { // CARLOS: Changed the array subscript that was below array bounds
-   //		int num = read(x->fd, buf + spot, 1);
-   //		if (num != 1) {
-   //			printf("srv1_init(): Can't read a byte from surveyor!\n");
-   //			return 0;
-   //		}
-   //		spot++;
-   //	}
+/*
+ * Finds the rate the robot's radio runs at: tries every line rate, fastest
+ * first, and keeps the first that answers SRV1_BAUD_PROBES version queries
+ * in a row. At a wrong rate the 'V' reaches the robot as noise.
+ * \return 1 with x->baud set, 0 if no rate answered.
+ */
+static int
+probe_baud(srv1_comm_t *x, srv1_reply_t *reply)
+{
+   for (size_t i = 0; i < NUM_LINE_RATES; i++)
+      {
+         int answered = 0;
 
-   //	CARLOS: fixed:
-   do
-      { // CARLOS: Changed the array subscript that was below array bounds
-         int num = read(x->fd, buf + spot, 1);
-         if (num != 1)
+         if (!set_line_rate(x, line_rates[i].baud))
             {
-               printf("srv1_init(): Can't read a byte from surveyor!\n");
                return 0;
             }
-         spot++;
-      }
-   while (buf[spot - 1] != '\n');
-
-   // Original was:
-   //   while (buf[spot - 1] != '\n')
-   //      {
-   //         int num = read(x->fd, buf + spot, 1);
-   //         if (num != 1)
-   //            {
-   //               printf("srv1_init(): Can't read a byte from surveyor!\n");
-   //               return 0;
-   //            }
-   //         spot++;
-   //      }
+         while (answered < SRV1_BAUD_PROBES
+               && query_version(x, reply, 500000))
+            {
+               answered++;
+            }
+         SRV1_LOG2(SRV1_LOG_DEBUG, "srv1: %ld baud: %d version replies\n",
+               line_rates[i].baud, answered);
+         if (answered == SRV1_BAUD_PROBES)
+            {
+               x->baud = line_rates[i].baud;
+               // The timeouts and noise at the wrong rates say nothing
+               // about the link.
+               srv1_stats_reset(&x->stats);
+               return 1;
+            }
+      }
+   return 0;
+}
+
+int
+srv1_init(srv1_comm_t *x)
+{
+   assert(x);
+
+   if (srv1_open(x) == 0)
+      {
+         // Error. srv1_open handles half-open closing.
+         return 0;
+      }
+
+   // Check to see that we can communicate by sending a #V. Transports
+   // that open something other than a tty have no rate to find.
+   srv1_reply_t reply;
+   if (x->baud == 0 && x->io->open == NULL)
+      {
+         if (!probe_baud(x, &reply))
+            {
+               printf("srv1_init(): surveyor answers at no supported rate!\n");
+               return 0;
+            }
+         printf("srv1_init(): %s answers at %ld baud\n", x->port, x->baud);
+      }
+   else if (!query_version(x, &reply, 2000000))
+      {
+         printf("srv1_init(): no version reply from surveyor!\n");
+         return 0;
+      }
+
    // Print the version number
-   printf("srv1_init(): successful init. HW %s", buf + 2);
+   printf("srv1_init(): successful init. HW %s", reply.text + 2);
 
    return 1;
 }
 
+/*
+ * Reference implementation of the speed model; srv1_set_speed() uses the
+ * tables in surveyor_lut.c, which give identical results.
+ */
 double
 calc_forward(signed char speed)
 {
-   unsigned char speedg = (speed > 0 ? speed : -speed);
-   if (speedg < 20)
-      {
-         return 0;
-      }
-   double i3 = 5.5277e-7;
-   double j3 = -0.00016261;
-   double k3 = 0.01628;
-   double l3 = -0.26129;
-   // third order is ultra-small... probably second-order.
-   double x = k3 * speedg;
-   double y = j3 * speedg * speedg;
-   double z = i3 * speedg * speedg * speedg;
-   double result = l3 + x + y + z;
-   printf("calc_forward(%d) = %f + %f + %f + %f = %f\n", speed, l3, x, y, z,
-         result);
-   return (speed > 0 ? result : -result);
+   double result = srv1_forward_model(speed);
+   SRV1_LOG2(SRV1_LOG_TRACE, "calc_forward(%d) = %f\n", speed, result);
+   return result;
 }
 
 signed char
@@ -325,7 +730,8 @@ calc_speed_hackish(double dx)
 {
    if (fabs(dx) > SRV1_MAX_VEL_X)
       {
-         printf("srv1_set_speed(): warning: speed out of range.\n");
+         SRV1_LOG0(SRV1_LOG_WARN,
+               "srv1_set_speed(): warning: speed out of range.\n");
          return (dx > 0.0 ? 127 : -127);
       }
 
@@ -350,8 +756,8 @@ double
 calc_angular(int left, int right)
 {
    double basis = 0.234;
-   printf("calc_angular(%d, %d) = %f\n", left, right, (calc_forward(right)
-         - calc_forward(left)) / basis);
+   SRV1_LOG3(SRV1_LOG_TRACE, "calc_angular(%d, %d) = %f\n", left, right,
+         (calc_forward(right) - calc_forward(left)) / basis);
    return (calc_forward(right) - calc_forward(left)) / basis;
 }
 
@@ -464,7 +870,7 @@ calc_rot_hackish(double dx, signed char *left, signed char *right)
    if (((r == 127) || (r == -127) || (l == 127) || (l == -127)) && (fabs(dx
          - calc_angular(l, r)) > 0.01))
       {
-         printf(
+         SRV1_LOG2(SRV1_LOG_WARN,
                "srv1_set_speed(): warning: can't achieve %f rotation. got %f.\n",
                dx, calc_angular(l, r));
       }
@@ -473,24 +879,15 @@ calc_rot_hackish(double dx, signed char *left, signed char *right)
    *left = l;
 }
 
-int
-srv1_set_motors(srv1_comm_t *x, signed char l, signed char r, double t)
+/*
+ * Sends 'Mabc' without waiting for the acknowledgement, followed by an 'I'
+ * in the same write if image is set.
+ * \return 1 for success, 0 for failure.
+ */
+static int
+write_motors(srv1_comm_t *x, signed char l, signed char r, char runtime,
+      int image)
 {
-   char cmdbuf[4];
-   //	float timeunits;
-   char runtime;
-
-   //	timeunits = t * 100;
-   //	if (timeunits > 255) {
-   //		runtime = 255;
-   //	} else if (timeunits < 0) {
-   //		runtime = 0;
-   //	} else {
-   //		runtime = timeunits;
-   //	}
-
-   runtime = 0; // CARLOS: forcing an indefinite duration
-
    // Command:    'Mabc'
    //	direct motor control
    //	'abc' parameters sent as 8-bit binary
@@ -503,57 +900,221 @@ srv1_set_motors(srv1_comm_t *x, signed char l, signed char r, double t)
    //      e.g. the decimal equivalent of the 4-byte sequence 0x4D 0x32 0xCE 0x14 = 'M' 50 -50 20 (rotate right for 200ms)
    //
    //	duration of 00 is infinite, e.g. the 4-byte sequence 0x4D 0x32 0x32 0x00 = M 50 50 00 (drive forward at 50% indefinitely)
+   char cmdbuf[5];
    cmdbuf[0] = 'M';
    cmdbuf[1] = l;
    cmdbuf[2] = r;
    cmdbuf[3] = runtime;
+   cmdbuf[4] = 'I';
+
+   return write_limited(x, cmdbuf, image ? 5 : 4, 250000) >= 0;
+}
 
-   if (write(x->fd, cmdbuf, 4) < 0)
+/*
+ * Remembers whether the robot acknowledged wheel speeds l, r, so that
+ * srv1_speed_unchanged() can tell a command that changes nothing.
+ */
+static void
+record_motors(srv1_comm_t *x, int ok, signed char l, signed char r)
+{
+   x->motors_known = ok;
+   if (ok)
+      {
+         x->motor_left = l;
+         x->motor_right = r;
+         x->motors_acked = now_usec();
+      }
+}
+
+int
+srv1_set_motors(srv1_comm_t *x, signed char l, signed char r, double t)
+{
+   //	float timeunits;
+   char runtime;
+
+   //	timeunits = t * 100;
+   //	if (timeunits > 255) {
+   //		runtime = 255;
+   //	} else if (timeunits < 0) {
+   //		runtime = 0;
+   //	} else {
+   //		runtime = timeunits;
+   //	}
+
+   runtime = 0; // CARLOS: forcing an indefinite duration
+
+   settle_link(x);
+
+   int64_t start = now_usec();
+   if (!write_motors(x, l, r, runtime, 0))
       {
          // TODO: do something useful
          //		return 0;   // CARLOS: thinks this should be commented this out here
       }
 
    // Response:   '#M'
-   if (read_limited(x->fd, cmdbuf, 2, 250000) == 2)
+   // Anything else in the way is skipped by the parser; no need to flush.
+   srv1_reply_t reply;
+   if (await_reply(x, SRV1_REPLY_MOTORS, &reply, 250000) == 1)
       {
-         if (cmdbuf[0] == '#' && cmdbuf[1] == 'M')
-            {
-               return 1;
-            }
-         printf("srv1_set_speed(): warning: failed response: %c%c!!!\n",
-               cmdbuf[0], cmdbuf[1]);
-         int bytes = srv1_flush_input(x);
-         printf("srv1: flushed %d bytes from input buffer\n", bytes);
-         //		return 0;   // CARLOS: thinks this should be commented this out here
+         srv1_stats_latency(&x->stats, SRV1_TXN_MOTORS, now_usec() - start);
+         record_motors(x, 1, l, r);
+         return 1;
       }
+   record_motors(x, 0, l, r);
+   SRV1_LOG0(SRV1_LOG_WARN, "srv1_set_speed(): warning: no '#M' response!!!\n");
 
    return 0;
 }
 
-int
-srv1_set_speed(srv1_comm_t *x, double dx, double dw)
+/*
+ * Converts a velocity into wheel speeds and records the velocity that will
+ * actually be achieved in x->vx and x->va.
+ */
+static void
+motor_speeds(srv1_comm_t *x, double dx, double dw, signed char *left,
+      signed char *right)
 {
-
    signed char leftspeed;
    signed char rightspeed;
 
-   printf("srv1_set_speed(): debug: dx: %2.2f dw: %2.2f\n", dx, dw);
-   leftspeed = calc_speed_hackish(dx);
+   SRV1_LOG2(SRV1_LOG_DEBUG, "srv1_set_speed(): debug: dx: %2.2f dw: %2.2f\n",
+         dx, dw);
+   if (fabs(dx) > SRV1_MAX_VEL_X)
+      {
+         SRV1_LOG0(SRV1_LOG_WARN,
+               "srv1_set_speed(): warning: speed out of range.\n");
+      }
+
+   // Table lookups; same answers as calc_speed_hackish()/calc_rot_hackish().
+   signed char speed = srv1_lut_speed(dx);
 
-   rightspeed = leftspeed;
+   x->vx = srv1_lut_forward(speed);
 
-   x->vx = calc_forward(leftspeed);
+   if (srv1_lut_rot(dw, speed, &leftspeed, &rightspeed))
+      {
+         SRV1_LOG2(SRV1_LOG_WARN,
+               "srv1_set_speed(): warning: can't achieve %f rotation. got %f.\n",
+               dw, srv1_lut_angular(leftspeed, rightspeed));
+      }
 
-   calc_rot_hackish(dw, &leftspeed, &rightspeed);
+   x->va = srv1_lut_angular(leftspeed, rightspeed);
 
-   x->va = calc_angular(leftspeed, rightspeed);
+   *left = leftspeed;
+   *right = rightspeed;
+}
+
+int
+srv1_set_speed(srv1_comm_t *x, double dx, double dw)
+{
+   signed char leftspeed;
+   signed char rightspeed;
+
+   motor_speeds(x, dx, dw, &leftspeed, &rightspeed);
 
    // The SRV-1 speed gets actually set here
    // Moving the motors for an indefinitely amount of time (0.0)
    return srv1_set_motors(x, leftspeed, rightspeed, 0.0);
 }
 
+/*
+ * Sends an 'I' so the robot starts capturing and streaming the next frame.
+ */
+static int
+request_image(srv1_comm_t *x)
+{
+   x->image_sent = now_usec();
+   if (write_limited(x, "I", 1, 500000) < 0)
+      {
+         // TODO: do something with this
+         return 0;
+      }
+   x->image_pending = 1;
+   return 1;
+}
+
+/*
+ * Reads the reply to an outstanding (or freshly sent) 'I' into a free pooled
+ * buffer, so the last complete frame is never overwritten while it may still
+ * be in use. On success x->frame refers to the new frame.
+ */
+static int
+receive_image(srv1_comm_t *x)
+{
+   srv1_reply_t reply;
+   int tries = 1;
+   for (;;)
+      {
+         if (!x->image_pending && !request_image(x))
+            {
+               return 0;
+            }
+
+         SRV1_LOG0(SRV1_LOG_DEBUG, "srv1_fill_image(): getting spec.\n");
+
+         int done = await_reply(x, SRV1_REPLY_IMAGE_START, &reply, 500000);
+         if (done < 0)
+            {
+               return 0;
+            }
+         if (done == 1)
+            {
+               break;
+            }
+
+         // The request or its reply got lost; ask again.
+         x->image_pending = 0;
+         if (tries < SRV1_IMAGE_TRIES)
+            {
+               tries++;
+               srv1_stats_count(&x->stats.image_retries, 1);
+               // Try again!
+               continue;
+            }
+         // give up!
+         SRV1_LOG1(SRV1_LOG_WARN,
+               "srv1_fill_image(): didn't get spec after %d tries.\n", tries);
+         return 0;
+      }
+
+   SRV1_LOG2(SRV1_LOG_DEBUG,
+         "srv1_fill_image(): spec: mode '%c', frame_size = %u\n", reply.mode,
+         reply.size);
+
+   // 1.5 secs is long enough.
+   uint32_t seq = x->frame_seq;
+   if (await_reply(x, SRV1_REPLY_IMAGE, &reply, 1500000) != 1)
+      {
+         abandon_image(x);
+         return 0;
+      }
+
+   // CARLOS: explicitly, writing image to file (for testing only)
+   //	savePhoto("x", x->frame->data, x->frame->size);
+
+   // handle_reply() committed the frame unless it had nowhere to put it.
+   if (x->frame_seq == seq)
+      {
+         return 0;
+      }
+   srv1_stats_latency(&x->stats, SRV1_TXN_IMAGE, now_usec() - x->image_sent);
+   return 1;
+}
+
+/*
+ * If an 'I' is still in flight its reply is next on the wire, so read it
+ * before sending anything that expects a different answer.
+ */
+static void
+settle_link(srv1_comm_t *x)
+{
+   if (x->image_pending && !receive_image(x))
+      {
+         SRV1_LOG0(SRV1_LOG_WARN,
+               "srv1: lost pipelined image while settling the link\n");
+      }
+}
+
 int
 srv1_fill_image(srv1_comm_t *x)
 {
@@ -561,42 +1122,41 @@ srv1_fill_image(srv1_comm_t *x)
    // CARLOS: pause for debugging and see what picture should be taking:
    //   std::cin.ignore();
 
-   char specbuf[10];
-
-   memset(specbuf, 0, 10);
-
    if (x->set_image_mode != x->image_mode)
       {
+         settle_link(x);
+
          if (x->image_mode != SRV1_IMAGE_OFF)
             {
-               printf("srv1_fill_image(): setting image mode '%c'\n",
+               SRV1_LOG1(SRV1_LOG_INFO,
+                     "srv1_fill_image(): setting image mode '%c'\n",
                      x->image_mode);
-               if (write(x->fd, &(x->image_mode), 1) < 0)
+               int64_t start = now_usec();
+               if (write_limited(x, (char *) &(x->image_mode), 1, 500000) < 0)
                   {
                      return 0;
                   }
 
-               int done = read_limited(x->fd, specbuf, 2, 500000);
-
-               if (done != 2)
+               srv1_reply_t reply;
+               if (await_reply(x, SRV1_REPLY_MODE, &reply, 500000) != 1)
                   {
                      // TODO: do something more important
-                     int btsdead = srv1_flush_input(x);
-                     printf("srv1_fill_image(): discarded %d bytes.\n", btsdead);
+                     SRV1_LOG0(SRV1_LOG_WARN,
+                           "srv1_fill_image(): no response from image size set\n");
                      return 0;
                   }
 
-               if (specbuf[0] != '#' || specbuf[1] != x->image_mode)
+               if (reply.mode != x->image_mode)
                   {
-                     printf(
-                           "srv1_fill_image(): didn't get correct response from image size set: %s\n",
-                           specbuf);
-                     int btsdead = srv1_flush_input(x);
-                     printf("srv1_fill_image(): discarded %d bytes.\n", btsdead);
+                     SRV1_LOG1(SRV1_LOG_WARN,
+                           "srv1_fill_image(): didn't get correct response from image size set: #%c\n",
+                           reply.mode);
                      return 0;
                   }
                else
                   {
+                     srv1_stats_latency(&x->stats, SRV1_TXN_MODE, now_usec()
+                           - start);
                      x->set_image_mode = x->image_mode;
                   }
             }
@@ -610,133 +1170,366 @@ srv1_fill_image(srv1_comm_t *x)
       {
          return 1;
       }
-   printf("srv1_fill_image(): Image Mode '%c'\n", x->set_image_mode);
-   int tries = 1;
-   for (;;)
+   SRV1_LOG1(SRV1_LOG_DEBUG, "srv1_fill_image(): Image Mode '%c'\n",
+         x->set_image_mode);
+
+   if (!receive_image(x))
       {
-         if (write(x->fd, "I", 1) < 0)
-            {
-               // TODO: do something with this
-               return 0;
-            }
+         return 0;
+      }
 
-         printf("srv1_fill_image(): getting spec.\n");
+   // Pipelined: the robot captures and streams the next frame while the
+   // caller publishes this one and sleeps, instead of the link sitting idle.
+   // Only when there is somewhere to put it, though.
+   if (x->pipeline && srv1_frame_pool_free(&x->frames) > 0)
+      {
+         request_image(x);
+      }
 
-         memset(specbuf, 0, 10);
-         int done = read_limited(x->fd, specbuf, 10, 500000);
+   return 1;
+}
 
-         if (done != 10)
-            {
-               int btsdead = srv1_flush_input(x);
-               if (tries < 10)
-                  {
-                     tries++;
-                     // Try again!
-                     continue;
-                  }
-               // give up!
-               printf(
-                     "srv1_fill_image(): didn't get spec (got %d bytes: %s). flushed %d bytes.\n",
-                     done, specbuf, btsdead);
-               return 0;
-            }
-         else
-            {
-               break;
-            }
+int
+srv1_fill_ir(srv1_comm_t *x)
+{
+   settle_link(x);
+
+   int64_t start = now_usec();
+   if (write_limited(x, "B", 1, 500000) < 0)
+      {
+         return 0;
       }
 
-   if (strncmp("##IMJ", specbuf, 5) != 0)
+   // handle_reply() stores the readings in x->bouncedir.
+   srv1_reply_t reply;
+   if (await_reply(x, SRV1_REPLY_IR, &reply, 500000) != 1)
       {
-         int btsdead = srv1_flush_input(x);
-         printf("srv1_fill_image(): incorrect response from I, flushed %d\n",
-               btsdead);
+         // TODO: do something more important
+         SRV1_LOG0(SRV1_LOG_WARN, "srv1_fill_ir(): no IR reply.\n");
          return 0;
       }
-   int s0 = (unsigned char) specbuf[6];
-   int s1 = (unsigned char) specbuf[7];
-   int s2 = (unsigned char) specbuf[8];
-   int s3 = (unsigned char) specbuf[9];
+   srv1_stats_latency(&x->stats, SRV1_TXN_IR, now_usec() - start);
+
+   return 1;
+}
+
+int
+srv1_read_sensors(srv1_comm_t *x)
+{
+
+   // CARLOS: Needs to handle returns (1: success), (0: error)
+   srv1_fill_image(x);
+   //	srv1_fill_ir(x);  // CARLOS: not tested yet
 
-   x->frame_size = s0 + (s1 * 256) + (s2 * 256 * 256) + (s3 * 256 * 256 * 256);
+   return 1;
+}
 
-   printf("srv1_fill_image(): specbuf: %c%c%c%c%c%c\n", specbuf[0], specbuf[1],
-         specbuf[2], specbuf[3], specbuf[4], specbuf[5]);
-   printf(
-         "srv1_fill_image(): frame_size = %d + (%d * 256) + (%d * 256 * 256) + (%d * 256 * 256 * 256) = %d\n",
-         s0, s1, s2, s3, x->frame_size);
-   //	printf("srv1_fill_image(): spec size %d\n", x->frame_size);
+/*
+ * Marks a transaction as in flight: it is complete once a reply of type want
+ * arrives, and fails if none has by the deadline. Callers set x->txn_start
+ * before sending the request.
+ */
+static void
+begin_txn(srv1_comm_t *x, int txn, int want, int microsecs)
+{
+   x->txn = txn;
+   x->txn_want = want;
+   x->txn_deadline = now_usec() + microsecs;
+}
 
+/*
+ * Sends the motor command for dx, dw, and an image request with it if image
+ * is set, and starts waiting for the '#M'.
+ */
+static int
+begin_motors(srv1_comm_t *x, double dx, double dw, int image)
+{
+   assert(x->txn == SRV1_TXN_NONE);
 
-   if (x->frame == NULL)
+   motor_speeds(x, dx, dw, &x->txn_left, &x->txn_right);
+   x->txn_start = now_usec();
+   if (!write_motors(x, x->txn_left, x->txn_right, 0, image))
       {
-         x->frame = (char *) malloc(x->frame_size);
+         return 0;
       }
-   else
+   x->image_follows = image;
+   if (image)
       {
-         x->frame = (char *) realloc(x->frame, x->frame_size);
+         x->image_sent = x->txn_start;
+         x->image_pending = 1;
       }
+   begin_txn(x, SRV1_TXN_MOTORS, SRV1_REPLY_MOTORS, 250000);
+   return 1;
+}
 
-   // 1.5 secs is long enough.
-   read_limited(x->fd, x->frame, x->frame_size, 1500000);
+int
+srv1_begin_speed(srv1_comm_t *x, double dx, double dw)
+{
+   return begin_motors(x, dx, dw, 0);
+}
 
-   // CARLOS: explicitly, writing image to file (for testing only)
-   //	savePhoto("x", x->frame, x->frame_size);
+int
+srv1_begin_speed_image(srv1_comm_t *x, double dx, double dw)
+{
+   assert(x->set_image_mode == x->image_mode
+         && x->image_mode != SRV1_IMAGE_OFF);
 
-   return 1;
+   return begin_motors(x, dx, dw, 1);
 }
 
 int
-srv1_fill_ir(srv1_comm_t *x)
+srv1_speed_unchanged(srv1_comm_t *x, double dx, double dw)
 {
-   if (write(x->fd, "B", 1) < 0)
+   signed char leftspeed;
+   signed char rightspeed;
+
+   if (!x->motors_known || x->motor_keepalive <= 0
+         || now_usec() - x->motors_acked >= x->motor_keepalive)
       {
          return 0;
       }
 
-   char buf[80]; // Real length: 13 for header + 32 for chars.
-   memset(buf, 0, 80);
-   int done = read_limited(x->fd, buf, 46, 500000);
+   double vx = x->vx;
+   double va = x->va;
+   motor_speeds(x, dx, dw, &leftspeed, &rightspeed);
+   x->vx = vx;
+   x->va = va;
+   return leftspeed == x->motor_left && rightspeed == x->motor_right;
+}
 
-   if (done != 46)
+int
+srv1_begin_image(srv1_comm_t *x)
+{
+   assert(x->txn == SRV1_TXN_NONE);
+
+   if (x->set_image_mode != x->image_mode)
+      {
+         if (x->image_mode == SRV1_IMAGE_OFF)
+            {
+               x->set_image_mode = SRV1_IMAGE_OFF;
+               return 0;
+            }
+         x->txn_start = now_usec();
+         if (write_limited(x, (char *) &(x->image_mode), 1, 500000) < 0)
+            {
+               return 0;
+            }
+         begin_txn(x, SRV1_TXN_MODE, SRV1_REPLY_MODE, 500000);
+         return 1;
+      }
+
+   if (x->set_image_mode == SRV1_IMAGE_OFF || !request_image(x))
       {
-         // TODO: do something more important
-         int btsdead = srv1_flush_input(x);
-         printf("srv1_fill_ir(): discarded %d bytes.\n", btsdead);
          return 0;
       }
+   x->txn_tries = 1;
+   x->txn_seq = x->frame_seq;
+   begin_txn(x, SRV1_TXN_IMAGE, SRV1_REPLY_IMAGE_START, 500000);
+   return 1;
+}
+
+int
+srv1_begin_ir(srv1_comm_t *x)
+{
+   assert(x->txn == SRV1_TXN_NONE);
 
-   if (strncmp(buf, "##BounceIR - ", 13) != 0)
+   x->txn_start = now_usec();
+   if (write_limited(x, "B", 1, 500000) < 0)
       {
-         int btsdead = srv1_flush_input(x);
-         printf(
-               "srv1_fill_ir(): IR return had wrong header '%s', discarded %d bytes.\n",
-               buf, btsdead);
          return 0;
       }
+   begin_txn(x, SRV1_TXN_IR, SRV1_REPLY_IR, 500000);
+   return 1;
+}
 
-   sscanf(buf + 13, "%x", &(x->bouncedir[0]));
-   sscanf(buf + 21, "%x", &(x->bouncedir[1]));
-   sscanf(buf + 29, "%x", &(x->bouncedir[2]));
-   sscanf(buf + 37, "%x", &(x->bouncedir[3]));
+/*
+ * Moves the transaction in flight on after the reply it was waiting for.
+ * \return 1 if the transaction is now complete.
+ */
+static int
+advance_txn(srv1_comm_t *x, const srv1_reply_t *reply, int *ok)
+{
+   switch (x->txn)
+      {
+   case SRV1_TXN_MODE:
+      *ok = (reply->mode == x->image_mode);
+      if (*ok)
+         {
+            x->set_image_mode = x->image_mode;
+         }
+      else
+         {
+            SRV1_LOG1(SRV1_LOG_WARN,
+                  "srv1: didn't get correct response from image size set: "
+                  "#%c\n", reply->mode);
+         }
+      return 1;
+   case SRV1_TXN_IMAGE:
+      if (reply->type == SRV1_REPLY_IMAGE_START)
+         {
+            // Same budget as srv1_fill_image() for the body.
+            begin_txn(x, SRV1_TXN_IMAGE, SRV1_REPLY_IMAGE, 1500000);
+            return 0;
+         }
+      // handle_reply() committed the frame unless it had nowhere to put it.
+      *ok = (x->frame_seq != x->txn_seq);
+      return 1;
+   default:
+      *ok = 1;
+      return 1;
+      }
+}
 
+/*
+ * Deals with a transaction whose deadline passed. Lost image requests are
+ * retried like srv1_fill_image() does.
+ * \return 1 if the transaction has failed for good.
+ */
+static int
+expire_txn(srv1_comm_t *x)
+{
+   srv1_stats_count(&x->stats.timeouts, 1);
+   stop_draining(x);
+   if (x->txn == SRV1_TXN_IMAGE)
+      {
+         if (x->txn_want == SRV1_REPLY_IMAGE_START)
+            {
+               // The request or its reply got lost; ask again.
+               x->image_pending = 0;
+               if (x->txn_tries < SRV1_IMAGE_TRIES && request_image(x))
+                  {
+                     x->txn_tries++;
+                     srv1_stats_count(&x->stats.image_retries, 1);
+                     begin_txn(x, SRV1_TXN_IMAGE, SRV1_REPLY_IMAGE_START,
+                           500000);
+                     return 0;
+                  }
+               SRV1_LOG1(SRV1_LOG_WARN,
+                     "srv1: didn't get image spec after %d tries.\n",
+                     x->txn_tries);
+            }
+         else
+            {
+               abandon_image(x);
+            }
+      }
+   else
+      {
+         SRV1_LOG1(SRV1_LOG_WARN, "srv1: transaction %d timed out\n", x->txn);
+      }
    return 1;
 }
 
 int
-srv1_read_sensors(srv1_comm_t *x)
+srv1_service(srv1_comm_t *x, int *ok)
 {
+   int done = SRV1_TXN_NONE;
+   uint32_t skipped = x->parser.skipped;
+   srv1_reply_t reply;
 
-   // CARLOS: Needs to handle returns (1: success), (0: error)
-   srv1_fill_image(x);
-   //	srv1_fill_ir(x);  // CARLOS: not tested yet
+   *ok = 0;
+   if (x->txn == SRV1_TXN_NONE)
+      {
+         return SRV1_TXN_NONE;
+      }
 
-   return 1;
+   for (;;)
+      {
+         int progress = pump(x, &reply);
+         if (progress < 0)
+            {
+               done = x->txn;
+               break;
+            }
+
+         if (reply.type != SRV1_REPLY_NONE && handle_reply(x, &reply)
+               == x->txn_want && advance_txn(x, &reply, ok))
+            {
+               done = x->txn;
+               break;
+            }
+
+         if (progress == 0)
+            {
+               if (now_usec() >= x->txn_deadline && expire_txn(x))
+                  {
+                     done = x->txn;
+                  }
+               break;
+            }
+      }
+
+   if (x->parser.skipped != skipped)
+      {
+         srv1_stats_count(&x->stats.skipped_bytes, x->parser.skipped - skipped);
+         SRV1_LOG1(SRV1_LOG_WARN, "srv1: resynchronized, skipped %u bytes\n",
+               x->parser.skipped - skipped);
+      }
+   if (done != SRV1_TXN_NONE)
+      {
+         if (*ok)
+            {
+               srv1_stats_latency(&x->stats, done, now_usec()
+                     - (done == SRV1_TXN_IMAGE ? x->image_sent : x->txn_start));
+            }
+         x->txn = SRV1_TXN_NONE;
+         if (done == SRV1_TXN_MOTORS)
+            {
+               record_motors(x, *ok, x->txn_left, x->txn_right);
+            }
+         if (done == SRV1_TXN_MOTORS && x->image_follows)
+            {
+               // The 'I' sent along with the motor command is answered
+               // next; wait for it like srv1_begin_image() would.
+               x->image_follows = 0;
+               x->txn_tries = 1;
+               x->txn_seq = x->frame_seq;
+               begin_txn(x, SRV1_TXN_IMAGE, SRV1_REPLY_IMAGE_START, 500000);
+            }
+      }
+   return done;
+}
+
+int
+srv1_finish_txn(srv1_comm_t *x)
+{
+   srv1_reply_t reply;
+   int ok = 1;
+
+   while (x->txn != SRV1_TXN_NONE)
+      {
+         // Nobody is going to take another image.
+         x->txn_tries = SRV1_IMAGE_TRIES;
+         if (srv1_service(x, &ok) != SRV1_TXN_NONE)
+            {
+               continue;
+            }
+         if (x->io->wait(x, x->txn_deadline) < 0)
+            {
+               x->txn = SRV1_TXN_NONE;
+               return 0;
+            }
+      }
+
+   // An image body that timed out is still coming; let it pass.
+   while (x->parser.draining && now_usec() < x->drain_deadline)
+      {
+         int progress = pump(x, &reply);
+         if (progress < 0 || (progress == 0 && x->io->wait(x,
+               x->drain_deadline) < 0))
+            {
+               return 0;
+            }
+      }
+   return ok && !x->parser.draining;
 }
 
 int
 srv1_reset_comms(srv1_comm_t *x)
 {
+   int bytes = srv1_flush_input(x);
+   SRV1_LOG1(SRV1_LOG_INFO, "srv1_reset_comms(): discarded %d bytes.\n", bytes);
+   x->image_pending = 0;
    return 1;
 }
 
@@ -745,8 +1538,8 @@ srv1_range_to_distance(int rangereading)
 {
    // Approximation based on a 3rd order polynomial fit of data:
    //    -6.0333e-05 x^3 + 1.2986e-02 x^2 + -9.6280e-01 x + 4.3082e+01
-   // TODO: Possibly replace this with a lookup table, or factorize
-   //  to minimize numerical error.
+   // This is the reference the IR table in surveyor_lut.c is built from;
+   // the driver converts readings with srv1_lut_ir_ranges().
    double a = -6.0333e-5 * rangereading * rangereading * rangereading;
    double b = 1.2986e-2 * rangereading * rangereading;
    double c = -9.6280e-1 * rangereading;
@@ -34,6 +34,13 @@ extern "C"
 #include <stdint.h>
 #include <limits.h>
 
+#include "surveyor_ring.h"
+#include "surveyor_parser.h"
+#include "surveyor_frame.h"
+#include "surveyor_transport.h"
+#include "surveyor_stats.h"
+#include "surveyor_capture.h"
+
    // CARLOS: added libraries when using cpp:
    //#include <sstream>
 
@@ -43,6 +50,30 @@ extern "C"
 #define SRV1_IMAGE_MED 'b'
 #define SRV1_IMAGE_BIG 'c'
 
+/* How long the rest of an image whose body timed out may take to arrive
+ * before the parser stops waiting for it (usec). */
+#define SRV1_DRAIN_USEC 2000000
+
+/* Image requests sent for one frame before it is given up. */
+#define SRV1_IMAGE_TRIES 10
+
+/* Line rate of the serial port unless srv1_comm_t.baud says otherwise
+ * (bits/s); the rate the SRV-1 and its radios ship with. */
+#define SRV1_DEFAULT_BAUD 115200
+
+/* Version queries in a row a rate must answer before probing keeps it. */
+#define SRV1_BAUD_PROBES 3
+
+   /** Exchanges with the robot that srv1_begin_*() start and srv1_service() completes. */
+   enum
+   {
+      SRV1_TXN_NONE, ///< Nothing in flight
+      SRV1_TXN_MOTORS, ///< 'M' waiting for '#M'
+      SRV1_TXN_MODE, ///< Image mode change waiting for its acknowledgement
+      SRV1_TXN_IMAGE, ///< 'I' waiting for the whole JPEG
+      SRV1_TXN_IR ///< 'B' waiting for the BounceIR line
+   };
+
 #define SRV1_MAX_VEL_X 0.315
 #define SRV1_MAX_VEL_W 2.69
 
@@ -54,22 +85,54 @@ extern "C"
     * @brief Type definition that is used in the communication link between the Surveyor Driver implementation and the robot itself
     * @ingroup driver_surveyor
     */
-   typedef struct
+   typedef struct srv1_comm
    {
 
          char port[PATH_MAX]; ///< Serial port communicating on.
          int fd; ///< fd if port is open. (-1 = not valid)
+         long baud; ///< Line rate in bits/s (0 = find it in srv1_init())
+         const srv1_transport_t *io; ///< How bytes get to and from fd
+         void *io_state; ///< Transport's per-robot state
+         uint32_t io_calls; ///< System calls made for I/O on the port
+         srv1_capture_t *capture; ///< Where traffic is recorded (NULL = nowhere)
+         srv1_ring_t rx; ///< Bytes received but not yet consumed
+         srv1_parser_t parser; ///< Splits received bytes into replies
+         srv1_frame_t *rx_frame; ///< Buffer the incoming image goes into (NULL = none)
 
          double vx; ///< velocity in the x direction
          double va; ///< angular velocity
 
+         signed char motor_left; ///< Left wheel speed the robot last acknowledged
+         signed char motor_right; ///< Right wheel speed the robot last acknowledged
+         unsigned char motors_known; ///< Whether motor_left and motor_right are valid
+         int64_t motors_acked; ///< When they were acknowledged (monotonic usec)
+         int64_t motor_keepalive; ///< Resend unchanged wheel speeds after this long (usec; 0 = always)
+
          unsigned char need_ir; ///< Do we need to read the IR?
          int bouncedir[4]; ///< 0 = front, 1 = left, 2 = back, 3 = right
 
          unsigned char image_mode; ///< Mode we want images in.
          unsigned char set_image_mode; ///< Mode that the camera is set to.
-         uint32_t frame_size; ///< size of JPEG frame
-         char *frame; ///< Frame that holds the actual image
+         srv1_frame_t *frame; ///< Latest complete image; we hold a reference
+
+         srv1_frame_pool_t frames; ///< Every image buffer, allocated at creation
+         uint32_t frame_seq; ///< Number of frames received so far
+         unsigned char pipeline; ///< Request the next image as soon as one arrives
+         unsigned char image_pending; ///< An 'I' was sent and its reply not read yet
+         int64_t image_sent; ///< When the last 'I' was sent (monotonic usec)
+         int64_t drain_deadline; ///< When to stop draining an abandoned image (monotonic usec)
+
+         int txn; ///< Transaction in flight (SRV1_TXN_*)
+         int txn_want; ///< Reply that completes its current step
+         int64_t txn_deadline; ///< When that step times out (monotonic usec)
+         int txn_tries; ///< Image requests sent for the transaction
+         uint32_t txn_seq; ///< frame_seq when the image transaction started
+         int64_t txn_start; ///< When its request was sent (monotonic usec)
+         signed char txn_left; ///< Left wheel speed of the motor command in flight
+         signed char txn_right; ///< Right wheel speed of the motor command in flight
+         unsigned char image_follows; ///< An 'I' went out behind the motor command in flight
+
+         srv1_stats_t stats; ///< Latencies and failures; see srv1_stats_snapshot()
 
    } srv1_comm_t;
 
@@ -86,11 +149,30 @@ extern "C"
    srv1_destroy(srv1_comm_t *x);
 
    /*
-    * Initialized a srv1, connecting and checking the version
+    * Initialized a srv1, connecting and checking the version.
+    * If x->baud is 0 the serial port tries each supported rate, fastest
+    * first, and keeps the first that answers SRV1_BAUD_PROBES version
+    * queries in a row; x->baud is then the rate found.
     */
    int
    srv1_init(srv1_comm_t *x);
 
+   /*
+    * \return 1 if the serial port can be set to baud: 115200, 230400,
+    *         460800 or 921600 bits/s.
+    */
+   int
+   srv1_baud_supported(long baud);
+
+   /*
+    * Records every byte sent to and received from the robot, with its time,
+    * in a capture file at path (see surveyor_capture.h). Call it before
+    * srv1_init() to capture the whole session.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_record(srv1_comm_t *x, const char *path);
+
    /*
     * Sets the speed.  Forward velocity trumps rotational velocity.
     *
@@ -113,6 +195,71 @@ extern "C"
    int
    srv1_read_sensors(srv1_comm_t *x);
 
+   /*
+    * Non-blocking counterpart of srv1_set_speed(): sends the motor command
+    * and returns; srv1_service() completes it. Only one transaction may be
+    * in flight per robot.
+    * \return 1 if the command was sent, 0 for failure.
+    */
+   int
+   srv1_begin_speed(srv1_comm_t *x, double dx, double dw);
+
+   /*
+    * Like srv1_begin_speed(), but an image request goes out in the same
+    * write. Once the motors are acknowledged srv1_service() reports
+    * SRV1_TXN_MOTORS and carries on with the image, as if
+    * srv1_begin_image() had started it. The camera must already be in
+    * x->image_mode.
+    * \return 1 if both requests were sent, 0 for failure.
+    */
+   int
+   srv1_begin_speed_image(srv1_comm_t *x, double dx, double dw);
+
+   /*
+    * \return 1 if dx, dw come to the wheel speeds the robot last
+    *         acknowledged, less than x->motor_keepalive ago: sending them
+    *         again would change nothing. Leaves x->vx and x->va alone.
+    */
+   int
+   srv1_speed_unchanged(srv1_comm_t *x, double dx, double dw);
+
+   /*
+    * Starts fetching an image: sets the image mode first if it changed (that
+    * is a transaction of its own), otherwise requests a frame.
+    * \return 1 if a transaction was started, 0 if images are off or the
+    *         write failed.
+    */
+   int
+   srv1_begin_image(srv1_comm_t *x);
+
+   /*
+    * Starts reading the bounced IR values.
+    * \return 1 if the request was sent, 0 for failure.
+    */
+   int
+   srv1_begin_ir(srv1_comm_t *x);
+
+   /*
+    * Reads whatever the port has without blocking and moves the transaction
+    * in flight on; call it when x->fd is readable or x->txn_deadline passes.
+    * \param ok set to 1 if the completed transaction succeeded.
+    * \return the SRV1_TXN_* that completed (successfully or not), or
+    *         SRV1_TXN_NONE if it is still in flight.
+    */
+   int
+   srv1_service(srv1_comm_t *x, int *ok);
+
+   /*
+    * Blocks until the transaction in flight completes or times out, without
+    * asking for a lost image again, and until the rest of an abandoned image
+    * has been drained. The next reply on the wire then belongs to whatever
+    * is sent next, so the blocking calls can take over from the reactor.
+    * \return 1 if the port was left between replies, 0 if it needs
+    *         srv1_reset_comms().
+    */
+   int
+   srv1_finish_txn(srv1_comm_t *x);
+
    /*
     * Resets communication buffers by reading all data waiting
     * and querying the version once again.
@@ -123,15 +270,17 @@ extern "C"
    int
    srv1_reset_comms(srv1_comm_t *x);
 
-/*
- * Returns an approximation of the distance an object is away with
- * a IR range reading.
- *
- * \param rangereading Reading from a IR.
- * \return approximated distance in cm
- */
-//double srv1_range_to_distance(int rangereading);
-//
+   /*
+    * Returns an approximation of the distance an object is away with
+    * a IR range reading. Reference for srv1_lut_ir_ranges(), which is
+    * what the driver uses.
+    *
+    * \param rangereading Reading from a IR.
+    * \return approximated distance in cm
+    */
+   double
+   srv1_range_to_distance(int rangereading);
+
 //// Added method for testing Picture Delay issue:
 //int saveNamedData(const char *name, char *data, int size);
 ///// Save the frame
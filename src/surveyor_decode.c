@@ -0,0 +1,401 @@
+/*
+ * surveyor_decode.c
+ *
+ * Pool of threads decoding camera JPEGs to RGB888 with libjpeg(-turbo),
+ * optionally with half- and quarter-size versions.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_decode.h"
+#include "surveyor_sched.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* jpeglib.h needs FILE declared first. */
+#include <jpeglib.h>
+
+/* libjpeg's default error handler exits the process; this one jumps back
+ * to srv1_decode_jpeg() instead. */
+typedef struct
+{
+      struct jpeg_error_mgr mgr;
+      jmp_buf escape;
+} decode_error_t;
+
+static void
+decode_error_exit(j_common_ptr cinfo)
+{
+   decode_error_t *err = (decode_error_t *) cinfo->err;
+
+   longjmp(err->escape, 1);
+}
+
+static void
+decode_output_message(j_common_ptr cinfo)
+{
+   /* Corrupt frames are counted, not printed. */
+}
+
+int
+srv1_decode_jpeg(const unsigned char *jpeg, uint32_t size,
+      srv1_image_t *img)
+{
+   struct jpeg_decompress_struct cinfo;
+   decode_error_t err;
+   JSAMPROW row;
+   uint32_t stride;
+
+   cinfo.err = jpeg_std_error(&err.mgr);
+   err.mgr.error_exit = decode_error_exit;
+   err.mgr.output_message = decode_output_message;
+   if (setjmp(err.escape))
+      {
+         jpeg_destroy_decompress(&cinfo);
+         return 0;
+      }
+
+   jpeg_create_decompress(&cinfo);
+   jpeg_mem_src(&cinfo, (unsigned char *) jpeg, size);
+   jpeg_read_header(&cinfo, TRUE);
+   cinfo.out_color_space = JCS_RGB;
+   cinfo.dct_method = JDCT_ISLOW;
+   jpeg_start_decompress(&cinfo);
+
+   stride = cinfo.output_width * 3;
+   if (!srv1_image_alloc(img, cinfo.output_width, cinfo.output_height))
+      {
+         jpeg_destroy_decompress(&cinfo);
+         return 0;
+      }
+   while (cinfo.output_scanline < cinfo.output_height)
+      {
+         row = img->data + cinfo.output_scanline * stride;
+         jpeg_read_scanlines(&cinfo, &row, 1);
+      }
+   jpeg_finish_decompress(&cinfo);
+   jpeg_destroy_decompress(&cinfo);
+   return 1;
+}
+
+int
+srv1_decode_thumbnail(const unsigned char *jpeg, uint32_t size,
+      unsigned char *out, uint32_t cap, uint32_t *width, uint32_t *height)
+{
+   struct jpeg_decompress_struct cinfo;
+   decode_error_t err;
+   JSAMPROW row;
+
+   cinfo.err = jpeg_std_error(&err.mgr);
+   err.mgr.error_exit = decode_error_exit;
+   err.mgr.output_message = decode_output_message;
+   if (setjmp(err.escape))
+      {
+         jpeg_destroy_decompress(&cinfo);
+         return 0;
+      }
+
+   jpeg_create_decompress(&cinfo);
+   jpeg_mem_src(&cinfo, (unsigned char *) jpeg, size);
+   jpeg_read_header(&cinfo, TRUE);
+   cinfo.out_color_space = JCS_GRAYSCALE;
+   cinfo.scale_num = 1;
+   cinfo.scale_denom = 8;
+   cinfo.do_fancy_upsampling = FALSE;
+   jpeg_start_decompress(&cinfo);
+
+   if (cinfo.output_width * cinfo.output_height > cap)
+      {
+         jpeg_destroy_decompress(&cinfo);
+         return 0;
+      }
+   while (cinfo.output_scanline < cinfo.output_height)
+      {
+         row = out + cinfo.output_scanline * cinfo.output_width;
+         jpeg_read_scanlines(&cinfo, &row, 1);
+      }
+   *width = cinfo.output_width;
+   *height = cinfo.output_height;
+
+   jpeg_finish_decompress(&cinfo);
+   jpeg_destroy_decompress(&cinfo);
+   return 1;
+}
+
+static int
+grow_jpeg(srv1_decode_job_t *job, uint32_t size)
+{
+   unsigned char *p;
+
+   if (size <= job->jpeg_cap)
+      {
+         return 1;
+      }
+   p = (unsigned char *) realloc(job->jpeg, size);
+   if (p == NULL)
+      {
+         return 0;
+      }
+   job->jpeg = p;
+   job->jpeg_cap = size;
+   return 1;
+}
+
+static void *
+decode_worker(void *arg)
+{
+   srv1_decode_pool_t *p = (srv1_decode_pool_t *) arg;
+   srv1_decode_job_t *job;
+   int64_t start;
+   int i, ok;
+
+   pthread_mutex_lock(&p->lock);
+   for (;;)
+      {
+         job = NULL;
+         /* Oldest frame first. */
+         for (i = 0; i < SRV1_DECODE_JOBS; i++)
+            {
+               if (p->jobs[i].state == SRV1_DECODE_QUEUED && (job == NULL
+                     || (int32_t) (p->jobs[i].ticket - job->ticket) < 0))
+                  {
+                     job = &p->jobs[i];
+                  }
+            }
+         if (job == NULL)
+            {
+               if (p->stop)
+                  {
+                     break;
+                  }
+               pthread_cond_wait(&p->work, &p->lock);
+               continue;
+            }
+         job->state = SRV1_DECODE_BUSY;
+         pthread_mutex_unlock(&p->lock);
+
+         start = srv1_sched_now();
+         ok = srv1_decode_jpeg(job->jpeg, job->jpeg_size, &job->levels[0])
+               && srv1_pyramid_build(job->levels, job->depth);
+
+         pthread_mutex_lock(&p->lock);
+         job->ok = ok;
+         job->state = SRV1_DECODE_DONE;
+         if (ok)
+            {
+               p->decoded++;
+            }
+         else
+            {
+               p->failed++;
+            }
+         p->decode_usec += srv1_sched_now() - start;
+         if (p->notify != NULL)
+            {
+               p->notify(p->notify_arg);
+            }
+      }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+int
+srv1_decode_init(srv1_decode_pool_t *p, int nthreads,
+      void (*notify)(void *), void *arg)
+{
+   memset(p, 0, sizeof(*p));
+   if (nthreads < 1)
+      {
+         nthreads = 1;
+      }
+   if (nthreads > SRV1_DECODE_MAX_THREADS)
+      {
+         nthreads = SRV1_DECODE_MAX_THREADS;
+      }
+   p->notify = notify;
+   p->notify_arg = arg;
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->work, NULL);
+
+   for (p->nthreads = 0; p->nthreads < nthreads; p->nthreads++)
+      {
+         if (pthread_create(&p->threads[p->nthreads], NULL, decode_worker, p)
+               != 0)
+            {
+               break;
+            }
+      }
+   if (p->nthreads == 0)
+      {
+         srv1_decode_destroy(p);
+         return 0;
+      }
+   return 1;
+}
+
+void
+srv1_decode_destroy(srv1_decode_pool_t *p)
+{
+   int i, j;
+
+   pthread_mutex_lock(&p->lock);
+   p->stop = 1;
+   /* Nothing queued is decoded any more. */
+   for (i = 0; i < SRV1_DECODE_JOBS; i++)
+      {
+         if (p->jobs[i].state == SRV1_DECODE_QUEUED)
+            {
+               p->jobs[i].state = SRV1_DECODE_FREE;
+            }
+      }
+   pthread_cond_broadcast(&p->work);
+   pthread_mutex_unlock(&p->lock);
+
+   for (i = 0; i < p->nthreads; i++)
+      {
+         pthread_join(p->threads[i], NULL);
+      }
+   p->nthreads = 0;
+
+   for (i = 0; i < SRV1_DECODE_JOBS; i++)
+      {
+         free(p->jobs[i].jpeg);
+         p->jobs[i].jpeg = NULL;
+         p->jobs[i].jpeg_cap = 0;
+         for (j = 0; j < SRV1_PYRAMID_LEVELS; j++)
+            {
+               srv1_image_free(&p->jobs[i].levels[j]);
+            }
+         p->jobs[i].state = SRV1_DECODE_FREE;
+      }
+   pthread_cond_destroy(&p->work);
+   pthread_mutex_destroy(&p->lock);
+}
+
+int
+srv1_decode_reserve(srv1_decode_pool_t *p, uint32_t width, uint32_t height)
+{
+   int ok = 1;
+   int i, j;
+
+   pthread_mutex_lock(&p->lock);
+   for (i = 0; i < SRV1_DECODE_JOBS; i++)
+      {
+         if (p->jobs[i].state != SRV1_DECODE_FREE)
+            {
+               continue;
+            }
+         for (j = 0; j < SRV1_PYRAMID_LEVELS; j++)
+            {
+               ok = ok && srv1_image_alloc(&p->jobs[i].levels[j], width >> j,
+                     height >> j);
+            }
+      }
+   pthread_mutex_unlock(&p->lock);
+   return ok;
+}
+
+int
+srv1_decode_submit(srv1_decode_pool_t *p, const void *jpeg, uint32_t size,
+      int tag, uint32_t seq, int depth)
+{
+   srv1_decode_job_t *job = NULL;
+   int i;
+
+   pthread_mutex_lock(&p->lock);
+   for (i = 0; i < SRV1_DECODE_JOBS; i++)
+      {
+         if (p->jobs[i].state == SRV1_DECODE_QUEUED && p->jobs[i].tag == tag)
+            {
+               job = &p->jobs[i];
+               p->superseded++;
+               break;
+            }
+      }
+   for (i = 0; job == NULL && i < SRV1_DECODE_JOBS; i++)
+      {
+         if (p->jobs[i].state == SRV1_DECODE_FREE)
+            {
+               job = &p->jobs[i];
+            }
+      }
+   /* Workers leave a BUSY job alone, so it can be filled unlocked. */
+   if (job == NULL || p->stop)
+      {
+         pthread_mutex_unlock(&p->lock);
+         return 0;
+      }
+   job->state = SRV1_DECODE_BUSY;
+   pthread_mutex_unlock(&p->lock);
+
+   if (!grow_jpeg(job, size))
+      {
+         pthread_mutex_lock(&p->lock);
+         job->state = SRV1_DECODE_FREE;
+         pthread_mutex_unlock(&p->lock);
+         return 0;
+      }
+   memcpy(job->jpeg, jpeg, size);
+   job->jpeg_size = size;
+   job->tag = tag;
+   job->seq = seq;
+   job->depth = depth < 1 ? 1 : depth > SRV1_PYRAMID_LEVELS
+         ? SRV1_PYRAMID_LEVELS : depth;
+   job->ok = 0;
+
+   pthread_mutex_lock(&p->lock);
+   job->ticket = p->tickets++;
+   job->state = SRV1_DECODE_QUEUED;
+   pthread_cond_signal(&p->work);
+   pthread_mutex_unlock(&p->lock);
+   return 1;
+}
+
+srv1_decode_job_t *
+srv1_decode_take(srv1_decode_pool_t *p)
+{
+   srv1_decode_job_t *job = NULL;
+   int i;
+
+   pthread_mutex_lock(&p->lock);
+   for (i = 0; i < SRV1_DECODE_JOBS; i++)
+      {
+         if (p->jobs[i].state == SRV1_DECODE_DONE && (job == NULL
+               || (int32_t) (p->jobs[i].ticket - job->ticket) < 0))
+            {
+               job = &p->jobs[i];
+            }
+      }
+   if (job != NULL)
+      {
+         job->state = SRV1_DECODE_TAKEN;
+      }
+   pthread_mutex_unlock(&p->lock);
+   return job;
+}
+
+void
+srv1_decode_release(srv1_decode_pool_t *p, srv1_decode_job_t *job)
+{
+   pthread_mutex_lock(&p->lock);
+   job->state = SRV1_DECODE_FREE;
+   pthread_mutex_unlock(&p->lock);
+}
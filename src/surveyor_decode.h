@@ -0,0 +1,165 @@
+/*
+ * surveyor_decode.h
+ *
+ * Pool of threads decoding camera JPEGs to RGB888 with libjpeg(-turbo),
+ * optionally with half- and quarter-size versions.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_DECODE_H_
+#define SURVEYOR_DECODE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "surveyor_pyramid.h"
+
+#define SRV1_DECODE_MAX_THREADS 8
+
+/* Frames queued, being decoded or waiting to be taken, at most. */
+#define SRV1_DECODE_JOBS 8
+
+   /** Life of a decode job. */
+   enum
+   {
+      SRV1_DECODE_FREE, ///< Unused
+      SRV1_DECODE_QUEUED, ///< Waiting for a worker
+      SRV1_DECODE_BUSY, ///< Being decoded
+      SRV1_DECODE_DONE, ///< Decoded (or failed); waiting for the consumer
+      SRV1_DECODE_TAKEN ///< The consumer has it until srv1_decode_release()
+   };
+
+   /**
+    * @brief One frame on its way through the pool. Its buffers stay
+    * allocated for the next frame.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int state; ///< SRV1_DECODE_*
+         int tag; ///< Caller's, e.g. which robot the frame came from
+         uint32_t seq; ///< Caller's frame number
+         uint32_t ticket; ///< Order of submission, over all tags
+         unsigned char *jpeg; ///< Copy of the compressed frame
+         uint32_t jpeg_size; ///< Bytes in jpeg
+         uint32_t jpeg_cap; ///< Bytes allocated for jpeg
+         int depth; ///< Pyramid levels wanted (1 = just the decoded frame)
+         srv1_image_t levels[SRV1_PYRAMID_LEVELS]; ///< Decoded frame, 1/2, 1/4
+         int ok; ///< 1 if levels 0 .. depth - 1 hold the frame
+   } srv1_decode_job_t;
+
+   /**
+    * @brief Worker threads that each decode one frame at a time. One thread
+    * submits frames and takes the results; libjpeg-turbo's SIMD code does the
+    * heavy lifting.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         pthread_t threads[SRV1_DECODE_MAX_THREADS]; ///< Workers
+         int nthreads; ///< Workers running
+         pthread_mutex_t lock; ///< Guards the job states and stop
+         pthread_cond_t work; ///< Signalled when a job is queued or on stop
+         int stop; ///< Tells the workers to exit
+         uint32_t tickets; ///< Frames submitted so far
+         srv1_decode_job_t jobs[SRV1_DECODE_JOBS]; ///< All jobs
+         void (*notify)(void *); ///< Called by a worker when a job is done
+         void *notify_arg; ///< Argument for notify
+         uint32_t decoded; ///< Frames decoded
+         uint32_t failed; ///< Frames that weren't valid JPEGs
+         uint32_t superseded; ///< Queued frames replaced by a newer one
+         uint64_t decode_usec; ///< Time spent decoding
+   } srv1_decode_pool_t;
+
+   /*
+    * Starts nthreads workers. notify (may be NULL) runs on a worker thread
+    * whenever a job is done.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_decode_init(srv1_decode_pool_t *p, int nthreads,
+         void (*notify)(void *), void *arg);
+
+   /*
+    * Stops the workers and frees every job.
+    */
+   void
+   srv1_decode_destroy(srv1_decode_pool_t *p);
+
+   /*
+    * Allocates every job's pyramid for frames of up to width x height, so
+    * that switching to a bigger image size doesn't make the workers
+    * allocate.
+    * \return 1 for success, 0 if out of memory.
+    */
+   int
+   srv1_decode_reserve(srv1_decode_pool_t *p, uint32_t width, uint32_t height);
+
+   /*
+    * Queues a copy of a JPEG, to be decoded and shrunk into depth pyramid
+    * levels (1 .. SRV1_PYRAMID_LEVELS). A frame with the same tag that no
+    * worker has started yet is replaced: only the newest frame of a source is
+    * worth decoding.
+    * \return 1 if queued, 0 if every job is in use (the frame is dropped).
+    */
+   int
+   srv1_decode_submit(srv1_decode_pool_t *p, const void *jpeg, uint32_t size,
+         int tag, uint32_t seq, int depth);
+
+   /*
+    * \return a finished job, which the caller owns until
+    * srv1_decode_release(), or NULL if none is finished.
+    */
+   srv1_decode_job_t *
+   srv1_decode_take(srv1_decode_pool_t *p);
+
+   /*
+    * Hands a job from srv1_decode_take() back to the pool.
+    */
+   void
+   srv1_decode_release(srv1_decode_pool_t *p, srv1_decode_job_t *job);
+
+   /*
+    * Decodes a JPEG into img, growing it as needed.
+    * \return 1 for success, 0 if it isn't a JPEG libjpeg can decode.
+    */
+   int
+   srv1_decode_jpeg(const unsigned char *jpeg, uint32_t size,
+         srv1_image_t *img);
+
+   /*
+    * Decodes a JPEG at 1/8 scale to greyscale into out, which has room for
+    * cap pixels. libjpeg then only needs each block's DC coefficient, so it
+    * costs a small fraction of a full decode.
+    * \return 1 for success, 0 if it isn't a JPEG libjpeg can decode or its
+    * thumbnail doesn't fit.
+    */
+   int
+   srv1_decode_thumbnail(const unsigned char *jpeg, uint32_t size,
+         unsigned char *out, uint32_t cap, uint32_t *width, uint32_t *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_DECODE_H_ */
@@ -21,6 +21,56 @@
 
 #include "surveyor_driver.h"
 
+#include <algorithm>
+#include <math.h>
+
+// The sizes the camera can take pictures in.
+static const struct
+{
+      char mode;
+      const char *size;
+} image_sizes[] =
+   {
+      { SRV1_IMAGE_BIG, "320x240" },
+      { SRV1_IMAGE_MED, "160x128" },
+      { SRV1_IMAGE_SMALL, "80x64" } };
+
+/** @brief Image mode for an image_size value.
+ * @returns SRV1_IMAGE_OFF if the camera has no such size.
+ */
+static char
+ImageModeFromSize(const char *size)
+{
+   for (unsigned int i = 0; i < sizeof(image_sizes) / sizeof(image_sizes[0]);
+         i++)
+      {
+         if (strcmp(size, image_sizes[i].size) == 0)
+            {
+               return image_sizes[i].mode;
+            }
+      }
+   return SRV1_IMAGE_OFF;
+}
+
+/** @brief image_size value of an image mode. */
+static const char *
+SizeFromImageMode(char mode)
+{
+   for (unsigned int i = 0; i < sizeof(image_sizes) / sizeof(image_sizes[0]);
+         i++)
+      {
+         if (image_sizes[i].mode == mode)
+            {
+               return image_sizes[i].size;
+            }
+      }
+   return "";
+}
+
+// Keys of the decoded camera interfaces, by pyramid level.
+static const char *rgb_keys[SRV1_PYRAMID_LEVELS] =
+   { "raw", "half", "quarter" };
+
 // factory creation function
 Driver*
 Surveyor_Init(ConfigFile *cf, int section)
@@ -35,66 +85,312 @@ Surveyor_Register(DriverTable *table)
    table->AddDriver("surveyor", Surveyor_Init);
 }
 
+/** @brief Reads robot i's values of a per-beam IR calibration option into
+ * out, which keeps its defaults if the option is missing. The option holds
+ * SRV1_IR_BEAMS values per robot, in port order, or SRV1_IR_BEAMS that every
+ * robot shares.
+ * @returns false if it holds some other number of values.
+ */
+static bool
+ReadBeamValues(ConfigFile *cf, int section, const char *key, int i,
+      int robots, float *out)
+{
+   int count = cf->GetTupleCount(section, key);
+   int first;
+
+   if (count == 0)
+      {
+         return true;
+      }
+   if (count == SRV1_IR_BEAMS)
+      {
+         first = 0;
+      }
+   else if (count == SRV1_IR_BEAMS * robots)
+      {
+         first = SRV1_IR_BEAMS * i;
+      }
+   else
+      {
+         PLAYER_ERROR2("%s needs %d values, or that many per robot", key,
+               SRV1_IR_BEAMS);
+         return false;
+      }
+   for (int b = 0; b < SRV1_IR_BEAMS; b++)
+      {
+         out[b] = (float) cf->ReadTupleFloat(section, key, first + b, out[b]);
+      }
+   return true;
+}
+
 /** @brief Constructor for the Surveyor driver.
  * Retrieves options from the configuration file, allocates memory for each interface
  * and then reads and adds the interfaces provided in the configuration file.
  */
 Surveyor::Surveyor(ConfigFile *cf, int section) :
-   ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
+   ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN),
 //   Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
+         image_size("image_size", "320x240", false)
 {
-   memset(&this->position_addr, 0, sizeof(player_devaddr_t));
-   memset(&this->camera_addr, 0, sizeof(player_devaddr_t));
-   memset(&this->ir_addr, 0, sizeof(player_devaddr_t));
-   memset(&this->dio_addr, 0, sizeof(player_devaddr_t));
+   this->setup_image_mode = SRV1_IMAGE_OFF;
+   this->pipeline_images = 0;
+   this->image_rate = 0.0;
+   this->ir_rate = 0.0;
+   this->odom_rate = 0.0;
+   this->camera_publish_rate = 0.0;
+   this->ir_publish_rate = 0.0;
+   this->baud = SRV1_DEFAULT_BAUD;
+   this->motor_keepalive = 0.0;
+   this->reactor = NULL;
+   this->decoding = false;
 
-   // Create a position?
-   if (cf->ReadDeviceAddr(&(this->position_addr), section, "provides",
-         PLAYER_POSITION2D_CODE, -1, NULL) == 0)
+   // Reads the configured size too; ApplyImageSize() picks up changes.
+   this->RegisterProperty("image_size", &this->image_size, cf, section);
+   this->setup_image_mode = ImageModeFromSize(this->image_size.GetValue());
+   if (this->setup_image_mode == SRV1_IMAGE_OFF)
       {
-         if (this->AddInterface(this->position_addr) != 0)
+         PLAYER_ERROR("image_size must be \"320x240\", \"160x128\" or \"80x64\"");
+         this->SetError(-1);
+         return;
+      }
+   this->pipeline_images = cf->ReadInt(section, "image_pipeline", 1);
+   this->image_rate = cf->ReadFloat(section, "image_rate", 0.0);
+   this->ir_rate = cf->ReadFloat(section, "ir_rate", 5.0);
+   if (this->image_rate < 0.0 || this->ir_rate <= 0.0)
+      {
+         PLAYER_ERROR("image_rate must not be negative, ir_rate must be positive");
+         this->SetError(-1);
+         return;
+      }
+
+   this->baud = cf->ReadInt(section, "baud", SRV1_DEFAULT_BAUD);
+   if (this->baud != 0 && !srv1_baud_supported(this->baud))
+      {
+         PLAYER_ERROR("baud must be 115200, 230400, 460800, 921600 or 0");
+         this->SetError(-1);
+         return;
+      }
+
+   this->motor_keepalive = cf->ReadFloat(section, "motor_keepalive", 1.0);
+   if (this->motor_keepalive < 0.0)
+      {
+         PLAYER_ERROR("motor_keepalive must not be negative");
+         this->SetError(-1);
+         return;
+      }
+
+   // One robot per port entry.
+   this->num_robots = cf->GetTupleCount(section, "port");
+   if (this->num_robots < 1)
+      {
+         this->num_robots = 1;
+      }
+   if (this->num_robots > SRV1_REACTOR_MAX)
+      {
+         PLAYER_ERROR1("at most %d SRV-1 ports per driver", SRV1_REACTOR_MAX);
+         this->SetError(-1);
+         return;
+      }
+
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         if (!this->AddRobot(cf, section, i))
             {
-               PLAYER_ERROR("Could not add Position2D interface for SRV-1");
                this->SetError(-1);
                return;
             }
       }
 
-   // Create a camera?
-   if (cf->ReadDeviceAddr(&(this->camera_addr), section, "provides",
-         PLAYER_CAMERA_CODE, -1, NULL) == 0)
+   this->report_interval = cf->ReadFloat(section, "report_interval", 10.0);
+
+   this->odom_rate = cf->ReadFloat(section, "odom_rate", 50.0);
+   if (this->odom_rate <= 0.0)
+      {
+         PLAYER_ERROR("odom_rate must be positive");
+         this->SetError(-1);
+         return;
+      }
+   this->camera_publish_rate = cf->ReadFloat(section, "camera_publish_rate",
+         0.0);
+   this->ir_publish_rate = cf->ReadFloat(section, "ir_publish_rate", 0.0);
+   if (this->camera_publish_rate < 0.0 || this->ir_publish_rate < 0.0)
+      {
+         PLAYER_ERROR("camera_publish_rate and ir_publish_rate must not be "
+               "negative");
+         this->SetError(-1);
+         return;
+      }
+
+   this->transport = srv1_transport_find(cf->ReadString(section, "transport",
+         "posix"));
+   if (this->transport == NULL)
+      {
+         PLAYER_ERROR("transport must be \"posix\", \"uring\" or \"replay\"");
+         this->SetError(-1);
+         return;
+      }
+   this->replay_speed = cf->ReadFloat(section, "replay_speed", 1.0);
+   this->capture = cf->ReadString(section, "capture", NULL);
+   this->uring.fd = -1;
+
+   int level = srv1_log_level_from_name(cf->ReadString(section, "log_level",
+         "info"));
+   if (level < 0)
+      {
+         PLAYER_ERROR(
+               "log_level must be \"error\", \"warn\", \"info\", \"debug\" or \"trace\"");
+         this->SetError(-1);
+         return;
+      }
+   srv1_log_set_level(level);
+
+   this->change_threshold = cf->ReadFloat(section, "change_threshold", 0.0);
+   this->change_max_gap = cf->ReadFloat(section, "change_max_gap", 1.0);
+   if (this->change_threshold < 0.0 || this->change_max_gap < 0.0)
       {
+         PLAYER_ERROR("change_threshold and change_max_gap must not be negative");
+         this->SetError(-1);
+         return;
+      }
+
+   this->decode_threads = cf->ReadInt(section, "decode_threads", 2);
+   if (this->decode_threads < 1
+         || this->decode_threads > SRV1_DECODE_MAX_THREADS)
+      {
+         PLAYER_ERROR1("decode_threads must be between 1 and %d",
+               SRV1_DECODE_MAX_THREADS);
+         this->SetError(-1);
+         return;
+      }
+
+   // Message for checking status:
+   puts("Constructor is done!");
+}
+
+/** @brief Reads the port and interfaces of robot i. With a single robot any
+ * position2d/camera index will do; with several, robot i provides
+ * position2d:i and camera:i, and its decoded cameras are
+ * camera:((level + 1) * num_robots + i).
+ */
+bool
+Surveyor::AddRobot(ConfigFile *cf, int section, int i)
+{
+   SurveyorRobot *robot = &this->robots[i];
+   int index = (this->num_robots > 1) ? i : -1;
+
+   memset(robot, 0, sizeof(*robot));
+   robot->image_mode = SRV1_IMAGE_OFF;
+
+   if (this->num_robots > 1)
+      {
+         robot->portname = cf->ReadTupleString(section, "port", i,
+               "/dev/ttyUSB0");
+      }
+   else
+      {
+         robot->portname = cf->ReadString(section, "port", "/dev/ttyUSB0");
+      }
+
+   // Create a position?
+   if (cf->ReadDeviceAddr(&(robot->position_addr), section, "provides",
+         PLAYER_POSITION2D_CODE, index, NULL) == 0)
+      {
+         if (this->AddInterface(robot->position_addr) != 0)
+            {
+               PLAYER_ERROR("Could not add Position2D interface for SRV-1");
+               return false;
+            }
+         robot->has_position = true;
+
+         // Only the newest velocity command matters; don't let a backlog of
+         // stale ones build up in our queue.
+         this->InQueue->AddReplaceRule(robot->position_addr,
+               PLAYER_MSGTYPE_CMD, PLAYER_POSITION2D_CMD_VEL, true);
+      }
 
-         const char *imagetype = cf->ReadString(section, "image_size",
-               "320x240");
-         if (imagetype[0] == '3')
+   // Decoded cameras? Read first, so that none is taken for the JPEG one.
+   for (int l = 0; l < SRV1_PYRAMID_LEVELS; l++)
+      {
+         int rgb_index = (this->num_robots > 1)
+               ? (l + 1) * this->num_robots + i : -1;
+         if (cf->ReadDeviceAddr(&(robot->rgb_addr[l]), section, "provides",
+               PLAYER_CAMERA_CODE, rgb_index, rgb_keys[l]) != 0)
             {
-               this->setup_image_mode = SRV1_IMAGE_BIG;
+               continue;
             }
-         else if (imagetype[0] == '1')
+         if (this->AddInterface(robot->rgb_addr[l]) != 0)
             {
-               this->setup_image_mode = SRV1_IMAGE_MED;
+               PLAYER_ERROR1("Could not add %s Camera interface for SRV-1",
+                     rgb_keys[l]);
+               return false;
             }
-         else
+         robot->has_rgb[l] = true;
+         robot->decodes = true;
+         robot->image_mode = this->setup_image_mode;
+      }
+
+   // Create a camera?
+   int found = cf->ReadDeviceAddr(&(robot->camera_addr), section, "provides",
+         PLAYER_CAMERA_CODE, index, NULL);
+   for (int l = 0; found == 0 && l < SRV1_PYRAMID_LEVELS; l++)
+      {
+         if (robot->has_rgb[l] && Device::MatchDeviceAddress(
+               robot->camera_addr, robot->rgb_addr[l]))
             {
-               this->setup_image_mode = SRV1_IMAGE_SMALL;
+               found = -1;
             }
-         if (this->AddInterface(this->camera_addr) != 0)
+      }
+   if (found == 0)
+      {
+         if (this->AddInterface(robot->camera_addr) != 0)
             {
                PLAYER_ERROR("Could not add Camera interface for SRV-1");
-               this->SetError(-1);
-               return;
+               return false;
             }
+         robot->has_camera = true;
+         robot->image_mode = this->setup_image_mode;
       }
 
-   // TODO: Implement others?  Add here.
+   // Link statistics?
+   if (cf->ReadDeviceAddr(&(robot->opaque_addr), section, "provides",
+         PLAYER_OPAQUE_CODE, index, NULL) == 0)
+      {
+         if (this->AddInterface(robot->opaque_addr) != 0)
+            {
+               PLAYER_ERROR("Could not add Opaque interface for SRV-1");
+               return false;
+            }
+         robot->has_opaque = true;
+      }
 
-   this->portname = cf->ReadString(section, "port", "/dev/ttyUSB0");
+   // IR beacons?
+   if (cf->ReadDeviceAddr(&(robot->ir_addr), section, "provides",
+         PLAYER_IR_CODE, index, NULL) == 0)
+      {
+         if (this->AddInterface(robot->ir_addr) != 0)
+            {
+               PLAYER_ERROR("Could not add IR interface for SRV-1");
+               return false;
+            }
+         robot->has_ir = true;
+      }
+   srv1_ir_cal_identity(&robot->ir_cal);
+   if (!ReadBeamValues(cf, section, "ir_scale", i, this->num_robots,
+         robot->ir_cal.scale) || !ReadBeamValues(cf, section, "ir_offset", i,
+         this->num_robots, robot->ir_cal.offset))
+      {
+         return false;
+      }
 
-   this->srvdev = NULL;
+   // TODO: Implement others?  Add here.
 
-   // Message for checking status:
-   puts("Constructor is done!");
+   if (!robot->has_position && !robot->has_camera && !robot->decodes
+         && !robot->has_ir)
+      {
+         PLAYER_ERROR1("SRV-1 on %s provides no interfaces", robot->portname);
+         return false;
+      }
+   return true;
 }
 
 //Surveyor::~Surveyor(void)
@@ -106,18 +402,148 @@ int
 Surveyor::MainSetup()   // for Player 3.x
 //Surveyor::Setup()     / for Player 2.x
 {
-   this->srvdev = srv1_create(this->portname);
+   this->reactor = srv1_reactor_create();
+   if (this->reactor == NULL)
+      {
+         PLAYER_ERROR("could not create SRV-1 reactor");
+         return -1;
+      }
+   // Stopped by ReleaseRobots().
+   if (!srv1_log_start())
+      {
+         PLAYER_WARN("no SRV-1 log thread; messages are written directly");
+      }
+
+   // Decoding is only worth its threads if someone can ask for RGB frames.
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         this->robots[i].rgb_published = false;
+         this->robots[i].frame_held = false;
+         this->robots[i].ir_held = false;
+         srv1_change_init(&this->robots[i].change, this->change_threshold,
+               (int64_t) (this->change_max_gap * 1e6));
+         srv1_odom_init(&this->robots[i].odom, 0.0, 0.0, 0.0,
+               srv1_sched_now());
+         if (this->robots[i].decodes && !this->decoding)
+            {
+               if (!srv1_decode_init(&this->decoder, this->decode_threads,
+                     Surveyor::LinkNotify, this))
+                  {
+                     PLAYER_ERROR("could not start the JPEG decoder threads");
+                     this->ReleaseRobots();
+                     return -1;
+                  }
+               this->decoding = true;
+
+               // Up front, for the biggest image size.
+               if (!srv1_decode_reserve(&this->decoder, 320, 240))
+                  {
+                     PLAYER_WARN("could not preallocate decoded images");
+                  }
+            }
+      }
 
-   if (!srv1_init(this->srvdev))
+   // All robots share one ring: a read, a write and a cancel each at most.
+   bool use_uring = (this->transport == &srv1_uring_transport);
+   if (use_uring && !srv1_uring_init(&this->uring, 4 * this->num_robots))
       {
-         srv1_destroy(this->srvdev);
-         this->srvdev = NULL;
-         PLAYER_ERROR("could not connect to SRV-1");
+         PLAYER_WARN("io_uring unavailable; using the posix transport");
+         use_uring = false;
+      }
+
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+
+         robot->srvdev = srv1_create(robot->portname);
+         if (robot->srvdev == NULL)
+            {
+               PLAYER_ERROR("could not allocate SRV-1 state");
+               this->ReleaseRobots();
+               return -1;
+            }
+
+         robot->srvdev->baud = this->baud;
+
+         if (use_uring && !srv1_use_uring(robot->srvdev, &this->uring))
+            {
+               PLAYER_WARN1("SRV-1 on %s falls back to the posix transport",
+                     robot->portname);
+            }
+         if (this->transport == &srv1_replay_transport
+               && !srv1_use_replay(robot->srvdev, this->replay_speed))
+            {
+               PLAYER_ERROR("replay_speed must not be negative");
+               this->ReleaseRobots();
+               return -1;
+            }
+
+         if (this->capture != NULL)
+            {
+               char path[PATH_MAX];
+               if (this->num_robots > 1)
+                  {
+                     snprintf(path, sizeof(path), "%s.%d", this->capture, i);
+                  }
+               else
+                  {
+                     snprintf(path, sizeof(path), "%s", this->capture);
+                  }
+               if (!srv1_record(robot->srvdev, path))
+                  {
+                     PLAYER_ERROR1("could not create capture file %s", path);
+                     this->ReleaseRobots();
+                     return -1;
+                  }
+            }
+
+         if (!srv1_init(robot->srvdev))
+            {
+               PLAYER_ERROR1("could not connect to SRV-1 on %s",
+                     robot->portname);
+               this->ReleaseRobots();
+               return -1;
+            }
+
+         robot->srvdev->image_mode = robot->image_mode;
+         robot->srvdev->pipeline = this->pipeline_images;
+         robot->srvdev->motor_keepalive = (int64_t) (this->motor_keepalive
+               * 1e6);
+         SRV1_LOG1(SRV1_LOG_INFO, "image_mode = '%c' \n",
+               robot->srvdev->image_mode);
+
+         // From here on only the reactor thread talks to the robot.
+         robot->link = srv1_reactor_add(this->reactor, robot->srvdev,
+               Surveyor::LinkNotify, this);
+         if (robot->link == NULL)
+            {
+               PLAYER_ERROR("could not add SRV-1 to the reactor");
+               this->ReleaseRobots();
+               return -1;
+            }
+         srv1_link_set_polling(robot->link, this->image_rate > 0.0
+               ? (int64_t) (1e6 / this->image_rate) : 0,
+               robot->has_ir ? (int64_t) (1e6 / this->ir_rate) : 0);
+      }
+
+   // One thread multiplexes the serial traffic of every robot.
+   if (!srv1_reactor_start(this->reactor))
+      {
+         PLAYER_ERROR("could not start SRV-1 reactor thread");
+         this->ReleaseRobots();
          return -1;
       }
 
-   this->srvdev->image_mode = this->setup_image_mode;
-   printf("image_mode = '%c' \n", this->srvdev->image_mode);
+   srv1_sched_init(&this->odom_sched, (int64_t) (1e6 / this->odom_rate));
+   srv1_sched_init(&this->camera_sched, this->camera_publish_rate > 0.0
+         ? (int64_t) (1e6 / this->camera_publish_rate) : 0);
+   srv1_sched_init(&this->ir_pub_sched, this->ir_publish_rate > 0.0
+         ? (int64_t) (1e6 / this->ir_publish_rate) : 0);
+   srv1_sched_init(&this->report_sched, (int64_t) (this->report_interval
+         * 1e6));
+   // The first report covers a whole interval, not the setup.
+   srv1_sched_begin(&this->report_sched, srv1_sched_now());
+
    // Start the device thread; spawns a new thread and executes
    // Surveyor::Main(), which contains the main loop for the driver.
    this->StartThread();
@@ -134,11 +560,123 @@ void Surveyor::MainQuit()    // for Player 3.x
 {
    puts("Shutting surveyor driver down");
    this->StopThread();
-   srv1_destroy(this->srvdev);
-   this->srvdev = NULL;
+   this->ReportTimerStats();
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         srv1_link_t *link = this->robots[i].link;
+         if (link != NULL)
+            {
+               PLAYER_MSG5(1,
+                     "SRV-1 %d velocity commands: %u received, %u coalesced, "
+                     "%u unchanged, %u sent with an image request",
+                     i, link->speed.posted, link->speed.coalesced,
+                     link->unchanged_speeds, link->combined_writes);
+               PLAYER_MSG3(1, "SRV-1 %d: %u I/O system calls (%s transport)",
+                     i, link->dev->io_calls, link->dev->io->name);
+               this->ReportLinkStats(i);
+               if (link->poll_ir && link->ir_sched.stats.cycles > 0)
+                  {
+                     PLAYER_MSG4(1, "SRV-1 %d: %u IR polls, %.1f ms late on "
+                           "average, worst %.1f ms", i,
+                           link->ir_sched.stats.cycles,
+                           link->ir_sched.stats.jitter_sum / 1e3
+                                 / link->ir_sched.stats.cycles,
+                           link->ir_sched.stats.jitter_max / 1e3);
+                  }
+            }
+         if (this->change_threshold > 0.0)
+            {
+               PLAYER_MSG3(1, "SRV-1 %d: %u frames published, %u unchanged "
+                     "ones dropped", i, this->robots[i].change.published,
+                     this->robots[i].change.suppressed);
+            }
+      }
+   if (this->decoding && this->decoder.decoded > 0)
+      {
+         PLAYER_MSG4(1, "SRV-1 decoder: %u frames in %.2f ms each, %u failed, "
+               "%u superseded", this->decoder.decoded,
+               this->decoder.decode_usec / 1e3 / this->decoder.decoded,
+               this->decoder.failed, this->decoder.superseded);
+      }
+   this->ReleaseRobots();
    return;
 }
 
+/** @brief Logs a summary of one robot's link statistics. */
+void
+Surveyor::ReportLinkStats(int i)
+{
+   static const char *names[SRV1_STATS_TXNS] =
+      { "motor", "image mode", "image", "IR" };
+   srv1_stats_t st;
+
+   srv1_stats_snapshot(&this->robots[i].srvdev->stats, &st);
+   for (int t = 0; t < SRV1_STATS_TXNS; t++)
+      {
+         const srv1_hist_t *h = &st.latency[t];
+         if (h->count == 0)
+            {
+               continue;
+            }
+         PLAYER_MSG6(1,
+               "SRV-1 %d %s replies: %u, latency p50 %u p99 %u max %u usec",
+               i, names[t], h->count, srv1_hist_percentile(h, 50.0),
+               srv1_hist_percentile(h, 99.0), h->max);
+      }
+   PLAYER_MSG5(1, "SRV-1 %d: %u timeouts, %u image retries, %u bytes flushed, "
+         "%u skipped", i, st.timeouts, st.image_retries, st.flushed_bytes,
+         st.skipped_bytes);
+   PLAYER_MSG4(1, "SRV-1 %d: %u truncated images (%u bytes drained), "
+         "%u malformed", i, st.truncated_frames, st.drained_bytes,
+         st.bad_frames);
+}
+
+/** @brief Stops the reactor and disconnects every robot. */
+void
+Surveyor::ReleaseRobots()
+{
+   if (this->reactor != NULL)
+      {
+         // Held frames belong to the links' pools.
+         for (int i = 0; i < this->num_robots; i++)
+            {
+               SurveyorRobot *robot = &this->robots[i];
+               if (robot->frame_held)
+                  {
+                     srv1_link_release_frame(robot->link,
+                           robot->held_frame.frame);
+                     robot->frame_held = false;
+                  }
+               robot->ir_held = false;
+            }
+         srv1_reactor_destroy(this->reactor);
+         this->reactor = NULL;
+      }
+
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         robot->link = NULL;
+         if (robot->srvdev != NULL)
+            {
+               srv1_destroy(robot->srvdev);
+               robot->srvdev = NULL;
+            }
+      }
+
+   // Only once no robot uses it any more.
+   srv1_uring_destroy(&this->uring);
+
+   if (this->decoding)
+      {
+         srv1_decode_destroy(&this->decoder);
+         this->decoding = false;
+      }
+
+   // Last, so that messages from shutting the robots down get written.
+   srv1_log_stop();
+}
+
 void
 Surveyor::Main()
 {
@@ -150,90 +688,508 @@ Surveyor::Main()
       //         printf("\nCARLOS: before Processing Messages()\n");
       this->ProcessMessages();
       //         printf("\nCARLOS: after Processing Messages()\n");
+      this->ApplyImageSize();
 
-      if (!srv1_read_sensors(this->srvdev))
+      // Serial traffic happens on the reactor thread; here we only collect
+      // whatever it has finished since the last pass.
+      this->ProcessLinkEvents();
+      if (this->decoding)
          {
-         PLAYER_ERROR("failed to retrieve sensors from SRV-1");
-         srv1_destroy(this->srvdev);
-         return;
+            this->ProcessDecoded();
          }
-      printf("\nCARLOS: before Publishing()\n");
-
-      ////////////////////////////
-      // Update position2d data;
-      player_position2d_data_t posdata;
-      memset(&posdata, 0, sizeof(posdata));
-
-      posdata.vel.px = this->srvdev->vx;
-      posdata.vel.pa = this->srvdev->va;
-
-      this->Publish(this->position_addr, PLAYER_MSGTYPE_DATA,
-            PLAYER_POSITION2D_DATA_STATE, (void*) &posdata, sizeof(posdata),
-            NULL);
-      //         printf("\nCARLOS: after Publishing()\n");
-
-      ////////////////////////////
-      // Update Camera data:
-      player_camera_data_t camdata;
-      memset(&camdata, 0, sizeof(camdata));
-
-      switch (this->srvdev->image_mode)
-      {
-         case SRV1_IMAGE_SMALL:
-            camdata.width = 80;
-            camdata.height = 64;
-            break;
-         case SRV1_IMAGE_MED:
-            camdata.width = 160;
-            camdata.height = 128;
-            break;
-         case SRV1_IMAGE_BIG:
-            camdata.width = 320;
-            camdata.height = 240;
-            break;
-      }
-
-      camdata.fdiv = 1;
-      camdata.bpp = 24;
-      camdata.format = PLAYER_CAMERA_FORMAT_RGB888;
-      camdata.compression = PLAYER_CAMERA_COMPRESS_JPEG;
-
-      // CARLOS: For debugging information
-      //         printf("Surveyor::Main(): frame_size = %d\n", this->srvdev->frame_size);
-      //         printf("Surveyor::Main(): image_mode = '%c'\n",
-      //               this->srvdev->image_mode);
-
-      if (this->srvdev->image_mode != SRV1_IMAGE_OFF)
+
+      // Every interface publishes on its own timer, however slow the
+      // camera is.
+      int64_t now = srv1_sched_now();
+      if (srv1_sched_due(&this->odom_sched, now))
+         {
+            srv1_sched_begin(&this->odom_sched, now);
+            this->PublishPositions(now);
+            now = srv1_sched_now();
+            srv1_sched_end(&this->odom_sched, now);
+         }
+      this->PublishHeld(now);
+      now = srv1_sched_now();
+
+      if (this->report_interval > 0.0 && srv1_sched_due(&this->report_sched,
+            now))
+         {
+            srv1_sched_begin(&this->report_sched, now);
+            this->ReportTimerStats();
+         }
+
+      // Sleep until the next timer is due, a client message arrives or the
+      // link thread has something for us (see LinkNotify()). Wait(0) would
+      // wait for a message however long it takes; a timer that fell due
+      // meanwhile goes round again instead.
+      int64_t left = this->NextDeadline(now);
+      if (left > 0)
          {
-         camdata.image_count = this->srvdev->frame_size;
+            this->Wait(left / 1e6);
+         }
+      }
+}
+
+int64_t
+Surveyor::NextDeadline(int64_t now)
+{
+   int64_t left = srv1_sched_remaining(&this->odom_sched, now);
+   bool frames = false;
+   bool ir = false;
+
+   // Timers with nothing to publish can't wake anybody.
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         frames = frames || this->robots[i].frame_held;
+         ir = ir || this->robots[i].ir_held;
+      }
+   if (frames && this->camera_publish_rate > 0.0)
+      {
+         left = std::min(left, srv1_sched_remaining(&this->camera_sched, now));
+      }
+   if (ir && this->ir_publish_rate > 0.0)
+      {
+         left = std::min(left, srv1_sched_remaining(&this->ir_pub_sched, now));
+      }
+   if (this->report_interval > 0.0)
+      {
+         left = std::min(left, srv1_sched_remaining(&this->report_sched, now));
+      }
+   return left;
+}
 
-         if (camdata.image == NULL)
+void
+Surveyor::ApplyImageSize()
+{
+   const char *size = this->image_size.GetValue();
+   char mode = ImageModeFromSize(size);
+   if (mode == this->setup_image_mode)
+      {
+         return;
+      }
+   if (mode == SRV1_IMAGE_OFF)
+      {
+         PLAYER_WARN1("image_size \"%s\" not supported; keeping the old one",
+               size);
+         this->image_size.SetValue(SizeFromImageMode(this->setup_image_mode));
+         return;
+      }
+
+   this->setup_image_mode = mode;
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         if (robot->image_mode == SRV1_IMAGE_OFF)
             {
-            camdata.image = (uint8_t *) malloc(camdata.image_count);
+               continue;
             }
-         else
+         // Frame buffers hold the biggest size already; the link thread
+         // switches the camera between two frames.
+         robot->image_mode = mode;
+         if (!srv1_link_set_image_mode(robot->link, mode))
             {
-            camdata.image = (uint8_t *) realloc(camdata.image,
-                  camdata.image_count);
+               PLAYER_ERROR1("could not switch the camera of SRV-1 on %s",
+                     robot->portname);
             }
-         memcpy(camdata.image, this->srvdev->frame, camdata.image_count);
-         //               printf("\nCARLOS: before Publishing CAMERA()\n");
+      }
+   PLAYER_MSG1(1, "SRV-1 image size now %s", size);
+}
 
-         // CARLOS: explicitly, writing image to file (for testing only)
-         //             savePhoto("published", (char *)camdata.image, camdata.image_count);
+void
+Surveyor::ReportTimerStats()
+{
+   ReportPublishStats(&this->odom_sched, "odometry", this->odom_rate, false);
+   if (this->camera_publish_rate > 0.0)
+      {
+         ReportPublishStats(&this->camera_sched, "camera",
+               this->camera_publish_rate, true);
+      }
+   if (this->ir_publish_rate > 0.0)
+      {
+         ReportPublishStats(&this->ir_pub_sched, "IR", this->ir_publish_rate,
+               true);
+      }
+}
+
+void
+Surveyor::ReportPublishStats(srv1_sched_t *sched, const char *name,
+      double rate, bool held)
+{
+   srv1_sched_stats_t st;
+   srv1_sched_take_stats(sched, &st);
+   if (st.cycles == 0)
+      {
+         return;
+      }
+   if (held)
+      {
+         // Lateness here is mostly the robot's: the timer waits for data.
+         PLAYER_MSG4(1, "SRV-1 %s %.0f Hz: %u updates, %u periods with "
+               "nothing new", name, rate, st.cycles, st.skipped);
+         return;
+      }
+   PLAYER_MSG7(1, "SRV-1 %s %.0f Hz: %u updates, jitter mean %.1f ms max "
+         "%.1f ms, %u overruns (worst %.1f ms)", name, rate, st.cycles,
+         st.jitter_sum / 1e3 / st.cycles, st.jitter_max / 1e3, st.overruns,
+         st.overrun_max / 1e3);
+   if (st.skipped > 0)
+      {
+         PLAYER_MSG2(1, "SRV-1 %s: %u periods skipped to catch up", name,
+               st.skipped);
+      }
+}
+
+void
+Surveyor::ProcessLinkEvents()
+{
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         this->ProcessLinkEvents(&this->robots[i]);
+      }
+}
+
+void
+Surveyor::ProcessLinkEvents(SurveyorRobot *robot)
+{
+   srv1_event_t evt;
+   srv1_event_t frame;
+   srv1_event_t ir;
+   int have_frame = 0;
+   int have_ir = 0;
+
+   while (srv1_link_poll(robot->link, &evt))
+      {
+         switch (evt.type)
+         {
+            case SRV1_EVT_MOTORS:
+               if (!evt.ok)
+                  {
+                     PLAYER_ERROR1("failed to set speed on SRV-1 on %s",
+                           robot->portname);
+                  }
+               // The robot moves at the new speed from the moment it
+               // answered, not from when we got round to the event.
+               srv1_odom_set_velocity(&robot->odom, evt.vx, evt.va, evt.usec);
+               break;
+            case SRV1_EVT_FRAME:
+               // Only the newest frame is worth publishing.
+               if (have_frame)
+                  {
+                     srv1_link_release_frame(robot->link, frame.frame);
+                  }
+               frame = evt;
+               have_frame = 1;
+               break;
+            case SRV1_EVT_IR:
+               // A failed poll just leaves the last readings standing.
+               if (evt.ok)
+                  {
+                     ir = evt;
+                     have_ir = 1;
+                  }
+               break;
          }
+      }
+
+   // Newer arrivals replace what is still waiting for its timer.
+   if (have_ir && robot->has_ir)
+      {
+         robot->held_ir = ir;
+         robot->ir_held = true;
+      }
+
+   if (have_frame)
+      {
+         if (robot->frame_held)
+            {
+               srv1_link_release_frame(robot->link, robot->held_frame.frame);
+            }
+         robot->held_frame = frame;
+         robot->frame_held = true;
+      }
+}
+
+bool
+Surveyor::PublishDue(srv1_sched_t *sched, double rate, int64_t now)
+{
+   if (rate <= 0.0)
+      {
+         return true;
+      }
+   if (!srv1_sched_due(sched, now))
+      {
+         return false;
+      }
+   srv1_sched_begin(sched, now);
+   return true;
+}
 
-      this->Publish(this->camera_addr, PLAYER_MSGTYPE_DATA,
-            PLAYER_CAMERA_DATA_STATE, (void*) &camdata, sizeof(camdata),
-            NULL);
-      //         printf("\nCARLOS: after Publishing CAMERA()\n");
+void
+Surveyor::PublishHeld(int64_t now)
+{
+   bool frames = false;
+   bool ir = false;
 
-      // TODO: add other interfaces' fills.
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         frames = frames || this->robots[i].frame_held;
+         ir = ir || this->robots[i].ir_held;
+      }
+   // A timer only starts a period when there is something to publish, so
+   // the first arrival after a quiet spell goes out at once.
+   frames = frames && PublishDue(&this->camera_sched,
+         this->camera_publish_rate, now);
+   ir = ir && PublishDue(&this->ir_pub_sched, this->ir_publish_rate, now);
 
-      usleep(SRVMIN_CYCLE_TIME);
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         if (ir && robot->ir_held)
+            {
+               this->PublishIR(robot, robot->held_ir);
+               robot->ir_held = false;
+            }
+         if (frames && robot->frame_held)
+            {
+               this->PublishCamera(robot, robot->held_frame);
+               srv1_link_release_frame(robot->link, robot->held_frame.frame);
+               robot->frame_held = false;
+            }
       }
 }
 
+void
+Surveyor::PublishCamera(SurveyorRobot *robot, const srv1_event_t &frame)
+{
+   // A parked robot keeps sending the same picture; nobody needs it again.
+   if (this->change_threshold > 0.0 && !srv1_change_test(&robot->change,
+         (const unsigned char *) frame.frame->data, frame.frame->size,
+         srv1_sched_now()))
+      {
+         return;
+      }
+
+   // The decoder takes its own copy. Levels are only computed down to the
+   // smallest one somebody wants, and nothing is decoded for nobody.
+   int depth = 0;
+   for (int l = 0; robot->decodes && l < SRV1_PYRAMID_LEVELS; l++)
+      {
+         if (__atomic_load_n(&robot->rgb_subscribers[l], __ATOMIC_RELAXED) > 0)
+            {
+               depth = l + 1;
+            }
+      }
+   if (depth > 0 && this->decoding)
+      {
+         if (!srv1_decode_submit(&this->decoder, frame.frame->data,
+               frame.frame->size, robot - this->robots, frame.frame->seq,
+               depth))
+            {
+               SRV1_LOG1(SRV1_LOG_DEBUG, "decoder busy; frame %u not decoded\n",
+                     frame.frame->seq);
+            }
+      }
+   if (!robot->has_camera)
+      {
+         return;
+      }
+
+   ////////////////////////////
+   // Update Camera data:
+   player_camera_data_t camdata;
+   memset(&camdata, 0, sizeof(camdata));
+
+   switch (frame.frame->mode)
+   {
+      case SRV1_IMAGE_SMALL:
+         camdata.width = 80;
+         camdata.height = 64;
+         break;
+      case SRV1_IMAGE_MED:
+         camdata.width = 160;
+         camdata.height = 128;
+         break;
+      case SRV1_IMAGE_BIG:
+         camdata.width = 320;
+         camdata.height = 240;
+         break;
+   }
+
+   camdata.fdiv = 1;
+   camdata.bpp = 24;
+   camdata.format = PLAYER_CAMERA_FORMAT_RGB888;
+   camdata.compression = PLAYER_CAMERA_COMPRESS_JPEG;
+
+   // Point straight at the pooled buffer the serial reader filled. Publish()
+   // makes the one copy the message queue needs; we hold our reference
+   // until it returns.
+   camdata.image_count = frame.frame->size;
+   camdata.image = (uint8_t *) frame.frame->data;
+
+   // CARLOS: explicitly, writing image to file (for testing only)
+   //             savePhoto("published", (char *)camdata.image, camdata.image_count);
+
+   this->Publish(robot->camera_addr, PLAYER_MSGTYPE_DATA,
+         PLAYER_CAMERA_DATA_STATE, (void*) &camdata, sizeof(camdata),
+         NULL);
+}
+
+void
+Surveyor::PublishPositions(int64_t now)
+{
+   double timestamp = now / 1e6;
+
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         if (!robot->has_position)
+            {
+               continue;
+            }
+
+         ////////////////////////////
+         // Update position2d data;
+         player_position2d_data_t posdata;
+         memset(&posdata, 0, sizeof(posdata));
+
+         srv1_odom_pose(&robot->odom, now, &posdata.pos.px, &posdata.pos.py,
+               &posdata.pos.pa);
+         posdata.vel.px = robot->odom.vx;
+         posdata.vel.pa = robot->odom.va;
+
+         this->Publish(robot->position_addr, PLAYER_MSGTYPE_DATA,
+               PLAYER_POSITION2D_DATA_STATE, (void*) &posdata,
+               sizeof(posdata), &timestamp);
+      }
+}
+
+void
+Surveyor::PublishIR(SurveyorRobot *robot, const srv1_event_t &ir)
+{
+   float voltages[SRV1_IR_BEAMS];
+   float ranges[SRV1_IR_BEAMS];
+
+   for (int i = 0; i < SRV1_IR_BEAMS; i++)
+      {
+         voltages[i] = (float) ir.ir[i];
+      }
+   srv1_lut_ir_ranges(ir.ir, ranges, 1, &robot->ir_cal);
+
+   player_ir_data_t irdata;
+   memset(&irdata, 0, sizeof(irdata));
+   irdata.voltages_count = SRV1_IR_BEAMS;
+   irdata.voltages = voltages;
+   irdata.ranges_count = SRV1_IR_BEAMS;
+   irdata.ranges = ranges;
+
+   this->Publish(robot->ir_addr, PLAYER_MSGTYPE_DATA, PLAYER_IR_DATA_RANGES,
+         (void*) &irdata, sizeof(irdata), NULL);
+}
+
+void
+Surveyor::ProcessDecoded()
+{
+   srv1_decode_job_t *job;
+
+   while ((job = srv1_decode_take(&this->decoder)) != NULL)
+      {
+         SurveyorRobot *robot = &this->robots[job->tag];
+
+         // Workers can finish out of order; never go back in time.
+         if (job->ok && (!robot->rgb_published
+               || (int32_t) (job->seq - robot->rgb_seq) > 0))
+            {
+               for (int l = 0; l < job->depth; l++)
+                  {
+                     if (!robot->has_rgb[l])
+                        {
+                           continue;
+                        }
+                     const srv1_image_t *img = &job->levels[l];
+                     player_camera_data_t camdata;
+                     memset(&camdata, 0, sizeof(camdata));
+
+                     camdata.width = img->width;
+                     camdata.height = img->height;
+                     camdata.fdiv = 1;
+                     camdata.bpp = 24;
+                     camdata.format = PLAYER_CAMERA_FORMAT_RGB888;
+                     camdata.compression = PLAYER_CAMERA_COMPRESS_RAW;
+                     camdata.image_count = srv1_image_size(img);
+                     camdata.image = img->data;
+
+                     this->Publish(robot->rgb_addr[l], PLAYER_MSGTYPE_DATA,
+                           PLAYER_CAMERA_DATA_STATE, (void*) &camdata,
+                           sizeof(camdata), NULL);
+                  }
+               robot->rgb_seq = job->seq;
+               robot->rgb_published = true;
+            }
+         else if (!job->ok)
+            {
+               SRV1_LOG1(SRV1_LOG_WARN, "frame %u is not a valid JPEG\n",
+                     job->seq);
+            }
+         srv1_decode_release(&this->decoder, job);
+      }
+}
+
+void
+Surveyor::LinkNotify(void *arg)
+{
+   // Runs on the reactor thread: just wake Main() out of Wait().
+   Surveyor *driver = (Surveyor *) arg;
+   driver->InQueue->DataAvailable();
+}
+
+int
+Surveyor::Subscribe(player_devaddr_t addr)
+{
+   int res = ThreadedDriver::Subscribe(addr);
+   if (res != 0)
+      {
+         return res;
+      }
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         for (int l = 0; l < SRV1_PYRAMID_LEVELS; l++)
+            {
+               if (robot->has_rgb[l]
+                     && Device::MatchDeviceAddress(addr, robot->rgb_addr[l]))
+                  {
+                     __atomic_add_fetch(&robot->rgb_subscribers[l], 1,
+                           __ATOMIC_RELAXED);
+                  }
+            }
+      }
+   return 0;
+}
+
+int
+Surveyor::Unsubscribe(player_devaddr_t addr)
+{
+   int res = ThreadedDriver::Unsubscribe(addr);
+   if (res != 0)
+      {
+         return res;
+      }
+   for (int i = 0; i < this->num_robots; i++)
+      {
+         SurveyorRobot *robot = &this->robots[i];
+         for (int l = 0; l < SRV1_PYRAMID_LEVELS; l++)
+            {
+               if (robot->has_rgb[l]
+                     && Device::MatchDeviceAddress(addr, robot->rgb_addr[l]))
+                  {
+                     __atomic_sub_fetch(&robot->rgb_subscribers[l], 1,
+                           __ATOMIC_RELAXED);
+                  }
+            }
+      }
+   return 0;
+}
+
 int
 Surveyor::ProcessMessage(QueuePointer &resp_queue, player_msghdr *hdr,
       void *data)
@@ -243,50 +1199,110 @@ Surveyor::ProcessMessage(QueuePointer &resp_queue, player_msghdr *hdr,
    // return -1, and a NACK will be sent for you, if a response is required.
    //   printf("\nCARLOS: I'm in ProcessMessage\n");
 
-   if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_CMD,
-         PLAYER_POSITION2D_CMD_VEL, this->position_addr))
+   for (int i = 0; i < this->num_robots; i++)
       {
-         printf("\nCARLOS: I'm Matching Message\n");
+         SurveyorRobot *robot = &this->robots[i];
+         if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_CMD,
+               PLAYER_POSITION2D_CMD_VEL, robot->position_addr))
+            {
+               SRV1_LOG0(SRV1_LOG_DEBUG, "\nCARLOS: I'm Matching Message\n");
 
-         // position motor command
-         player_position2d_cmd_vel_t position_cmd;
-         position_cmd = *(player_position2d_cmd_vel_t *) data;
-         PLAYER_MSG2(2,"sending motor commands %f %f", position_cmd.vel.px, position_cmd.vel.pa);
+               // position motor command
+               player_position2d_cmd_vel_t position_cmd;
+               position_cmd = *(player_position2d_cmd_vel_t *) data;
+               PLAYER_MSG2(2,"sending motor commands %f %f", position_cmd.vel.px, position_cmd.vel.pa);
 
-         if (!srv1_set_speed(this->srvdev, position_cmd.vel.px,
-               position_cmd.vel.pa))
+               // Hand it to the reactor; the result comes back as an event.
+               // If the previous command hasn't gone out yet this one replaces it.
+               srv1_link_set_speed(robot->link, position_cmd.vel.px,
+                     position_cmd.vel.pa);
+
+               return 0;
+            }
+         else if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
+               PLAYER_POSITION2D_REQ_MOTOR_POWER, robot->position_addr))
             {
-               PLAYER_ERROR("failed to set speed on SRV-1");
+               this->Publish(robot->position_addr, resp_queue,
+                     PLAYER_MSGTYPE_RESP_ACK, PLAYER_POSITION2D_REQ_MOTOR_POWER);
+               return 0;
             }
+         else if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
+               PLAYER_POSITION2D_REQ_GET_GEOM, robot->position_addr))
+            {
+               /* Return the robot geometry. */
+               memset(&pos_geom, 0, sizeof pos_geom);
+               // Assume that it turns about its geometric center, so zeros are fine
 
-         return 0;
-      }
-   else if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
-         PLAYER_POSITION2D_REQ_MOTOR_POWER, this->position_addr))
-      {
-         this->Publish(this->position_addr, resp_queue,
-               PLAYER_MSGTYPE_RESP_ACK, PLAYER_POSITION2D_REQ_MOTOR_POWER);
-         return 0;
-      }
-   else if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
-         PLAYER_POSITION2D_REQ_GET_GEOM, this->position_addr))
-      {
-         /* Return the robot geometry. */
-         memset(&pos_geom, 0, sizeof pos_geom);
-         // Assume that it turns about its geometric center, so zeros are fine
+               pos_geom.size.sl = SRV1_DIAMETER;
+               pos_geom.size.sw = SRV1_DIAMETER;
 
-         pos_geom.size.sl = SRV1_DIAMETER;
-         pos_geom.size.sw = SRV1_DIAMETER;
+               this->Publish(robot->position_addr, resp_queue,
+                     PLAYER_MSGTYPE_RESP_ACK, PLAYER_POSITION2D_REQ_GET_GEOM,
+                     (void*) &pos_geom, sizeof pos_geom, NULL);
+               return 0;
+            }
+         else if (Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
+               PLAYER_POSITION2D_REQ_RESET_ODOM, robot->position_addr)
+               || Message::MatchMessage(hdr, PLAYER_MSGTYPE_REQ,
+                     PLAYER_POSITION2D_REQ_SET_ODOM, robot->position_addr))
+            {
+               // Keeps the current velocity; only the pose starts over.
+               int64_t now = srv1_sched_now();
+               double vx = robot->odom.vx;
+               double va = robot->odom.va;
+               player_pose2d_t pose;
+               memset(&pose, 0, sizeof(pose));
+               if (hdr->subtype == PLAYER_POSITION2D_REQ_SET_ODOM)
+                  {
+                     pose = ((player_position2d_set_odom_req_t *) data)->pose;
+                  }
+               srv1_odom_init(&robot->odom, pose.px, pose.py, pose.pa, now);
+               srv1_odom_set_velocity(&robot->odom, vx, va, now);
 
-         this->Publish(this->position_addr, resp_queue,
-               PLAYER_MSGTYPE_RESP_ACK, PLAYER_POSITION2D_REQ_GET_GEOM,
-               (void*) &pos_geom, sizeof pos_geom, NULL);
-         return 0;
-      }
-   else
-      {
-         return -1;
+               this->Publish(robot->position_addr, resp_queue,
+                     PLAYER_MSGTYPE_RESP_ACK, hdr->subtype);
+               return 0;
+            }
+         else if (robot->has_ir && Message::MatchMessage(hdr,
+               PLAYER_MSGTYPE_REQ, PLAYER_IR_REQ_POSE, robot->ir_addr))
+            {
+               // On the rim, facing out: front, left, back, right.
+               player_pose3d_t poses[4];
+               memset(poses, 0, sizeof(poses));
+               for (int b = 0; b < 4; b++)
+                  {
+                     poses[b].pyaw = b * M_PI / 2;
+                     poses[b].px = cos(poses[b].pyaw) * SRV1_DIAMETER / 2;
+                     poses[b].py = sin(poses[b].pyaw) * SRV1_DIAMETER / 2;
+                  }
+
+               player_ir_pose_t pose;
+               pose.poses_count = 4;
+               pose.poses = poses;
+               this->Publish(robot->ir_addr, resp_queue,
+                     PLAYER_MSGTYPE_RESP_ACK, PLAYER_IR_REQ_POSE,
+                     (void*) &pose, sizeof pose, NULL);
+               return 0;
+            }
+         else if (robot->has_opaque && Message::MatchMessage(hdr,
+               PLAYER_MSGTYPE_REQ, PLAYER_OPAQUE_REQ_DATA,
+               robot->opaque_addr))
+            {
+               // The reactor keeps updating the counters; take a copy.
+               srv1_stats_t st;
+               srv1_stats_snapshot(&robot->srvdev->stats, &st);
+
+               player_opaque_data_t reply;
+               reply.data_count = sizeof(st);
+               reply.data = (uint8_t *) &st;
+               this->Publish(robot->opaque_addr, resp_queue,
+                     PLAYER_MSGTYPE_RESP_ACK, PLAYER_OPAQUE_REQ_DATA,
+                     (void*) &reply, sizeof reply, NULL);
+               return 0;
+            }
       }
+
+   return -1;
    // No commands / requests for cameras
    // CARLOS: Why???
 
@@ -26,9 +26,14 @@
 
 #include <libplayercore/playercore.h>
 
+#include "surveyor_change.h"
 #include "surveyor_comms.h"
-
-#define SRVMIN_CYCLE_TIME 200000
+#include "surveyor_decode.h"
+#include "surveyor_link.h"
+#include "surveyor_log.h"
+#include "surveyor_lut.h"
+#include "surveyor_odom.h"
+#include "surveyor_sched.h"
 
 /** @ingroup drivers */
 
@@ -58,32 +63,158 @@
  The surveyor driver provides the following device interfaces:
 
  - @ref interface_position2d
- - This interface does not return odometry data, but accepts velocity commands.
+ - Accepts velocity commands, and returns the velocities the robot
+   acknowledged with the pose they add up to (dead reckoning; the SRV-1 has
+   no wheel encoders). Published odom_rate times a second, timestamped with
+   the monotonic clock.
 
  - @ref interface_camera
- - The camera on the robot returns JPEG images.
+ - The camera on the robot returns JPEG images, published at up to
+   camera_publish_rate.
+
+ - @ref interface_camera (keys "raw", "half" and "quarter")
+ - The same images decoded on the host to uncompressed RGB888: at full size,
+   and shrunk to 1/2 and 1/4 of it (each pixel the mean of a 2x2 or 4x4
+   block). Frames are only decoded, and levels only computed, while someone
+   subscribes. List the JPEG camera first. With n robots, robot i provides
+   "raw:::camera:<n+i>", "half:::camera:<2n+i>" and
+   "quarter:::camera:<3n+i>".
 
  - @ref interface_ir
- - The robot has 4 IR beacons which can act as rudimentary range-finders
- - UNIMPLEMENTED
+ - The robot has 4 IR beacons which can act as rudimentary range-finders:
+   front, left, back and right. Voltages are the raw readings, ranges their
+   distance estimate in meters (from a 256 entry table, calibrated with
+   ir_scale and ir_offset). Polled at ir_rate between images, published at
+   up to ir_publish_rate.
+
+ Each interface publishes on its own timer, so a slow JPEG transfer does not
+ hold back the position2d updates.
 
  - @ref interface_dio
  - The robot has 5 pins which can be used as digital in/out ports.
  - UNIMPLEMENTED
 
+ - @ref interface_opaque
+ - Statistics of the serial link; see below. With several robots, robot i
+   provides opaque:i.
+
  @par  Supported configuration requests
 
- - none
+ - PLAYER_POSITION2D_REQ_RESET_ODOM, PLAYER_POSITION2D_REQ_SET_ODOM: start
+   dead reckoning again from the origin or from the given pose.
+
+ - PLAYER_IR_REQ_POSE: where the four beacons sit on the robot.
+
+ - PLAYER_OPAQUE_REQ_DATA on the opaque interface (its body is ignored) is
+   answered with a srv1_stats_t (surveyor_stats.h, host byte order):
+   per-transaction latency histograms for 'M', image mode changes, 'I' and
+   'B', and counts of timeouts, image retries, bytes thrown away, and images
+   that were cut short or weren't a whole JPEG (none of which are
+   published). Check its version field against SRV1_STATS_VERSION. Other
+   requests there are refused.
 
  @par  Configuration file options
 
- - port (string)
- - Serial port used to communicate with the robot
+ - port (string or tuple of strings)
+ - Serial port used to communicate with the robot. List several ports to
+   serve a fleet from one driver: robot i then provides position2d:i and
+   camera:i, and one thread multiplexes the serial traffic of all of them.
  - Default: "/dev/ttyUSB0"
+ - baud (integer)
+ - Line rate of the serial ports: 115200, 230400, 460800 or 921600, to
+   match what the radios are set to. A 320x240 image is about 10 KB, so at
+   115200 the link carries few frames per second. 0 finds the rate at
+   startup: each rate is tried, fastest first, and the first that answers
+   3 version queries in a row is kept.
+ - Default: 115200
+ - motor_keepalive (float)
+ - A velocity command that comes to the wheel speeds the robot last
+   acknowledged is not sent, unless that was this many seconds ago. Clients
+   that repeat the same command all the time then leave the link to the
+   camera. 0 sends every command.
+ - Default: 1
  - image_size (string)
  - Size of the images returned by the camera.
  - Default: "320x240"
  - Allowed values: "320x240", "160x128", "80x64"
+ - Also a property, so clients can change it while the driver runs (e.g.
+   with playerprop). An image already on its way arrives in the old size;
+   the camera is switched before the next one.
+ - image_rate (float)
+ - Images requested per second and robot; 0 requests the next one as soon
+   as the link is free. IR polls only go out when they will be over before
+   the next image is due, so they never delay a frame; with 0 they get only
+   the gaps when the driver falls behind, so set a rate below what the link
+   carries to leave them room.
+ - Default: 0
+ - ir_rate (float)
+ - IR polls per second and robot, for robots that provide the ir interface.
+   Each is a 'B' request and a 46 byte reply.
+ - Default: 5
+ - ir_scale, ir_offset (tuples of floats)
+ - Calibration of the IR ranges: each beam's modelled range is multiplied by
+   its scale, then its offset (m) is added. Four values, for the front,
+   left, back and right beams, shared by every robot; or four per robot, in
+   port order.
+ - Default: scale 1, offset 0
+ - image_pipeline (integer)
+ - Request the next image as soon as a frame buffer is free, so the robot
+   captures and transmits while the driver publishes. With 0 the next image is
+   only requested once the previous one has been published.
+ - Default: 1
+ - transport (string)
+ - How serial I/O is done: "posix" (read/write/poll) or "uring" (io_uring,
+   Linux 5.11 or later; a request and the read of its reply go to the
+   kernel together, and all robots share one ring). Falls back to "posix"
+   if io_uring can't be used. "replay" plays back capture files instead:
+   each port then names a file recorded with the capture option.
+ - Default: "posix"
+ - replay_speed (float)
+ - With the replay transport, how fast the recorded timeline runs: 1 is as
+   recorded, 2 twice as fast, 0 as fast as the driver can take the bytes.
+ - Default: 1
+ - capture (string)
+ - Record all serial traffic, with timestamps, to this file (robot i to
+   "<capture>.<i>" when there are several). See surveyor_capture.h.
+ - Default: none
+ - odom_rate (float)
+ - Position2d updates published per second. The pose is worked out for the
+   moment of publishing, so this needn't wait for the robot.
+ - Default: 50
+ - camera_publish_rate (float)
+ - Most frames published per second on each camera (the decoded ones
+   follow). Only the newest frame is kept while waiting; older ones are
+   dropped. 0 publishes every frame as it arrives. image_rate is what the
+   robot is asked for; this is what clients get.
+ - Default: 0
+ - ir_publish_rate (float)
+ - The same for the IR readings; 0 publishes each poll as it comes in.
+ - Default: 0
+ - report_interval (float)
+ - Seconds between log messages with the statistics of the publish timers
+   (at message level 1): updates, lateness, overruns and skipped periods. 0
+   disables them.
+ - Default: 10
+ - log_level (string)
+ - Which of the driver's own serial-link messages are written: "error",
+   "warn", "info", "debug" or "trace". They are queued without blocking and
+   written by a background thread, so even "trace" does not slow the link.
+ - Default: "info"
+ - change_threshold (float)
+ - Don't publish (or decode) frames that look like the last one published:
+   their 1/8 scale greyscale thumbnails differ by less than this mean
+   absolute difference per pixel (0 to 255; 2 to 4 rides out sensor noise).
+   0 publishes every frame.
+ - Default: 0
+ - change_max_gap (float)
+ - With change_threshold, publish a frame at least this often (seconds)
+   even if nothing changes, so clients can tell the camera is alive.
+   0 waits for a change however long it takes.
+ - Default: 1
+ - decode_threads (integer)
+ - Threads decoding JPEGs for the decoded camera interfaces. Only the newest
+   frame of each robot waiting to be decoded is kept.
+ - Default: 2
  - plugin (string)
  - Relative or Absolute path to the location of the shared-object plugin driver.
 
@@ -97,15 +228,40 @@
        provides ["position2d:0" "camera:0"]
        port "/dev/ttyUSB0"
     )
+
+ driver
+    (
+       name "surveyor"
+       plugin "libSurveyor_Driver.so"
+       provides ["position2d:0" "camera:0" "position2d:1" "camera:1"]
+       port ["/dev/ttyUSB0" "/dev/ttyUSB1"]
+    )
+
+ driver
+    (
+       name "surveyor"
+       plugin "libSurveyor_Driver.so"
+       provides ["position2d:0" "camera:0" "raw:::camera:1" "quarter:::camera:2"]
+       port "/dev/ttyUSB0"
+    )
+
+ driver
+    (
+       name "surveyor"
+       plugin "libSurveyor_Driver.so"
+       provides ["position2d:0" "camera:0" "ir:0"]
+       port "/dev/ttyUSB0"
+       image_rate 2
+       ir_rate 5
+    )
  @endverbatim
 
  @bug
  - Camera interface has a small delay for snapshots (Robot has to focus first, and then shoot)
  - Camera rate is very slow - about 1fps...Could do better: at least 4fps
+ - IR sensors are very noisy and produce false negatives on dark and shiny obstacles
 
  @todo
- - Property bags to change image size on the fly
- - Implement IR (IR sensors are very noisy and produce false negatives on dark and shiny obstacles)
  - Implement DIO
  - Opaque interface to set program
 
@@ -115,6 +271,44 @@
  */
 /** @} */
 
+/** @brief Player-side state of one robot served by the driver.
+ * @ingroup driver_surveyor
+ */
+struct SurveyorRobot
+{
+      const char *portname; ///< Serial port
+
+      player_devaddr_t position_addr; ///< Address of the position device (wheels odometry)
+      player_devaddr_t camera_addr; ///< Address of the camera device
+      player_devaddr_t rgb_addr[SRV1_PYRAMID_LEVELS]; ///< Decoded (RGB888) cameras: full size, 1/2, 1/4
+      player_devaddr_t ir_addr; ///< Address of the infrared (IR) beacons
+      player_devaddr_t dio_addr; ///< Address of the digital input/output pins (ports)
+      player_devaddr_t opaque_addr; ///< Address the link statistics are requested on
+      bool has_position; ///< position_addr is provided
+      bool has_camera; ///< camera_addr is provided
+      bool has_rgb[SRV1_PYRAMID_LEVELS]; ///< rgb_addr[level] is provided
+      bool decodes; ///< Any of rgb_addr is provided
+      bool has_opaque; ///< opaque_addr is provided
+      bool has_ir; ///< ir_addr is provided
+
+      int image_mode; ///< Camera size for this robot (SRV1_IMAGE_OFF without a camera)
+      int rgb_subscribers[SRV1_PYRAMID_LEVELS]; ///< Clients of rgb_addr[level] (atomic)
+      uint32_t rgb_seq; ///< Frame number last published on the decoded cameras
+      bool rgb_published; ///< rgb_seq is valid
+      srv1_change_t change; ///< Finds the frames not worth publishing
+      srv1_ir_cal_t ir_cal; ///< Corrects this robot's IR ranges
+
+      srv1_comm_t *srvdev; ///< The surveyor object
+      srv1_link_t *link; ///< Its end of the reactor while running
+
+      srv1_odom_t odom; ///< Pose and the velocities last acknowledged by the robot
+
+      srv1_event_t held_frame; ///< Newest frame, waiting for the camera timer
+      bool frame_held; ///< held_frame is valid (and keeps its buffer)
+      srv1_event_t held_ir; ///< Newest IR readings, waiting for the IR timer
+      bool ir_held; ///< held_ir is valid
+};
+
 //class Surveyor : public Driver
 class Surveyor : public ThreadedDriver
 {
@@ -157,6 +351,21 @@ class Surveyor : public ThreadedDriver
       int
       ProcessMessage(QueuePointer & resp_queue, player_msghdr *hdr, void *data);
 
+      /** @brief Counts the subscribers of the decoded camera interfaces, so
+       * that frames are only decoded for someone.
+       * @param addr The device being subscribed to
+       * @returns 0 on success.
+       */
+      int
+      Subscribe(player_devaddr_t addr);
+
+      /** @brief Counterpart of Subscribe().
+       * @param addr The device being unsubscribed from
+       * @returns 0 on success.
+       */
+      int
+      Unsubscribe(player_devaddr_t addr);
+
    private:
 
       /** @brief  Main "entry point" function for the driver thread created using
@@ -165,19 +374,146 @@ class Surveyor : public ThreadedDriver
       virtual void
       Main();
 
-      const char *portname; ///< Serial port
+      /** @brief Reads the configuration of one robot and adds its interfaces.
+       * @param cf Current configuration file
+       * @param section Current section in configuration file
+       * @param i Index of the robot (and of its port entry)
+       * @returns true on success.
+       */
+      bool
+      AddRobot(ConfigFile *cf, int section, int i);
 
-      player_devaddr_t position_addr; ///< Address of the position device (wheels odometry)
-      player_devaddr_t camera_addr; ///< Address of the camera device
-      player_devaddr_t ir_addr; ///< Address of the infrared (IR) beacons
-      player_devaddr_t dio_addr; ///< Address of the digital input/output pins (ports)
+      /** @brief Stops the reactor and disconnects every robot. */
+      void
+      ReleaseRobots();
 
-      srv1_comm_t *srvdev; ///< The surveyor object
+      /** @brief Handles the queued events of every robot. */
+      void
+      ProcessLinkEvents();
+
+      /** @brief Takes every event the reactor has queued for one robot:
+       * records motor acknowledgements and holds on to the newest camera
+       * frame and IR readings until PublishHeld() sends them.
+       * @param robot The robot
+       */
+      void
+      ProcessLinkEvents(SurveyorRobot *robot);
+
+      /** @brief Publishes the held frames and IR readings of every robot
+       * whose interface timer is due.
+       * @param now Monotonic time (usec)
+       */
+      void
+      PublishHeld(int64_t now);
+
+      /** @brief Checks an interface timer and, if it is due, starts its next
+       * period. A timer without a rate is always due.
+       * @param sched The interface timer
+       * @param rate Its publish rate (per second; 0 = on arrival)
+       * @param now Monotonic time (usec)
+       * @returns true if the interface may publish now.
+       */
+      static bool
+      PublishDue(srv1_sched_t *sched, double rate, int64_t now);
+
+      /** @brief How long Main() may sleep before some timer is due.
+       * @param now Monotonic time (usec)
+       * @returns Microseconds, 0 or less if something is due already.
+       */
+      int64_t
+      NextDeadline(int64_t now);
+
+      /** @brief Publishes one frame from the reactor on a robot's camera interface.
+       * @param robot The robot the frame came from
+       * @param frame SRV1_EVT_FRAME event describing the frame
+       */
+      void
+      PublishCamera(SurveyorRobot *robot, const srv1_event_t &frame);
+
+      /** @brief Publishes every robot's velocity and dead-reckoned pose.
+       * @param now Monotonic time to publish them for (usec)
+       */
+      void
+      PublishPositions(int64_t now);
+
+      /** @brief Publishes one set of IR readings from the reactor.
+       * @param robot The robot they came from
+       * @param ir SRV1_EVT_IR event carrying them
+       */
+      void
+      PublishIR(SurveyorRobot *robot, const srv1_event_t &ir);
+
+      /** @brief Publishes every frame the decoder has finished on the
+       * decoded camera interfaces of its robot.
+       */
+      void
+      ProcessDecoded();
+
+      /** @brief Switches every camera to the size in the image_size
+       * property, if a client changed it.
+       */
+      void
+      ApplyImageSize();
+
+      /** @brief Logs and resets the statistics of the interface timers. */
+      void
+      ReportTimerStats();
+
+      /** @brief Logs and resets the statistics of one interface timer.
+       * @param sched The timer
+       * @param name Interface name for the log
+       * @param rate Its publish rate (per second)
+       * @param held Whether it publishes held data (and so waits for it)
+       */
+      static void
+      ReportPublishStats(srv1_sched_t *sched, const char *name, double rate,
+            bool held);
+
+      /** @brief Logs a summary of one robot's link statistics.
+       * @param i Index of the robot
+       */
+      void
+      ReportLinkStats(int i);
+
+      /** @brief Callback run on the reactor thread when it has queued events;
+       * wakes Main() out of Wait().
+       * @param arg The Surveyor driver
+       */
+      static void
+      LinkNotify(void *arg);
+
+      SurveyorRobot robots[SRV1_REACTOR_MAX]; ///< One per port entry
+      int num_robots; ///< Entries used in robots
+      srv1_reactor_t *reactor; ///< Thread that multiplexes all serial traffic
+      const srv1_transport_t *transport; ///< Serial transport from the configuration
+      double replay_speed; ///< Timeline scale for the replay transport
+      const char *capture; ///< Capture file for the traffic (NULL = none)
+      srv1_uring_t uring; ///< Ring shared by the robots on the uring transport
+      srv1_decode_pool_t decoder; ///< Decodes frames for the decoded cameras
+      bool decoding; ///< decoder is running
+      int decode_threads; ///< Threads for decoder
+      double change_threshold; ///< Change that makes a frame worth publishing (0 = all are)
+      double change_max_gap; ///< Longest time between published frames (seconds)
 
       player_position2d_cmd_vel_t position_cmd; ///< position2d velocity command
       player_position2d_geom_t pos_geom; ///< position2d geometry
 
-      int setup_image_mode; ///< Desired camera size
+      StringProperty image_size; ///< Camera size; clients may change it
+      int setup_image_mode; ///< Camera size in effect (from image_size)
+      int pipeline_images; ///< Keep one image request in flight
+      double image_rate; ///< Images requested per second (0 = as fast as the link goes)
+      double ir_rate; ///< IR polls per second
+      long baud; ///< Serial line rate (0 = probe for it)
+      double motor_keepalive; ///< Seconds before unchanged wheel speeds are sent again (0 = always sent)
+
+      srv1_sched_t odom_sched; ///< When position2d data is next due
+      double odom_rate; ///< Position2d updates per second
+      srv1_sched_t camera_sched; ///< When held frames may next be published
+      double camera_publish_rate; ///< Frames published per second (0 = on arrival)
+      srv1_sched_t ir_pub_sched; ///< When held IR readings may next be published
+      double ir_publish_rate; ///< IR readings published per second (0 = on arrival)
+      srv1_sched_t report_sched; ///< When the timer statistics are next logged
+      double report_interval; ///< Seconds between statistics reports (0 = never)
 };
 
 /** @brief Factory creation function that instantiates the Driver
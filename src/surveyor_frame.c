@@ -0,0 +1,124 @@
+/*
+ * surveyor_frame.c
+ *
+ * Pool of reference-counted image buffers shared by the serial link and
+ * the Player thread.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int
+srv1_frame_pool_init(srv1_frame_pool_t *pool)
+{
+   memset(pool, 0, sizeof(*pool));
+
+   pool->storage = (char *) malloc((size_t) SRV1_FRAME_POOL
+         * SRV1_FRAME_CAPACITY);
+   if (pool->storage == NULL)
+      {
+         return 0;
+      }
+
+   for (int i = 0; i < SRV1_FRAME_POOL; i++)
+      {
+         pool->frames[i].data = pool->storage + (size_t) i
+               * SRV1_FRAME_CAPACITY;
+      }
+   return 1;
+}
+
+void
+srv1_frame_pool_destroy(srv1_frame_pool_t *pool)
+{
+   free(pool->storage);
+   pool->storage = NULL;
+}
+
+srv1_frame_t *
+srv1_frame_acquire(srv1_frame_pool_t *pool)
+{
+   for (int i = 0; i < SRV1_FRAME_POOL; i++)
+      {
+         srv1_frame_t *f = &pool->frames[i];
+         int expected = 0;
+         // Claim it only if nobody else did in the meantime.
+         if (__atomic_compare_exchange_n(&f->refs, &expected, 1, 0,
+               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+               f->size = 0;
+               return f;
+            }
+      }
+   return NULL;
+}
+
+int
+srv1_frame_pool_free(srv1_frame_pool_t *pool)
+{
+   int n = 0;
+   for (int i = 0; i < SRV1_FRAME_POOL; i++)
+      {
+         if (__atomic_load_n(&pool->frames[i].refs, __ATOMIC_ACQUIRE) == 0)
+            {
+               n++;
+            }
+      }
+   return n;
+}
+
+void
+srv1_frame_ref(srv1_frame_t *f)
+{
+   __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+}
+
+void
+srv1_frame_unref(srv1_frame_t *f)
+{
+   if (f != NULL)
+      {
+         // Release: our reads of the data happen before the buffer is reused.
+         __atomic_sub_fetch(&f->refs, 1, __ATOMIC_RELEASE);
+      }
+}
+
+int
+srv1_frame_is_jpeg(const char *data, uint32_t size)
+{
+   const unsigned char *p = (const unsigned char *) data;
+   uint32_t end;
+
+   // SOI, then the next marker.
+   if (size < 4 || p[0] != 0xFF || p[1] != 0xD8 || p[2] != 0xFF)
+      {
+         return 0;
+      }
+   for (end = size; end >= 4 && end + SRV1_JPEG_TAIL_SLACK >= size; end--)
+      {
+         if (p[end - 2] == 0xFF && p[end - 1] == 0xD9)
+            {
+               return 1;
+            }
+      }
+   return 0;
+}
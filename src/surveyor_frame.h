@@ -0,0 +1,120 @@
+/*
+ * surveyor_frame.h
+ *
+ * Pool of reference-counted image buffers shared by the serial link and
+ * the Player thread.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_FRAME_H_
+#define SURVEYOR_FRAME_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/* One being received, the latest complete one, and two out with consumers. */
+#define SRV1_FRAME_POOL 4
+
+/* Fixed size of every buffer; a 320x240 JPEG from the SRV-1 is well under. */
+#define SRV1_FRAME_CAPACITY (128 * 1024)
+
+/* Bytes of padding tolerated after a JPEG's EOI marker. */
+#define SRV1_JPEG_TAIL_SLACK 16
+
+   /**
+    * @brief One image buffer. Whoever holds a reference may read it; the
+    * buffer goes back to the pool when the last reference is dropped.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         char *data; ///< SRV1_FRAME_CAPACITY bytes
+         uint32_t size; ///< Bytes of data in use
+         unsigned char mode; ///< Image mode the frame was taken in
+         uint32_t seq; ///< Frame number, counting from the first capture
+         int refs; ///< Reference count (atomic); 0 = free
+   } srv1_frame_t;
+
+   /**
+    * @brief All the image buffers a robot will ever use, allocated up front.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         srv1_frame_t frames[SRV1_FRAME_POOL]; ///< The buffers
+         char *storage; ///< One allocation backing every frame's data
+   } srv1_frame_pool_t;
+
+   /*
+    * Allocates every buffer.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_frame_pool_init(srv1_frame_pool_t *pool);
+
+   /*
+    * Frees every buffer. No references may be outstanding.
+    */
+   void
+   srv1_frame_pool_destroy(srv1_frame_pool_t *pool);
+
+   /*
+    * Takes a free buffer, holding one reference to it. Safe from any thread.
+    * \return the buffer, or NULL if all are in use.
+    */
+   srv1_frame_t *
+   srv1_frame_acquire(srv1_frame_pool_t *pool);
+
+   /*
+    * \return number of buffers nobody holds.
+    */
+   int
+   srv1_frame_pool_free(srv1_frame_pool_t *pool);
+
+   /*
+    * Adds a reference.
+    */
+   void
+   srv1_frame_ref(srv1_frame_t *f);
+
+   /*
+    * Drops a reference; the last one returns the buffer to its pool.
+    * Accepts NULL.
+    */
+   void
+   srv1_frame_unref(srv1_frame_t *f);
+
+   /*
+    * Checks that size bytes look like one whole JPEG: an SOI marker first
+    * and an EOI marker at the end, give or take SRV1_JPEG_TAIL_SLACK bytes
+    * of padding. A body that is cut short or runs into the next reply
+    * fails; the entropy-coded data isn't looked at.
+    * \return 1 if it does, 0 if not.
+    */
+   int
+   srv1_frame_is_jpeg(const char *data, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_FRAME_H_ */
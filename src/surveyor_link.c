@@ -0,0 +1,596 @@
+/*
+ * surveyor_link.c
+ *
+ * Serial link reactor: one thread owns the connections to any number of
+ * SRV-1s, multiplexes their serial traffic in a single poll() loop, and
+ * exchanges commands and events with the Player thread through lock-free
+ * queues.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_link.h"
+#include "surveyor_log.h"
+#include "surveyor_sched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* How long an idle reactor sleeps before re-checking its state. */
+#define LINK_IDLE_MSEC 100
+
+/*
+ * Queues an event for the Player thread. A frame that can't be queued gives
+ * its buffer straight back, otherwise it would never be released.
+ * \return 1 if the event was queued.
+ */
+static int
+emit(srv1_link_t *l, const srv1_event_t *evt)
+{
+   if (!srv1_spsc_push(&l->events, evt))
+      {
+         if (evt->type == SRV1_EVT_FRAME)
+            {
+               srv1_link_release_frame(l, evt->frame);
+            }
+         __atomic_add_fetch(&l->dropped_events, 1, __ATOMIC_RELAXED);
+         return 0;
+      }
+   return 1;
+}
+
+/*
+ * Emits the latest frame if the robot structure received one since we last
+ * looked.
+ */
+static void
+emit_new_frame(srv1_link_t *l)
+{
+   srv1_comm_t *x = l->dev;
+   if (x->frame_seq == l->seen || x->frame == NULL)
+      {
+         return;
+      }
+   l->seen = x->frame_seq;
+
+   srv1_event_t evt;
+   memset(&evt, 0, sizeof(evt));
+   evt.type = SRV1_EVT_FRAME;
+   evt.ok = 1;
+   evt.frame = x->frame;
+
+   // The event owns a reference until the Player thread releases it.
+   srv1_frame_ref(evt.frame);
+   __atomic_add_fetch(&l->frames_out, 1, __ATOMIC_RELAXED);
+   emit(l, &evt);
+}
+
+static void
+emit_ir(srv1_link_t *l, int ok)
+{
+   srv1_event_t evt;
+   memset(&evt, 0, sizeof(evt));
+   evt.type = SRV1_EVT_IR;
+   evt.ok = ok;
+   memcpy(evt.ir, l->dev->bouncedir, sizeof(evt.ir));
+   emit(l, &evt);
+}
+
+static void
+emit_motors(srv1_link_t *l, int ok)
+{
+   srv1_event_t evt;
+   memset(&evt, 0, sizeof(evt));
+   evt.type = SRV1_EVT_MOTORS;
+   evt.ok = ok;
+   evt.vx = l->dev->vx;
+   evt.va = l->dev->va;
+   evt.usec = srv1_sched_now();
+   emit(l, &evt);
+}
+
+/*
+ * Whether l may capture another image at all. Only capture when there is a
+ * buffer to capture into; otherwise the Player thread is behind and will
+ * hand one back shortly. Without pipelining, wait until it has finished
+ * with the last frame, too.
+ */
+static int
+images_wanted(srv1_link_t *l)
+{
+   srv1_comm_t *x = l->dev;
+   return x->image_mode != SRV1_IMAGE_OFF
+         && srv1_frame_pool_free(&x->frames) > 0
+         && (x->pipeline || __atomic_load_n(&l->frames_out, __ATOMIC_RELAXED)
+               == 0);
+}
+
+/*
+ * Sends a velocity command, unless the robot already runs at those wheel
+ * speeds. An image request that is due (and not backing off) goes out in
+ * the same write.
+ * \return 1 if events were queued (the command failed outright).
+ */
+static int
+start_speed(srv1_link_t *l, const srv1_cmd_t *cmd, int64_t now)
+{
+   srv1_comm_t *x = l->dev;
+
+   // Clients repeat themselves; the robot keeps its speed regardless.
+   if (srv1_speed_unchanged(x, cmd->vx, cmd->va))
+      {
+         l->unchanged_speeds++;
+         return 0;
+      }
+
+   int image = now >= l->retry_at && images_wanted(l)
+         && x->set_image_mode == x->image_mode
+         && srv1_sched_due(&l->image_sched, now);
+   if (!(image ? srv1_begin_speed_image(x, cmd->vx, cmd->va)
+         : srv1_begin_speed(x, cmd->vx, cmd->va)))
+      {
+         emit_motors(l, 0);
+         return 1;
+      }
+   if (image)
+      {
+         srv1_sched_begin(&l->image_sched, now);
+         l->combined_writes++;
+      }
+   return 0;
+}
+
+/*
+ * Starts the next transaction for an idle robot. Velocity goes first: it is
+ * the most latency sensitive, and only the newest one matters. Images fill
+ * the link at their rate, and IR polls the gaps they leave.
+ * \return 1 if events were queued (a command failed outright).
+ */
+static int
+start_next(srv1_link_t *l, int64_t now)
+{
+   srv1_comm_t *x = l->dev;
+   srv1_cmd_t cmd;
+
+   // Commands go out even while polling backs off from a failure: a stop
+   // must not wait for the camera.
+   if (srv1_mailbox_take(&l->speed, &cmd) || srv1_spsc_pop(&l->cmds, &cmd))
+      {
+         switch (cmd.type)
+            {
+         case SRV1_CMD_SPEED:
+            if (start_speed(l, &cmd, now))
+               {
+                  return 1;
+               }
+            break;
+         case SRV1_CMD_IMAGE_MODE:
+            // srv1_begin_image() switches the camera before the next image,
+            // which may as well be requested right away.
+            x->image_mode = cmd.mode;
+            break;
+         default:
+            SRV1_LOG1(SRV1_LOG_WARN, "srv1_link: unknown command %d\n", cmd.type);
+            break;
+            }
+         if (x->txn != SRV1_TXN_NONE)
+            {
+               return 0;
+            }
+      }
+
+   if (now < l->retry_at)
+      {
+         return 0;
+      }
+
+   int images = images_wanted(l);
+
+   // An IR poll has to be over before the next image is due.
+   if (l->poll_ir && srv1_sched_due(&l->ir_sched, now) && (!images
+         || srv1_sched_remaining(&l->image_sched, now) >= l->ir_cost))
+      {
+         srv1_sched_begin(&l->ir_sched, now);
+         if (!srv1_begin_ir(x))
+            {
+               l->retry_at = now + LINK_IDLE_MSEC * 1000;
+            }
+         return 0;
+      }
+
+   if (images && srv1_sched_due(&l->image_sched, now))
+      {
+         if (!srv1_begin_image(x))
+            {
+               l->retry_at = now + LINK_IDLE_MSEC * 1000;
+            }
+         // A mode change goes first and doesn't count as the image.
+         else if (x->txn == SRV1_TXN_IMAGE)
+            {
+               srv1_sched_begin(&l->image_sched, now);
+            }
+      }
+   return 0;
+}
+
+/*
+ * Lets a robot's transaction in flight make progress.
+ * \return 1 if events were queued.
+ */
+static int
+service_link(srv1_link_t *l, int64_t now)
+{
+   int ok;
+   switch (srv1_service(l->dev, &ok))
+      {
+   case SRV1_TXN_NONE:
+      return 0;
+   case SRV1_TXN_MOTORS:
+      emit_motors(l, ok);
+      // Its reply may be in already if an image request went along.
+      if (l->dev->txn == SRV1_TXN_IMAGE)
+         {
+            service_link(l, now);
+         }
+      return 1;
+   case SRV1_TXN_IMAGE:
+      emit_new_frame(l);
+      break;
+   case SRV1_TXN_IR:
+      if (ok)
+         {
+            // Tracks what the robot and radio actually take.
+            l->ir_cost = (3 * l->ir_cost + (now - l->dev->txn_start)) / 4;
+         }
+      emit_ir(l, ok);
+      if (!ok)
+         {
+            l->retry_at = now + LINK_IDLE_MSEC * 1000;
+         }
+      return 1;
+   default:
+      break;
+      }
+
+   // Don't hammer a robot that stopped answering.
+   if (!ok)
+      {
+         l->retry_at = now + LINK_IDLE_MSEC * 1000;
+      }
+   return ok;
+}
+
+/*
+ * Rouses the reactor thread if it is idling in poll().
+ */
+static void
+wake_reactor(srv1_reactor_t *r)
+{
+   // A full pipe is fine: the thread has a wake-up pending already.
+   if (write(r->wake[1], "x", 1) < 0 && errno != EAGAIN)
+      {
+         perror("srv1_link:write()");
+      }
+}
+
+/*
+ * Empties the wake-up pipe; the commands themselves are in the queues.
+ */
+static void
+drain_wake(srv1_reactor_t *r)
+{
+   char junk[64];
+   while (read(r->wake[0], junk, sizeof(junk)) > 0)
+      {
+      }
+}
+
+static void *
+reactor_main(void *arg)
+{
+   srv1_reactor_t *r = (srv1_reactor_t *) arg;
+   struct pollfd pfds[SRV1_REACTOR_MAX + 1];
+   srv1_link_t *polled[SRV1_REACTOR_MAX + 1];
+
+   while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+      {
+         int64_t now = srv1_sched_now();
+         int64_t wake_at = now + LINK_IDLE_MSEC * 1000;
+         int n = 1;
+
+         drain_wake(r);
+
+         pfds[0].fd = r->wake[0];
+         pfds[0].events = POLLIN;
+         pfds[0].revents = 0;
+
+         // Keep every robot busy; each one only waits on its own reply.
+         for (int i = 0; i < r->nlinks; i++)
+            {
+               srv1_link_t *l = r->links[i];
+               srv1_comm_t *x = l->dev;
+
+               if (x->txn == SRV1_TXN_NONE && start_next(l, now)
+                     && l->notify != NULL)
+                  {
+                     l->notify(l->notify_arg);
+                  }
+
+               if (x->txn != SRV1_TXN_NONE)
+                  {
+                     // Completions that are already in let us skip sleeping.
+                     if (x->io->ready(x))
+                        {
+                           wake_at = now;
+                        }
+                     x->io->flush(x);
+                     pfds[n].fd = x->io->poll_fd(x);
+                     pfds[n].events = POLLIN;
+                     pfds[n].revents = 0;
+                     polled[n] = l;
+                     n++;
+                     if (x->txn_deadline < wake_at)
+                        {
+                           wake_at = x->txn_deadline;
+                        }
+                  }
+               else
+                  {
+                     // Whatever is due already is waiting for something
+                     // that wakes us anyway (a buffer, or the next image).
+                     int64_t due[3] =
+                        { l->retry_at, INT64_MAX, INT64_MAX };
+                     if (x->image_mode != SRV1_IMAGE_OFF)
+                        {
+                           due[1] = l->image_sched.deadline;
+                        }
+                     if (l->poll_ir)
+                        {
+                           due[2] = l->ir_sched.deadline;
+                        }
+                     for (int d = 0; d < 3; d++)
+                        {
+                           if (due[d] > now && due[d] < wake_at)
+                              {
+                                 wake_at = due[d];
+                              }
+                        }
+                  }
+            }
+
+         int timeout = 0;
+         if (wake_at > now)
+            {
+               // Round up so we never wake a hair early and spin.
+               timeout = (int) ((wake_at - now + 999) / 1000);
+            }
+         if (poll(pfds, n, timeout) < 0 && errno != EINTR)
+            {
+               perror("srv1_link:poll()");
+            }
+
+         now = srv1_sched_now();
+         for (int i = 1; i < n; i++)
+            {
+               srv1_link_t *l = polled[i];
+               if (pfds[i].revents == 0 && now < l->dev->txn_deadline
+                     && !l->dev->io->ready(l->dev))
+                  {
+                     continue;
+                  }
+               if (service_link(l, now) && l->notify != NULL)
+                  {
+                     l->notify(l->notify_arg);
+                  }
+            }
+      }
+
+   return NULL;
+}
+
+srv1_reactor_t *
+srv1_reactor_create(void)
+{
+   srv1_reactor_t *r = (srv1_reactor_t *) calloc(1, sizeof(srv1_reactor_t));
+   if (r == NULL)
+      {
+         return NULL;
+      }
+
+   // Non-blocking on both ends: a full pipe already means "wake up".
+   if (pipe(r->wake) < 0)
+      {
+         perror("srv1_reactor_create():pipe()");
+         free(r);
+         return NULL;
+      }
+   if (fcntl(r->wake[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(r->wake[1],
+         F_SETFL, O_NONBLOCK) < 0)
+      {
+         perror("srv1_reactor_create():fcntl()");
+         close(r->wake[0]);
+         close(r->wake[1]);
+         free(r);
+         return NULL;
+      }
+
+   return r;
+}
+
+srv1_link_t *
+srv1_reactor_add(srv1_reactor_t *r, srv1_comm_t *x, void (*notify)(void *),
+      void *notify_arg)
+{
+   if (r->running || r->nlinks == SRV1_REACTOR_MAX)
+      {
+         return NULL;
+      }
+
+   srv1_link_t *l = (srv1_link_t *) calloc(1, sizeof(srv1_link_t));
+   if (l == NULL)
+      {
+         return NULL;
+      }
+
+   l->dev = x;
+   l->reactor = r;
+   l->notify = notify;
+   l->notify_arg = notify_arg;
+   l->seen = x->frame_seq;
+   srv1_link_set_polling(l, 0, 0);
+
+   if (!srv1_spsc_init(&l->cmds, sizeof(srv1_cmd_t), SRV1_LINK_QUEUE_LEN)
+         || !srv1_mailbox_init(&l->speed, sizeof(srv1_cmd_t))
+         || !srv1_spsc_init(&l->events, sizeof(srv1_event_t),
+               SRV1_LINK_QUEUE_LEN))
+      {
+         srv1_spsc_destroy(&l->cmds);
+         srv1_mailbox_destroy(&l->speed);
+         srv1_spsc_destroy(&l->events);
+         free(l);
+         return NULL;
+      }
+
+   r->links[r->nlinks++] = l;
+   return l;
+}
+
+void
+srv1_link_set_polling(srv1_link_t *l, int64_t image_period,
+      int64_t ir_period)
+{
+   long baud = l->dev->baud > 0 ? l->dev->baud : SRV1_DEFAULT_BAUD;
+
+   srv1_sched_init(&l->image_sched, image_period);
+   srv1_sched_init(&l->ir_sched, ir_period);
+   l->poll_ir = (ir_period > 0);
+
+   // Until one is measured: twice the time 'B' and its reply take on the
+   // wire, ten bits a byte.
+   l->ir_cost = 2 * (int64_t) (1 + SRV1_IR_REPLY_LEN) * 10 * 1000000 / baud;
+}
+
+int
+srv1_reactor_start(srv1_reactor_t *r)
+{
+   if (pthread_create(&r->thread, NULL, reactor_main, r) != 0)
+      {
+         perror("srv1_reactor_start():pthread_create()");
+         return 0;
+      }
+   r->running = 1;
+   return 1;
+}
+
+void
+srv1_reactor_destroy(srv1_reactor_t *r)
+{
+   if (r->running)
+      {
+         __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+         wake_reactor(r);
+         pthread_join(r->thread, NULL);
+      }
+
+   for (int i = 0; i < r->nlinks; i++)
+      {
+         srv1_link_t *l = r->links[i];
+
+         // Frames nobody took still hold references.
+         srv1_event_t evt;
+         while (srv1_spsc_pop(&l->events, &evt))
+            {
+               if (evt.type == SRV1_EVT_FRAME)
+                  {
+                     srv1_frame_unref(evt.frame);
+                  }
+            }
+
+         // Leave the robot ready for the blocking calls again: a reply
+         // still on its way would otherwise be taken for theirs (and with
+         // pipelining that is usually the rest of a JPEG).
+         if (!srv1_finish_txn(l->dev))
+            {
+               srv1_reset_comms(l->dev);
+            }
+
+         srv1_spsc_destroy(&l->cmds);
+         srv1_mailbox_destroy(&l->speed);
+         srv1_spsc_destroy(&l->events);
+         free(l);
+      }
+
+   close(r->wake[0]);
+   close(r->wake[1]);
+   free(r);
+}
+
+int
+srv1_link_send(srv1_link_t *l, const srv1_cmd_t *cmd)
+{
+   if (!srv1_spsc_push(&l->cmds, cmd))
+      {
+         return 0;
+      }
+   wake_reactor(l->reactor);
+   return 1;
+}
+
+int
+srv1_link_set_speed(srv1_link_t *l, double vx, double va)
+{
+   srv1_cmd_t cmd;
+   memset(&cmd, 0, sizeof(cmd));
+   cmd.type = SRV1_CMD_SPEED;
+   cmd.vx = vx;
+   cmd.va = va;
+
+   int replaced = srv1_mailbox_post(&l->speed, &cmd);
+   wake_reactor(l->reactor);
+   return replaced;
+}
+
+int
+srv1_link_set_image_mode(srv1_link_t *l, char mode)
+{
+   srv1_cmd_t cmd;
+   memset(&cmd, 0, sizeof(cmd));
+   cmd.type = SRV1_CMD_IMAGE_MODE;
+   cmd.mode = mode;
+   return srv1_link_send(l, &cmd);
+}
+
+int
+srv1_link_poll(srv1_link_t *l, srv1_event_t *evt)
+{
+   return srv1_spsc_pop(&l->events, evt);
+}
+
+void
+srv1_link_release_frame(srv1_link_t *l, srv1_frame_t *frame)
+{
+   srv1_frame_unref(frame);
+   __atomic_sub_fetch(&l->frames_out, 1, __ATOMIC_RELAXED);
+   // The thread may be idle waiting for a free buffer.
+   wake_reactor(l->reactor);
+}
@@ -0,0 +1,226 @@
+/*
+ * surveyor_link.h
+ *
+ * Serial link reactor: one thread owns the connections to any number of
+ * SRV-1s, multiplexes their serial traffic in a single poll() loop, and
+ * exchanges commands and events with the Player thread through lock-free
+ * queues.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_LINK_H_
+#define SURVEYOR_LINK_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <pthread.h>
+
+#include "surveyor_comms.h"
+#include "surveyor_queue.h"
+#include "surveyor_sched.h"
+
+#define SRV1_LINK_QUEUE_LEN 32
+
+/* Most robots one reactor thread serves. */
+#define SRV1_REACTOR_MAX 16
+
+   /** Commands travelling from the Player thread to the link thread. */
+   enum
+   {
+      SRV1_CMD_SPEED, ///< Set the wheel speeds from vx/va (via the speed mailbox)
+      SRV1_CMD_IMAGE_MODE ///< Switch the camera to mode before the next image
+   };
+
+   /** Events travelling from the link thread to the Player thread. */
+   enum
+   {
+      SRV1_EVT_FRAME, ///< A new image is ready in srv1_event_t::frame
+      SRV1_EVT_MOTORS, ///< A speed command completed
+      SRV1_EVT_IR ///< An IR poll completed; the readings are in srv1_event_t::ir
+   };
+
+   /**
+    * @brief Command for the link thread.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int type; ///< SRV1_CMD_*
+         double vx; ///< Requested forward velocity (m/s)
+         double va; ///< Requested angular velocity (rad/s)
+         char mode; ///< Requested image mode (SRV1_CMD_IMAGE_MODE)
+   } srv1_cmd_t;
+
+   /**
+    * @brief Event produced by the link thread.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int type; ///< SRV1_EVT_*
+         int ok; ///< Whether the robot acknowledged the transaction
+         double vx; ///< Achieved forward velocity (SRV1_EVT_MOTORS)
+         double va; ///< Achieved angular velocity (SRV1_EVT_MOTORS)
+         int64_t usec; ///< When the robot acknowledged it (SRV1_EVT_MOTORS; monotonic)
+         int ir[4]; ///< Bounced IR readings: front, left, back, right (SRV1_EVT_IR)
+         srv1_frame_t *frame; ///< The image, with a reference for the receiver (SRV1_EVT_FRAME)
+   } srv1_event_t;
+
+   struct srv1_reactor;
+
+   /**
+    * @brief One robot's end of the reactor: its queues and where its
+    * transactions stand.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         srv1_comm_t *dev; ///< Robot; only the reactor thread touches it while running
+         struct srv1_reactor *reactor; ///< Reactor serving this robot
+
+         srv1_spsc_t cmds; ///< Player thread -> link thread
+         srv1_mailbox_t speed; ///< Newest velocity command (Player thread -> link thread)
+         srv1_spsc_t events; ///< Link thread -> Player thread
+
+         void (*notify)(void *); ///< Called after events are queued
+         void *notify_arg; ///< Argument for notify
+
+         uint32_t seen; ///< frame_seq of the last frame emitted
+         int frames_out; ///< Frames emitted and not yet released (atomic)
+         int64_t retry_at; ///< No new transaction before this (monotonic usec)
+
+         srv1_sched_t image_sched; ///< When the next image may be requested
+         srv1_sched_t ir_sched; ///< When the next IR poll is due
+         int poll_ir; ///< Whether IR is polled at all
+         int64_t ir_cost; ///< Expected length of an IR round trip (usec)
+
+         uint32_t dropped_events; ///< Events lost because the Player thread fell behind
+         uint32_t unchanged_speeds; ///< Velocity commands not sent: the robot already ran at them
+         uint32_t combined_writes; ///< Velocity commands sent in one write with an image request
+   } srv1_link_t;
+
+   /**
+    * @brief The reactor thread and the robots it serves.
+    * @ingroup driver_surveyor
+    */
+   typedef struct srv1_reactor
+   {
+         pthread_t thread; ///< The reactor thread
+         int running; ///< Whether thread was started
+         int stop; ///< Set to ask the thread to exit (atomic)
+         int wake[2]; ///< Pipe that rouses the thread when a command is queued
+
+         srv1_link_t *links[SRV1_REACTOR_MAX]; ///< One per robot
+         int nlinks; ///< Entries used in links
+   } srv1_reactor_t;
+
+   /*
+    * Creates a reactor with no robots; add them with srv1_reactor_add().
+    * \return the reactor, or NULL on failure.
+    */
+   srv1_reactor_t *
+   srv1_reactor_create(void);
+
+   /*
+    * Hands x over to the reactor. Only valid before srv1_reactor_start().
+    *
+    * \param x connected robot; must not be used by the caller until
+    *          srv1_reactor_destroy() returns.
+    * \param notify optional callback run on the reactor thread whenever
+    *          events are queued for this robot, e.g. to wake the consumer.
+    * \return the robot's link, or NULL on failure.
+    */
+   srv1_link_t *
+   srv1_reactor_add(srv1_reactor_t *r, srv1_comm_t *x, void (*notify)(void *),
+         void *notify_arg);
+
+   /*
+    * Sets how often l requests images and polls the IR readings. IR polls
+    * only go out when they will be over before the next image is due, so
+    * they never hold a frame up; an image_period shorter than the link
+    * needs per frame leaves them no room. Only valid before
+    * srv1_reactor_start().
+    * \param image_period usec between image requests, 0 for as fast as
+    *          the link carries them (the default).
+    * \param ir_period usec between IR polls, 0 for none (the default).
+    */
+   void
+   srv1_link_set_polling(srv1_link_t *l, int64_t image_period,
+         int64_t ir_period);
+
+   /*
+    * Starts the reactor thread.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_reactor_start(srv1_reactor_t *r);
+
+   /*
+    * Stops and joins the thread if it is running and frees every link. The
+    * robots belong to the caller again.
+    */
+   void
+   srv1_reactor_destroy(srv1_reactor_t *r);
+
+   /*
+    * Queues a command without blocking.
+    * \return 1 for success, 0 if the queue is full.
+    */
+   int
+   srv1_link_send(srv1_link_t *l, const srv1_cmd_t *cmd);
+
+   /*
+    * Posts a velocity command without blocking. It replaces any earlier
+    * velocity command the link thread has not sent yet, so the robot always
+    * gets the newest one.
+    * \return 1 if an unsent command was replaced, 0 otherwise.
+    */
+   int
+   srv1_link_set_speed(srv1_link_t *l, double vx, double va);
+
+   /*
+    * Asks for images in another mode (SRV1_IMAGE_*) without blocking. An
+    * image already under way still arrives in the old mode; the camera is
+    * switched before the next one is requested.
+    * \return 1 for success, 0 if the command queue is full.
+    */
+   int
+   srv1_link_set_image_mode(srv1_link_t *l, char mode);
+
+   /*
+    * Takes the next event without blocking.
+    * \return 1 if evt was filled in, 0 if there was nothing waiting.
+    */
+   int
+   srv1_link_poll(srv1_link_t *l, srv1_event_t *evt);
+
+   /*
+    * Drops the reference a SRV1_EVT_FRAME event carried, letting the link
+    * thread reuse the buffer. Must be called once for every frame event taken.
+    */
+   void
+   srv1_link_release_frame(srv1_link_t *l, srv1_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_LINK_H_ */
@@ -0,0 +1,376 @@
+/*
+ * surveyor_log.c
+ *
+ * Asynchronous logger: a lock-free ring of binary records drained and
+ * formatted by a background thread.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_log.h"
+#include "surveyor_sched.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_MASK (SRV1_LOG_CAPACITY - 1)
+#define LOG_IDLE_NSEC 10000000L
+#define LOG_LINE_MAX 512
+
+int srv1_log_level = SRV1_LOG_INFO;
+
+/*
+ * Bounded multi-producer single-consumer ring (after Vyukov). Each cell's
+ * seq says whose turn it is: equal to the enqueue position when free for
+ * that producer, one past it once the record is readable.
+ */
+typedef struct
+{
+      uint32_t seq;
+      srv1_log_record_t rec;
+} log_cell_t;
+
+static log_cell_t cells[SRV1_LOG_CAPACITY];
+static uint32_t enqueue_pos;
+static uint32_t dequeue_pos;
+static uint32_t dropped;
+static int cells_ready;
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t log_thread;
+static int log_users;
+static int log_running;
+static int log_stop;
+
+static void
+init_cells(void)
+{
+   uint32_t i;
+   if (__atomic_load_n(&cells_ready, __ATOMIC_ACQUIRE))
+      {
+         return;
+      }
+   for (i = 0; i < SRV1_LOG_CAPACITY; i++)
+      {
+         cells[i].seq = i;
+      }
+   __atomic_store_n(&cells_ready, 1, __ATOMIC_RELEASE);
+}
+
+static int
+push(const srv1_log_record_t *rec)
+{
+   log_cell_t *cell;
+   uint32_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+   for (;;)
+      {
+         int32_t diff;
+         cell = &cells[pos & LOG_MASK];
+         diff = (int32_t) (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE)
+               - pos);
+         if (diff == 0)
+            {
+               if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                  {
+                     break;
+                  }
+            }
+         else if (diff < 0)
+            {
+               return 0;
+            }
+         else
+            {
+               pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+            }
+      }
+   cell->rec = *rec;
+   __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+   return 1;
+}
+
+/* Only the writer thread, or stop once it has been joined, pops. */
+static int
+pop(srv1_log_record_t *rec)
+{
+   log_cell_t *cell = &cells[dequeue_pos & LOG_MASK];
+   if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1)
+      {
+         return 0;
+      }
+   *rec = cell->rec;
+   __atomic_store_n(&cell->seq, dequeue_pos + SRV1_LOG_CAPACITY,
+         __ATOMIC_RELEASE);
+   dequeue_pos++;
+   return 1;
+}
+
+/*
+ * printf with numeric arguments only: each conversion is handed the next
+ * argument cast to what it expects, and length modifiers are dropped since
+ * the cast decides the width.
+ */
+static void
+format_record(const srv1_log_record_t *rec, char *out, size_t len)
+{
+   const char *p = rec->fmt;
+   size_t n;
+   int arg = 0;
+
+   n = snprintf(out, len, "[%lld.%06lld] ", (long long) (rec->usec / 1000000),
+         (long long) (rec->usec % 1000000));
+   while (*p && n + 1 < len)
+      {
+         char spec[32];
+         size_t s = 0;
+         double v;
+         int w = 0;
+
+         if (*p != '%')
+            {
+               out[n++] = *p++;
+               continue;
+            }
+         if (p[1] == '%')
+            {
+               out[n++] = '%';
+               p += 2;
+               continue;
+            }
+         spec[s++] = *p++;
+         while (*p && strchr("-+ #0123456789.", *p) && s < sizeof(spec) - 5)
+            {
+               spec[s++] = *p++;
+            }
+         while (*p && strchr("hlLqjzt", *p))
+            {
+               p++;
+            }
+         if (!*p)
+            {
+               break;
+            }
+         v = arg < rec->nargs ? rec->args[arg] : 0.0;
+         arg++;
+         switch (*p)
+            {
+            case 'd':
+            case 'i':
+               spec[s++] = 'l';
+               spec[s++] = 'l';
+               spec[s++] = *p;
+               spec[s] = '\0';
+               w = snprintf(out + n, len - n, spec, (long long) v);
+               break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+               spec[s++] = 'l';
+               spec[s++] = 'l';
+               spec[s++] = *p;
+               spec[s] = '\0';
+               w = snprintf(out + n, len - n, spec,
+                     (unsigned long long) (long long) v);
+               break;
+            case 'c':
+               spec[s++] = 'c';
+               spec[s] = '\0';
+               w = snprintf(out + n, len - n, spec, (int) v);
+               break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+               spec[s++] = *p;
+               spec[s] = '\0';
+               w = snprintf(out + n, len - n, spec, v);
+               break;
+            default:
+               w = snprintf(out + n, len - n, "?");
+               break;
+            }
+         p++;
+         if (w > 0)
+            {
+               n += w;
+            }
+      }
+   if (n >= len)
+      {
+         n = len - 1;
+      }
+   out[n] = '\0';
+}
+
+static void
+write_record(const srv1_log_record_t *rec)
+{
+   char line[LOG_LINE_MAX];
+   format_record(rec, line, sizeof(line));
+   fputs(line, stdout);
+}
+
+static void
+drain(void)
+{
+   static uint32_t reported;
+   srv1_log_record_t rec;
+   uint32_t lost;
+   int any = 0;
+
+   while (pop(&rec))
+      {
+         write_record(&rec);
+         any = 1;
+      }
+   lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+   if (lost != reported)
+      {
+         printf("srv1_log: %u records dropped (ring full)\n", lost - reported);
+         reported = lost;
+         any = 1;
+      }
+   if (any)
+      {
+         fflush(stdout);
+      }
+}
+
+static void *
+log_main(void *arg)
+{
+   struct timespec idle;
+   (void) arg;
+   idle.tv_sec = 0;
+   idle.tv_nsec = LOG_IDLE_NSEC;
+   while (!__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+      {
+         drain();
+         nanosleep(&idle, NULL);
+      }
+   drain();
+   return NULL;
+}
+
+void
+srv1_log_emit(int level, const char *fmt, int nargs, double a, double b,
+      double c, double d)
+{
+   srv1_log_record_t rec;
+
+   rec.usec = srv1_sched_now();
+   rec.fmt = fmt;
+   rec.level = (uint16_t) level;
+   rec.nargs = (uint16_t) nargs;
+   rec.args[0] = a;
+   rec.args[1] = b;
+   rec.args[2] = c;
+   rec.args[3] = d;
+
+   if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+      {
+         write_record(&rec);
+         return;
+      }
+   if (!push(&rec))
+      {
+         __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      }
+}
+
+int
+srv1_log_start(void)
+{
+   int ok = 1;
+   pthread_mutex_lock(&log_lock);
+   if (log_users++ == 0)
+      {
+         init_cells();
+         __atomic_store_n(&log_stop, 0, __ATOMIC_RELEASE);
+         if (pthread_create(&log_thread, NULL, log_main, NULL) != 0)
+            {
+               log_users = 0;
+               ok = 0;
+            }
+         else
+            {
+               __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+            }
+      }
+   pthread_mutex_unlock(&log_lock);
+   return ok;
+}
+
+void
+srv1_log_stop(void)
+{
+   pthread_mutex_lock(&log_lock);
+   if (log_users > 0 && --log_users == 0)
+      {
+         // Records pushed by producers that saw log_running just before it
+         // dropped are picked up by the final drains; one still being
+         // written at that instant may be lost.
+         __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+         __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+         pthread_join(log_thread, NULL);
+         drain();
+      }
+   pthread_mutex_unlock(&log_lock);
+}
+
+void
+srv1_log_set_level(int level)
+{
+   if (level < SRV1_LOG_ERROR)
+      {
+         level = SRV1_LOG_ERROR;
+      }
+   if (level > SRV1_LOG_TRACE)
+      {
+         level = SRV1_LOG_TRACE;
+      }
+   __atomic_store_n(&srv1_log_level, level, __ATOMIC_RELAXED);
+}
+
+int
+srv1_log_level_from_name(const char *name)
+{
+   static const char *names[] =
+      { "error", "warn", "info", "debug", "trace" };
+   int i;
+   for (i = 0; i <= SRV1_LOG_TRACE; i++)
+      {
+         if (strcmp(name, names[i]) == 0)
+            {
+               return i;
+            }
+      }
+   return -1;
+}
+
+uint32_t
+srv1_log_dropped(void)
+{
+   return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,142 @@
+/*
+ * surveyor_log.h
+ *
+ * Levelled logging that never blocks the caller: call sites store compact
+ * binary records in a lock-free ring and a background thread formats and
+ * writes them.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_LOG_H_
+#define SURVEYOR_LOG_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#define SRV1_LOG_ERROR 0
+#define SRV1_LOG_WARN 1
+#define SRV1_LOG_INFO 2
+#define SRV1_LOG_DEBUG 3
+#define SRV1_LOG_TRACE 4
+
+/* Call sites above this level are compiled out entirely. */
+#ifndef SRV1_LOG_COMPILE_LEVEL
+#define SRV1_LOG_COMPILE_LEVEL SRV1_LOG_TRACE
+#endif
+
+/* Records the ring holds before new ones are dropped; a power of two. */
+#define SRV1_LOG_CAPACITY 1024
+
+/* Most arguments one record carries. */
+#define SRV1_LOG_MAX_ARGS 4
+
+   /** Level at or below which records are kept (runtime). */
+   extern int srv1_log_level;
+
+#define SRV1_LOG_ENABLED(level) \
+   ((level) <= SRV1_LOG_COMPILE_LEVEL \
+         && (level) <= __atomic_load_n(&srv1_log_level, __ATOMIC_RELAXED))
+
+/*
+ * Logging macros, one per argument count like Player's PLAYER_MSGn. fmt must
+ * be a string literal (only its address is stored) and the arguments must be
+ * numbers; %s is not supported. Nothing, arguments included, is evaluated
+ * unless the level is enabled.
+ */
+#define SRV1_LOG0(level, fmt) \
+   do { if (SRV1_LOG_ENABLED(level)) \
+      srv1_log_emit((level), (fmt), 0, 0.0, 0.0, 0.0, 0.0); } while (0)
+#define SRV1_LOG1(level, fmt, a) \
+   do { if (SRV1_LOG_ENABLED(level)) \
+      srv1_log_emit((level), (fmt), 1, (double) (a), 0.0, 0.0, 0.0); } while (0)
+#define SRV1_LOG2(level, fmt, a, b) \
+   do { if (SRV1_LOG_ENABLED(level)) \
+      srv1_log_emit((level), (fmt), 2, (double) (a), (double) (b), 0.0, \
+            0.0); } while (0)
+#define SRV1_LOG3(level, fmt, a, b, c) \
+   do { if (SRV1_LOG_ENABLED(level)) \
+      srv1_log_emit((level), (fmt), 3, (double) (a), (double) (b), \
+            (double) (c), 0.0); } while (0)
+#define SRV1_LOG4(level, fmt, a, b, c, d) \
+   do { if (SRV1_LOG_ENABLED(level)) \
+      srv1_log_emit((level), (fmt), 4, (double) (a), (double) (b), \
+            (double) (c), (double) (d)); } while (0)
+
+   /**
+    * @brief One log record as it sits in the ring.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int64_t usec; ///< When it was logged (monotonic)
+         const char *fmt; ///< printf format; a string literal
+         uint16_t level; ///< SRV1_LOG_*
+         uint16_t nargs; ///< Entries used in args
+         double args[SRV1_LOG_MAX_ARGS]; ///< Numeric arguments
+   } srv1_log_record_t;
+
+   /*
+    * Queues a record; use the SRV1_LOGn macros instead. Never blocks: if the
+    * ring is full the record is dropped and counted. Without a running
+    * writer thread the record is printed straight away.
+    */
+   void
+   srv1_log_emit(int level, const char *fmt, int nargs, double a, double b,
+         double c, double d);
+
+   /*
+    * Starts the writer thread, or counts one more user if it runs already.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_log_start(void);
+
+   /*
+    * Drops a user; the last one writes out what is left and stops the thread.
+    */
+   void
+   srv1_log_stop(void);
+
+   /*
+    * Sets the runtime level.
+    */
+   void
+   srv1_log_set_level(int level);
+
+   /*
+    * Parses "error", "warn", "info", "debug" or "trace".
+    * \return the level, or -1 if the name is unknown.
+    */
+   int
+   srv1_log_level_from_name(const char *name);
+
+   /*
+    * \return records dropped because the ring was full.
+    */
+   uint32_t
+   srv1_log_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_LOG_H_ */
@@ -0,0 +1,377 @@
+/*
+ * surveyor_lut.c
+ *
+ * Precomputed tables that map velocity commands to SRV-1 wheel speeds.
+ *
+ * calc_speed_hackish() and calc_rot_hackish() in surveyor_comms.c search for
+ * wheel speeds by walking one motor value at a time and evaluating the
+ * forward-speed polynomial at every step. The walks only ever visit a fixed
+ * sequence of wheel pairs for a given starting speed and turn direction, so
+ * here those sequences are laid out once, with the running maximum of the
+ * angular velocity along each one. A lookup is then "first entry above the
+ * request", found through a coarse bucket index plus a step or two of
+ * correction, and gives exactly the pair the original walk stops at.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_lut.h"
+#include "surveyor_comms.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Motor values below this don't overcome friction (see srv1_forward_model). */
+#define MOTOR_DEADBAND 20
+#define MOTOR_MAX 127
+
+/* Wheel base used by calc_angular(). */
+#define ANGULAR_BASIS 0.234
+
+#define SPEED_BUCKETS 256
+#define ROT_BUCKETS 128
+/* Comfortably above the largest reachable angular velocity (~2.7 rad/s). */
+#define ROT_RANGE 3.0
+
+/*
+ * The wheel pairs one walk of calc_rot_hackish() goes through, for a single
+ * starting speed and turn direction.
+ */
+typedef struct
+{
+   double *max; ///< Running maximum of the (signed) angular velocity per step
+   int len; ///< Number of steps that stay inside the motor limits
+   unsigned char bucket[ROT_BUCKETS]; ///< First step whose maximum exceeds the bucket floor
+} rot_path_t;
+
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+static double forward[256]; ///< srv1_forward_model(), indexed by speed + 128
+static double speed_max[MOTOR_MAX + 1]; ///< Running max of forward[] from the deadband up
+static unsigned char speed_bucket[SPEED_BUCKETS];
+
+static rot_path_t rot_paths[256][2]; ///< [start speed + 128][turning left?]
+static double *rot_storage;
+
+static float ir_range[SRV1_IR_LUT_SIZE]; ///< srv1_range_to_distance() in m, floored at 0
+
+double
+srv1_forward_model(signed char speed)
+{
+   unsigned char speedg = (speed > 0 ? speed : -speed);
+   if (speedg < MOTOR_DEADBAND)
+      {
+         return 0;
+      }
+   double i3 = 5.5277e-7;
+   double j3 = -0.00016261;
+   double k3 = 0.01628;
+   double l3 = -0.26129;
+   // third order is ultra-small... probably second-order.
+   double x = k3 * speedg;
+   double y = j3 * speedg * speedg;
+   double z = i3 * speedg * speedg * speedg;
+   double result = l3 + x + y + z;
+   return (speed > 0 ? result : -result);
+}
+
+/*
+ * Wheel pair after k steps of calc_rot_hackish() starting from (s, s).
+ * When starting from rest the walk first jumps both wheels to the deadband.
+ */
+static void
+path_state(int s, int up, int k, int *l, int *r)
+{
+   if (s == 0)
+      {
+         *l = (up ? -(MOTOR_DEADBAND + k) : MOTOR_DEADBAND + k);
+         *r = -*l;
+      }
+   else if (s > 0)
+      {
+         *l = (up ? s : s + k);
+         *r = (up ? s + k : s);
+      }
+   else
+      {
+         *l = (up ? s - k : s);
+         *r = (up ? s : s - k);
+      }
+}
+
+/*
+ * The loop conditions of the three branches of calc_rot_hackish().
+ */
+static int
+path_valid(int s, int l, int r)
+{
+   if (s == 0)
+      {
+         return (l > -MOTOR_MAX) && (l < MOTOR_MAX) && (r > -MOTOR_MAX)
+               && (r < MOTOR_MAX);
+      }
+   if (s > 0)
+      {
+         return (l < MOTOR_MAX) && (r < MOTOR_MAX);
+      }
+   return (l > -MOTOR_MAX) && (r > -MOTOR_MAX);
+}
+
+/*
+ * Index of the first entry of the non-decreasing array max[0..len) that is
+ * greater than v, or len if there is none. hint may be off in either
+ * direction; the loops correct it.
+ */
+static int
+first_above(const double *max, int len, int hint, double v)
+{
+   int i = (hint < len ? hint : len);
+   while (i < len && max[i] <= v)
+      {
+         i++;
+      }
+   while (i > 0 && max[i - 1] > v)
+      {
+         i--;
+      }
+   return i;
+}
+
+static void
+build_tables(void)
+{
+   // The fit falls monotonically and crosses 0 around reading 130.
+   for (int i = 0; i < SRV1_IR_LUT_SIZE; i++)
+      {
+         double cm = srv1_range_to_distance(i);
+         ir_range[i] = (float) (cm > 0.0 ? cm / 100.0 : 0.0);
+      }
+
+   for (int s = -128; s < 128; s++)
+      {
+         forward[s + 128] = srv1_forward_model((signed char) s);
+      }
+
+   // calc_speed_hackish() returns one below the first speed whose forward
+   // velocity exceeds the request, starting from just above the deadband.
+   double running = -HUGE_VAL;
+   for (int c = 0; c <= MOTOR_MAX; c++)
+      {
+         if (c > MOTOR_DEADBAND && forward[c + 128] > running)
+            {
+               running = forward[c + 128];
+            }
+         speed_max[c] = running;
+      }
+   for (int b = 0; b < SPEED_BUCKETS; b++)
+      {
+         double floor_v = b * (SRV1_MAX_VEL_X / SPEED_BUCKETS);
+         speed_bucket[b] = first_above(speed_max, MOTOR_MAX + 1,
+               MOTOR_DEADBAND + 1, floor_v);
+      }
+
+   // Every walk is shorter than 2 * MOTOR_MAX steps.
+   rot_storage = (double *) malloc(sizeof(double) * 256 * 2 * 2 * MOTOR_MAX);
+   double *next = rot_storage;
+
+   for (int s = -128; s < 128; s++)
+      {
+         for (int up = 0; up < 2; up++)
+            {
+               rot_path_t *p = &rot_paths[s + 128][up];
+               int l, r;
+
+               p->max = next;
+               p->len = 0;
+               running = -HUGE_VAL;
+
+               path_state(s, up, 0, &l, &r);
+               if (rot_storage != NULL && path_valid(s, l, r))
+                  {
+                     for (int k = 1;; k++)
+                        {
+                           path_state(s, up, k, &l, &r);
+                           if (!path_valid(s, l, r))
+                              {
+                                 break;
+                              }
+                           double a = srv1_lut_angular(l, r);
+                           double m = (up ? a : -a);
+                           if (m > running)
+                              {
+                                 running = m;
+                              }
+                           p->max[p->len++] = running;
+                        }
+                  }
+               next += p->len;
+
+               for (int b = 0; b < ROT_BUCKETS; b++)
+                  {
+                     p->bucket[b] = first_above(p->max, p->len, 0,
+                           b * (ROT_RANGE / ROT_BUCKETS));
+                  }
+            }
+      }
+}
+
+void
+srv1_lut_init(void)
+{
+   pthread_once(&lut_once, build_tables);
+}
+
+double
+srv1_lut_forward(signed char speed)
+{
+   return forward[speed + 128];
+}
+
+double
+srv1_lut_angular(int left, int right)
+{
+   return (forward[(signed char) right + 128] - forward[(signed char) left
+         + 128]) / ANGULAR_BASIS;
+}
+
+signed char
+srv1_lut_speed(double dx)
+{
+   double v = fabs(dx);
+   // NaN would pass both tests below and index nowhere; stop instead.
+   if (!isfinite(dx))
+      {
+         return 0;
+      }
+   if (v > SRV1_MAX_VEL_X)
+      {
+         return (dx > 0.0 ? MOTOR_MAX : -MOTOR_MAX);
+      }
+   if (v < 0.05)
+      {
+         return 0;
+      }
+
+   int b = (int) (v * (SPEED_BUCKETS / SRV1_MAX_VEL_X));
+   if (b >= SPEED_BUCKETS)
+      {
+         b = SPEED_BUCKETS - 1;
+      }
+   int c = first_above(speed_max, MOTOR_MAX + 1, speed_bucket[b], v);
+   if (c < MOTOR_DEADBAND + 1)
+      {
+         c = MOTOR_DEADBAND + 1;
+      }
+
+   return (dx < 0.0 ? -(c - 1) : c - 1);
+}
+
+int
+srv1_lut_rot(double dw, signed char speed, signed char *left,
+      signed char *right)
+{
+   *left = speed;
+   *right = speed;
+
+   if (fabs(dw) < 0.05)
+      {
+         return 0;
+      }
+   // Nothing sensible to aim for; keep going straight and say so.
+   if (!isfinite(dw))
+      {
+         return 1;
+      }
+
+   int up = (dw > 0.0);
+   double v = (up ? dw : -dw);
+   const rot_path_t *p = &rot_paths[speed + 128][up];
+   int l = speed;
+   int r = speed;
+
+   path_state(speed, up, 0, &l, &r);
+   if (path_valid(speed, l, r))
+      {
+         // Past ROT_RANGE every walk ends at the motor limit anyway; clamp
+         // before converting, or a huge dw overflows the index.
+         int b = (v < ROT_RANGE ? (int) (v * (ROT_BUCKETS / ROT_RANGE))
+               : ROT_BUCKETS - 1);
+         if (b >= ROT_BUCKETS)
+            {
+               b = ROT_BUCKETS - 1;
+            }
+         // The walk stops on the first step that overshoots the request, or
+         // on the first step outside the motor limits if none does.
+         int i = first_above(p->max, p->len, p->bucket[b], v);
+         path_state(speed, up, i + 1, &l, &r);
+      }
+
+   *left = l;
+   *right = r;
+
+   return ((r == MOTOR_MAX) || (r == -MOTOR_MAX) || (l == MOTOR_MAX) || (l
+         == -MOTOR_MAX)) && (fabs(dw - srv1_lut_angular(l, r)) > 0.01);
+}
+
+void
+srv1_ir_cal_identity(srv1_ir_cal_t *cal)
+{
+   for (int b = 0; b < SRV1_IR_BEAMS; b++)
+      {
+         cal->scale[b] = 1.0f;
+         cal->offset[b] = 0.0f;
+      }
+}
+
+void
+srv1_lut_ir_ranges(const int *readings, float *ranges, size_t count,
+      const srv1_ir_cal_t *cal)
+{
+   size_t n = count * SRV1_IR_BEAMS;
+
+   // Table lookups; a gather either way.
+   for (size_t i = 0; i < n; i++)
+      {
+         int r = readings[i];
+         if ((unsigned) r >= SRV1_IR_LUT_SIZE)
+            {
+               r = (r < 0 ? 0 : SRV1_IR_LUT_SIZE - 1);
+            }
+         ranges[i] = ir_range[r];
+      }
+   if (cal == NULL)
+      {
+         return;
+      }
+
+   // One sample is one vector: the calibration lines up with it beam for
+   // beam, and the loop vectorises.
+   const float *scale = cal->scale;
+   const float *offset = cal->offset;
+   for (size_t i = 0; i < n; i += SRV1_IR_BEAMS)
+      {
+         float *out = ranges + i;
+         for (int b = 0; b < SRV1_IR_BEAMS; b++)
+            {
+               float v = out[b] * scale[b] + offset[b];
+               out[b] = (v > 0.0f ? v : 0.0f);
+            }
+      }
+}
@@ -0,0 +1,122 @@
+/*
+ * surveyor_lut.h
+ *
+ * Precomputed tables that map velocity commands to SRV-1 wheel speeds.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_LUT_H_
+#define SURVEYOR_LUT_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+/* Entries in the IR range table: one per bounced IR reading. Readings above
+ * the last entry are read as the last one. */
+#define SRV1_IR_LUT_SIZE 256
+
+/* IR beams per robot, in bouncedir[] order: front, left, back, right. */
+#define SRV1_IR_BEAMS 4
+
+   /**
+    * @brief Per-robot correction of the IR range model, per beam:
+    * range = scale * model + offset, and never below 0.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         float scale[SRV1_IR_BEAMS]; ///< Multiplies the modelled range
+         float offset[SRV1_IR_BEAMS]; ///< Then added (m)
+   } srv1_ir_cal_t;
+
+   /*
+    * Forward speed (m/s) of a wheel driven at the given motor value.
+    * This is the fitted polynomial every other table is built from.
+    */
+   double
+   srv1_forward_model(signed char speed);
+
+   /*
+    * Builds the tables. Cheap to call again; only the first call does work.
+    */
+   void
+   srv1_lut_init(void);
+
+   /*
+    * Table version of calc_forward().
+    */
+   double
+   srv1_lut_forward(signed char speed);
+
+   /*
+    * Table version of calc_angular().
+    */
+   double
+   srv1_lut_angular(int left, int right);
+
+   /*
+    * Same result as calc_speed_hackish(), in constant time and without
+    * printing. A dx that is NaN or infinite stops the wheels.
+    * \param dx forward velocity in m/s
+    * \return motor value for both wheels.
+    */
+   signed char
+   srv1_lut_speed(double dx);
+
+   /*
+    * Same result as calc_rot_hackish() with both wheels starting at speed,
+    * in constant time and without printing. (Where the original search
+    * would spin forever on an exact tie, this settles on the next step.)
+    * A dw that is NaN or infinite leaves both wheels at speed and counts
+    * as not reached.
+    * \param dw angular velocity in rad/s
+    * \param speed wheel speed from srv1_lut_speed()
+    * \param left,right set to the adjusted wheel speeds
+    * \return 1 if the wheels saturated before reaching dw, 0 otherwise.
+    */
+   int
+   srv1_lut_rot(double dw, signed char speed, signed char *left,
+         signed char *right);
+
+   /*
+    * Sets cal to no correction: scale 1, offset 0.
+    */
+   void
+   srv1_ir_cal_identity(srv1_ir_cal_t *cal);
+
+   /*
+    * Table version of srv1_range_to_distance(), in meters and never below
+    * 0, for many readings at once: count samples of SRV1_IR_BEAMS readings
+    * each (bouncedir[] one after the other), calibrated with cal.
+    * \param readings count * SRV1_IR_BEAMS readings
+    * \param ranges where the count * SRV1_IR_BEAMS ranges go (m)
+    * \param cal correction, or NULL for none
+    */
+   void
+   srv1_lut_ir_ranges(const int *readings, float *ranges, size_t count,
+         const srv1_ir_cal_t *cal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_LUT_H_ */
@@ -0,0 +1,87 @@
+/*
+ * surveyor_odom.c
+ *
+ * Dead reckoning: integrates the velocities the robot acknowledged into a
+ * pose.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_odom.h"
+
+#include <math.h>
+
+/* Below this turn rate (rad/s) the arc is taken as a straight line. */
+#define ODOM_STRAIGHT 1e-6
+
+static double
+wrap_angle(double a)
+{
+   return atan2(sin(a), cos(a));
+}
+
+void
+srv1_odom_init(srv1_odom_t *o, double x, double y, double yaw, int64_t now)
+{
+   o->x = x;
+   o->y = y;
+   o->yaw = wrap_angle(yaw);
+   o->since = now;
+   o->vx = 0.0;
+   o->va = 0.0;
+}
+
+void
+srv1_odom_set_velocity(srv1_odom_t *o, double vx, double va, int64_t at)
+{
+   if (at < o->since)
+      {
+         at = o->since;
+      }
+   srv1_odom_pose(o, at, &o->x, &o->y, &o->yaw);
+   o->since = at;
+   o->vx = vx;
+   o->va = va;
+}
+
+void
+srv1_odom_pose(const srv1_odom_t *o, int64_t at, double *x, double *y,
+      double *yaw)
+{
+   double dt = (at > o->since ? (at - o->since) / 1e6 : 0.0);
+   double turn = o->va * dt;
+   double px = o->x;
+   double py = o->y;
+
+   // Constant velocities trace a circle exactly; no step size to choose.
+   if (fabs(o->va) < ODOM_STRAIGHT)
+      {
+         px += o->vx * dt * cos(o->yaw);
+         py += o->vx * dt * sin(o->yaw);
+      }
+   else
+      {
+         double r = o->vx / o->va;
+         px += r * (sin(o->yaw + turn) - sin(o->yaw));
+         py -= r * (cos(o->yaw + turn) - cos(o->yaw));
+      }
+
+   *x = px;
+   *y = py;
+   *yaw = wrap_angle(o->yaw + turn);
+}
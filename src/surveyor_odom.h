@@ -0,0 +1,76 @@
+/*
+ * surveyor_odom.h
+ *
+ * Dead reckoning: integrates the velocities the robot acknowledged into a
+ * pose.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_ODOM_H_
+#define SURVEYOR_ODOM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+   /**
+    * @brief A robot's pose, kept as the pose at the last change of velocity
+    * and the velocity since. The SRV-1 has no wheel encoders, so this is as
+    * good as the velocity model in surveyor_lut.c.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         double x; ///< Position when velocity last changed (m)
+         double y; ///< Position when velocity last changed (m)
+         double yaw; ///< Heading when velocity last changed (rad, -pi to pi)
+         int64_t since; ///< When velocity last changed (monotonic usec)
+         double vx; ///< Forward velocity since (m/s)
+         double va; ///< Angular velocity since (rad/s)
+   } srv1_odom_t;
+
+   /*
+    * Sets the pose, standing still, at monotonic time now.
+    */
+   void
+   srv1_odom_init(srv1_odom_t *o, double x, double y, double yaw,
+         int64_t now);
+
+   /*
+    * Moves the pose on to time at (earlier times count as the last change)
+    * and carries on at the new velocity from there.
+    */
+   void
+   srv1_odom_set_velocity(srv1_odom_t *o, double vx, double va, int64_t at);
+
+   /*
+    * Pose at time at, following the arc the current velocity describes.
+    * Doesn't change o, so it may be asked for as often as is useful.
+    */
+   void
+   srv1_odom_pose(const srv1_odom_t *o, int64_t at, double *x, double *y,
+         double *yaw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_ODOM_H_ */
@@ -0,0 +1,380 @@
+/*
+ * surveyor_parser.c
+ *
+ * Incremental parser for the replies a SRV-1 sends back over the serial link.
+ *
+ * Replies all start with '#'. Anything that doesn't lead to a reply we know
+ * is skipped one byte at a time until the next '#', so a corrupt or
+ * unexpected reply costs only its own bytes and never the start of the
+ * next good one.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+   P_SYNC, ///< Looking for '#'
+   P_HASH, ///< Have "#"
+   P_TAG, ///< Have "##" and part of a tag
+   P_IMJ, ///< Have "##IMJ", reading mode and length
+   P_IR, ///< Have "##BounceIR - ", reading the readings
+   P_LINE, ///< Have "##Version", reading to the end of the line
+   P_PAYLOAD ///< Reading image data
+};
+
+static const char *const tags[] =
+   { "IMJ", "BounceIR - ", "Version" };
+static const int tag_states[] =
+   { P_IMJ, P_IR, P_LINE };
+#define NTAGS (sizeof(tags) / sizeof(tags[0]))
+
+/* "##IMJ" + mode + 4 length bytes. */
+#define IMJ_HDR_LEN 10
+
+void
+srv1_parser_reset(srv1_parser_t *p)
+{
+   p->state = P_SYNC;
+   p->hdr_len = 0;
+   p->replay_len = 0;
+   p->replay_pos = 0;
+   p->payload_size = 0;
+   p->payload_got = 0;
+   p->sink = NULL;
+   p->sink_cap = 0;
+   p->draining = 0;
+}
+
+static void
+begin(srv1_reply_t *reply, int type)
+{
+   memset(reply, 0, sizeof(*reply));
+   reply->type = type;
+}
+
+/*
+ * False start: the '#' we locked onto wasn't the beginning of a reply.
+ * Skip it and look at the rest of what we buffered again, since the real
+ * reply may start inside it.
+ */
+static void
+resync(srv1_parser_t *p)
+{
+   unsigned char tmp[sizeof(p->replay)];
+   int n = 0;
+
+   for (int i = 1; i < p->hdr_len; i++)
+      {
+         tmp[n++] = p->hdr[i];
+      }
+   for (int i = p->replay_pos; i < p->replay_len; i++)
+      {
+         tmp[n++] = p->replay[i];
+      }
+
+   memcpy(p->replay, tmp, n);
+   p->replay_len = n;
+   p->replay_pos = 0;
+
+   p->skipped++;
+   p->resyncs++;
+   p->state = P_SYNC;
+   p->hdr_len = 0;
+}
+
+/*
+ * Advances the state machine by one byte (never in P_PAYLOAD).
+ * \return 1 if a reply completed.
+ */
+static int
+step(srv1_parser_t *p, unsigned char c, srv1_reply_t *reply)
+{
+   if (p->state == P_SYNC)
+      {
+         if (c == '#')
+            {
+               p->hdr[0] = c;
+               p->hdr_len = 1;
+               p->state = P_HASH;
+            }
+         else
+            {
+               p->skipped++;
+            }
+         return 0;
+      }
+
+   p->hdr[p->hdr_len++] = c;
+
+   switch (p->state)
+      {
+   case P_HASH:
+      if (c == 'M')
+         {
+            begin(reply, SRV1_REPLY_MOTORS);
+            p->state = P_SYNC;
+            return 1;
+         }
+      if (c == 'a' || c == 'b' || c == 'c')
+         {
+            begin(reply, SRV1_REPLY_MODE);
+            reply->mode = c;
+            p->state = P_SYNC;
+            return 1;
+         }
+      if (c == '#')
+         {
+            p->state = P_TAG;
+            return 0;
+         }
+      resync(p);
+      return 0;
+
+   case P_TAG:
+      {
+         int taglen = p->hdr_len - 2;
+         int prefix = 0;
+         for (unsigned int i = 0; i < NTAGS; i++)
+            {
+               if (strncmp((const char *) p->hdr + 2, tags[i], taglen) != 0)
+                  {
+                     continue;
+                  }
+               if (tags[i][taglen] == '\0')
+                  {
+                     p->state = tag_states[i];
+                     return 0;
+                  }
+               prefix = 1;
+            }
+         if (!prefix)
+            {
+               resync(p);
+            }
+         return 0;
+      }
+
+   case P_IMJ:
+      if (p->hdr_len < IMJ_HDR_LEN)
+         {
+            return 0;
+         }
+      p->mode = p->hdr[5];
+      p->payload_size = p->hdr[6] + (p->hdr[7] << 8) + (p->hdr[8] << 16)
+            + ((uint32_t) p->hdr[9] << 24);
+      if (p->payload_size == 0 || p->payload_size > SRV1_MAX_FRAME)
+         {
+            resync(p);
+            return 0;
+         }
+      p->payload_got = 0;
+      p->sink = NULL;
+      p->sink_cap = 0;
+      p->state = P_PAYLOAD;
+
+      begin(reply, SRV1_REPLY_IMAGE_START);
+      reply->mode = p->mode;
+      reply->size = p->payload_size;
+      return 1;
+
+   case P_IR:
+      if (p->hdr_len < SRV1_IR_REPLY_LEN)
+         {
+            return 0;
+         }
+      begin(reply, SRV1_REPLY_IR);
+      p->hdr[p->hdr_len] = '\0';
+      sscanf((const char *) p->hdr + 13, "%x", &reply->bouncedir[0]);
+      sscanf((const char *) p->hdr + 21, "%x", &reply->bouncedir[1]);
+      sscanf((const char *) p->hdr + 29, "%x", &reply->bouncedir[2]);
+      sscanf((const char *) p->hdr + 37, "%x", &reply->bouncedir[3]);
+      p->state = P_SYNC;
+      return 1;
+
+   case P_LINE:
+      if (c == '\n')
+         {
+            begin(reply, SRV1_REPLY_VERSION);
+            p->hdr[p->hdr_len] = '\0';
+            reply->text = (const char *) p->hdr;
+            p->state = P_SYNC;
+            return 1;
+         }
+      if (p->hdr_len == SRV1_PARSER_HDR_MAX)
+         {
+            resync(p);
+         }
+      return 0;
+      }
+
+   return 0;
+}
+
+/*
+ * Takes up to n payload bytes from data.
+ * \return 1 if the image is complete.
+ */
+static int
+payload(srv1_parser_t *p, const unsigned char *data, uint32_t n,
+      srv1_reply_t *reply)
+{
+   if (p->sink != NULL && p->payload_got < p->sink_cap)
+      {
+         uint32_t room = p->sink_cap - p->payload_got;
+         memcpy(p->sink + p->payload_got, data, (n < room ? n : room));
+      }
+   return srv1_parser_payload_commit(p, n, reply);
+}
+
+size_t
+srv1_parser_feed(srv1_parser_t *p, const unsigned char *data, size_t len,
+      srv1_reply_t *reply)
+{
+   size_t used = 0;
+
+   reply->type = SRV1_REPLY_NONE;
+
+   for (;;)
+      {
+         // Bytes from a false start come first; they arrived before data did.
+         int from_replay = (p->replay_pos < p->replay_len);
+         const unsigned char *src;
+         size_t avail;
+         int done;
+
+         if (from_replay)
+            {
+               src = p->replay + p->replay_pos;
+               avail = p->replay_len - p->replay_pos;
+            }
+         else if (used < len)
+            {
+               src = data + used;
+               avail = len - used;
+            }
+         else
+            {
+               break;
+            }
+
+         if (p->state == P_PAYLOAD)
+            {
+               uint32_t left = p->payload_size - p->payload_got;
+               uint32_t n = (avail < left ? avail : left);
+               done = payload(p, src, n, reply);
+               if (from_replay)
+                  {
+                     p->replay_pos += n;
+                  }
+               else
+                  {
+                     used += n;
+                  }
+            }
+         else
+            {
+               // Advance first: step() may rebuild the replay buffer.
+               unsigned char c = *src;
+               if (from_replay)
+                  {
+                     p->replay_pos++;
+                  }
+               else
+                  {
+                     used++;
+                  }
+               done = step(p, c, reply);
+            }
+
+         if (p->replay_pos >= p->replay_len)
+            {
+               p->replay_len = 0;
+               p->replay_pos = 0;
+            }
+
+         if (done)
+            {
+               break;
+            }
+      }
+
+   return used;
+}
+
+uint32_t
+srv1_parser_drain(srv1_parser_t *p)
+{
+   if (p->state != P_PAYLOAD)
+      {
+         return 0;
+      }
+   p->sink = NULL;
+   p->sink_cap = 0;
+   p->draining = 1;
+   return p->payload_size - p->payload_got;
+}
+
+void
+srv1_parser_set_sink(srv1_parser_t *p, char *buf, uint32_t cap)
+{
+   p->sink = buf;
+   p->sink_cap = cap;
+}
+
+uint32_t
+srv1_parser_payload_room(srv1_parser_t *p, char **dst)
+{
+   if (p->state != P_PAYLOAD || p->sink == NULL || p->replay_pos
+         < p->replay_len || p->payload_got >= p->sink_cap)
+      {
+         return 0;
+      }
+
+   uint32_t left = p->payload_size - p->payload_got;
+   uint32_t room = p->sink_cap - p->payload_got;
+   *dst = p->sink + p->payload_got;
+   return (left < room ? left : room);
+}
+
+int
+srv1_parser_payload_commit(srv1_parser_t *p, uint32_t n, srv1_reply_t *reply)
+{
+   p->payload_got += n;
+   if (p->payload_got < p->payload_size)
+      {
+         return 0;
+      }
+
+   begin(reply, SRV1_REPLY_IMAGE);
+   reply->mode = p->mode;
+   reply->size = p->payload_size;
+   reply->stored = (p->sink == NULL ? 0 : (p->payload_size < p->sink_cap
+         ? p->payload_size : p->sink_cap));
+
+   p->state = P_SYNC;
+   p->hdr_len = 0;
+   p->sink = NULL;
+   p->sink_cap = 0;
+   p->draining = 0;
+   return 1;
+}
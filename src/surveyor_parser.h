@@ -0,0 +1,151 @@
+/*
+ * surveyor_parser.h
+ *
+ * Incremental parser for the replies a SRV-1 sends back over the serial link.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_PARSER_H_
+#define SURVEYOR_PARSER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest header or text reply we buffer ("##Version - ..." lines). */
+#define SRV1_PARSER_HDR_MAX 96
+
+/* Largest JPEG we believe; bigger lengths mean we locked onto garbage. */
+#define SRV1_MAX_FRAME (1 << 20)
+
+/* Length of a "##BounceIR - " reply: 13 for header + 32 for chars + '\n'. */
+#define SRV1_IR_REPLY_LEN 46
+
+   /** Kinds of reply the parser recognizes. */
+   enum
+   {
+      SRV1_REPLY_NONE, ///< Nothing complete yet
+      SRV1_REPLY_MOTORS, ///< "#M"
+      SRV1_REPLY_MODE, ///< "#a", "#b" or "#c"
+      SRV1_REPLY_IMAGE_START, ///< "##IMJ<mode><len32>"; payload follows
+      SRV1_REPLY_IMAGE, ///< Payload of an image is complete
+      SRV1_REPLY_IR, ///< "##BounceIR - ..."
+      SRV1_REPLY_VERSION ///< "##Version - ...\n"
+   };
+
+   /**
+    * @brief One reply from the robot.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int type; ///< SRV1_REPLY_*
+         unsigned char mode; ///< Image mode (MODE, IMAGE_START, IMAGE)
+         uint32_t size; ///< Payload length (IMAGE_START, IMAGE)
+         uint32_t stored; ///< Payload bytes that went into the sink (IMAGE)
+         int bouncedir[4]; ///< IR readings (IR)
+         const char *text; ///< NUL-terminated reply text (VERSION), valid until the next feed
+   } srv1_reply_t;
+
+   /**
+    * @brief Parser state. Knows nothing about file descriptors; it is only
+    * ever handed bytes.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int state; ///< Where we are within a reply
+         unsigned char hdr[SRV1_PARSER_HDR_MAX + 1]; ///< Bytes of the current header
+         int hdr_len; ///< Bytes in hdr
+
+         // Header bytes that have to be looked at again after a false start.
+         unsigned char replay[2 * SRV1_PARSER_HDR_MAX];
+         int replay_len;
+         int replay_pos;
+
+         unsigned char mode; ///< Mode of the image being received
+         uint32_t payload_size; ///< Length of the image being received
+         uint32_t payload_got; ///< Payload bytes seen so far
+         char *sink; ///< Where payload bytes go (NULL = discard)
+         uint32_t sink_cap; ///< Size of sink
+         int draining; ///< The current payload was given up on (see srv1_parser_drain())
+
+         uint32_t skipped; ///< Bytes thrown away while looking for a reply
+         uint32_t resyncs; ///< Times a false start sent us looking again
+   } srv1_parser_t;
+
+   /*
+    * Forgets any partial reply. The counters are kept.
+    */
+   void
+   srv1_parser_reset(srv1_parser_t *p);
+
+   /*
+    * Consumes bytes until a reply completes or the input runs out. After
+    * SRV1_REPLY_IMAGE_START the caller may give the payload a home with
+    * srv1_parser_set_sink() before feeding more.
+    * \param reply type is SRV1_REPLY_NONE unless a reply completed.
+    * \return number of bytes of data consumed.
+    */
+   size_t
+   srv1_parser_feed(srv1_parser_t *p, const unsigned char *data, size_t len,
+         srv1_reply_t *reply);
+
+   /*
+    * Gives up on the current image payload without losing track of where it
+    * ends: the rest of it is discarded as it arrives, and the image then
+    * completes with nothing stored. Resetting instead would leave the
+    * unread tail to be scanned for replies, and JPEG data is full of bytes
+    * that look like the start of one.
+    * \return payload bytes still expected (0 if no payload was under way).
+    */
+   uint32_t
+   srv1_parser_drain(srv1_parser_t *p);
+
+   /*
+    * Sets where the payload of the current image goes.
+    */
+   void
+   srv1_parser_set_sink(srv1_parser_t *p, char *buf, uint32_t cap);
+
+   /*
+    * When an image payload is expected and has a sink, lets the caller read
+    * straight into it instead of feeding bytes through.
+    * \param dst set to where the next payload byte goes.
+    * \return number of payload bytes that may be written at dst (0 if the
+    *         parser isn't in a payload or has no sink).
+    */
+   uint32_t
+   srv1_parser_payload_room(srv1_parser_t *p, char **dst);
+
+   /*
+    * Records n bytes written at the pointer from srv1_parser_payload_room().
+    * \return 1 (and fills in reply) if that completed the image, 0 otherwise.
+    */
+   int
+   srv1_parser_payload_commit(srv1_parser_t *p, uint32_t n, srv1_reply_t *reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_PARSER_H_ */
@@ -0,0 +1,129 @@
+/*
+ * surveyor_pyramid.c
+ *
+ * RGB888 images and their half- and quarter-size versions.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_pyramid.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+int
+srv1_image_alloc(srv1_image_t *img, uint32_t width, uint32_t height)
+{
+   uint32_t size = width * height * 3;
+   unsigned char *p;
+
+   if (size > img->cap)
+      {
+         p = (unsigned char *) realloc(img->data, size);
+         if (p == NULL)
+            {
+               return 0;
+            }
+         img->data = p;
+         img->cap = size;
+      }
+   img->width = width;
+   img->height = height;
+   return 1;
+}
+
+void
+srv1_image_free(srv1_image_t *img)
+{
+   free(img->data);
+   img->data = NULL;
+   img->cap = img->width = img->height = 0;
+}
+
+uint32_t
+srv1_image_size(const srv1_image_t *img)
+{
+   return img->width * img->height * 3;
+}
+
+/* Input bytes handled per pass of half_row(): 64 pixel pairs. */
+#define CHUNK 384
+
+/* One output row from two input rows. The rows are first added byte by
+ * byte, a plain loop the compiler turns into SIMD adds; the pairing of
+ * neighbouring pixels is then left with half the work. */
+static void
+half_row(const unsigned char *__restrict r0, const unsigned char *__restrict r1,
+      unsigned char *__restrict out, uint32_t out_width)
+{
+   uint16_t sum[CHUNK];
+   size_t bytes = (size_t) out_width * 6;
+   size_t start, n, i;
+
+   for (start = 0; start < bytes; start += CHUNK)
+      {
+         n = (bytes - start < CHUNK) ? bytes - start : CHUNK;
+         for (i = 0; i < n; i++)
+            {
+               sum[i] = (uint16_t) (r0[i] + r1[i]);
+            }
+         for (i = 0; i < n; i += 6)
+            {
+               out[0] = (unsigned char) ((sum[i] + sum[i + 3] + 2) >> 2);
+               out[1] = (unsigned char) ((sum[i + 1] + sum[i + 4] + 2) >> 2);
+               out[2] = (unsigned char) ((sum[i + 2] + sum[i + 5] + 2) >> 2);
+               out += 3;
+            }
+         r0 += n;
+         r1 += n;
+      }
+}
+
+int
+srv1_pyramid_half(const srv1_image_t *src, srv1_image_t *dst)
+{
+   uint32_t stride = src->width * 3;
+   uint32_t y;
+
+   if (!srv1_image_alloc(dst, src->width / 2, src->height / 2))
+      {
+         return 0;
+      }
+   for (y = 0; y < dst->height; y++)
+      {
+         const unsigned char *r0 = src->data + 2 * y * stride;
+         half_row(r0, r0 + stride, dst->data + y * dst->width * 3,
+               dst->width);
+      }
+   return 1;
+}
+
+int
+srv1_pyramid_build(srv1_image_t *levels, int depth)
+{
+   int i;
+
+   for (i = 1; i < depth && i < SRV1_PYRAMID_LEVELS; i++)
+      {
+         if (!srv1_pyramid_half(&levels[i - 1], &levels[i]))
+            {
+               return 0;
+            }
+      }
+   return 1;
+}
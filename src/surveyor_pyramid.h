@@ -0,0 +1,89 @@
+/*
+ * surveyor_pyramid.h
+ *
+ * RGB888 images and their half- and quarter-size versions.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_PYRAMID_H_
+#define SURVEYOR_PYRAMID_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/* Full size, 1/2 and 1/4. */
+#define SRV1_PYRAMID_LEVELS 3
+
+   /**
+    * @brief An RGB888 image, row after row without padding, in a buffer that
+    * only ever grows.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         unsigned char *data; ///< width * height * 3 bytes
+         uint32_t cap; ///< Bytes allocated for data
+         uint32_t width; ///< Pixels per row
+         uint32_t height; ///< Rows
+   } srv1_image_t;
+
+   /*
+    * Makes room for a width x height image.
+    * \return 1 for success, 0 if out of memory.
+    */
+   int
+   srv1_image_alloc(srv1_image_t *img, uint32_t width, uint32_t height);
+
+   /*
+    * Frees the buffer.
+    */
+   void
+   srv1_image_free(srv1_image_t *img);
+
+   /*
+    * \return bytes of pixel data in img.
+    */
+   uint32_t
+   srv1_image_size(const srv1_image_t *img);
+
+   /*
+    * Shrinks src to half its width and height into dst, each pixel the
+    * rounded mean of a 2x2 block. An odd last row or column is dropped.
+    * \return 1 for success, 0 if out of memory.
+    */
+   int
+   srv1_pyramid_half(const srv1_image_t *src, srv1_image_t *dst);
+
+   /*
+    * Fills levels 1 .. depth - 1 from level 0, each half the size of the one
+    * before, so that level 2 is (to within rounding) the mean of 4x4 blocks
+    * of level 0.
+    * \return 1 for success, 0 if out of memory.
+    */
+   int
+   srv1_pyramid_build(srv1_image_t *levels, int depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_PYRAMID_H_ */
@@ -0,0 +1,153 @@
+/*
+ * surveyor_queue.c
+ *
+ * Lock-free single-producer/single-consumer queue used to pass commands
+ * and events between the Player thread and the serial link thread.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int
+srv1_spsc_init(srv1_spsc_t *q, uint32_t elem_size, uint32_t capacity)
+{
+   uint32_t size = 1;
+   while (size < capacity)
+      {
+         size <<= 1;
+      }
+
+   q->slots = (unsigned char *) malloc((size_t) size * elem_size);
+   if (q->slots == NULL)
+      {
+         return 0;
+      }
+   q->elem_size = elem_size;
+   q->mask = size - 1;
+   q->head = 0;
+   q->tail = 0;
+   return 1;
+}
+
+void
+srv1_spsc_destroy(srv1_spsc_t *q)
+{
+   free(q->slots);
+   q->slots = NULL;
+}
+
+int
+srv1_spsc_push(srv1_spsc_t *q, const void *elem)
+{
+   uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+   uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+   if (head - tail > q->mask)
+      {
+         return 0;
+      }
+
+   memcpy(q->slots + (size_t) (head & q->mask) * q->elem_size, elem,
+         q->elem_size);
+
+   // Publish the element only after its bytes are in place.
+   __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+   return 1;
+}
+
+int
+srv1_spsc_pop(srv1_spsc_t *q, void *elem)
+{
+   uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+   uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+   if (head == tail)
+      {
+         return 0;
+      }
+
+   memcpy(elem, q->slots + (size_t) (tail & q->mask) * q->elem_size,
+         q->elem_size);
+
+   // Hand the slot back to the producer only after we are done copying.
+   __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+   return 1;
+}
+
+int
+srv1_mailbox_init(srv1_mailbox_t *m, uint32_t elem_size)
+{
+   m->bufs = (unsigned char *) calloc(3, elem_size);
+   if (m->bufs == NULL)
+      {
+         return 0;
+      }
+   m->elem_size = elem_size;
+   m->back = 0;
+   m->middle = 1;
+   m->front = 2;
+   m->posted = 0;
+   m->coalesced = 0;
+   return 1;
+}
+
+void
+srv1_mailbox_destroy(srv1_mailbox_t *m)
+{
+   free(m->bufs);
+   m->bufs = NULL;
+}
+
+int
+srv1_mailbox_post(srv1_mailbox_t *m, const void *elem)
+{
+   memcpy(m->bufs + (size_t) m->back * m->elem_size, elem, m->elem_size);
+
+   // Swap our freshly written buffer into the middle; whatever was there
+   // becomes our next back buffer.
+   int old = __atomic_exchange_n(&m->middle, m->back | SRV1_MAILBOX_FRESH,
+         __ATOMIC_ACQ_REL);
+   m->back = old & ~SRV1_MAILBOX_FRESH;
+
+   __atomic_add_fetch(&m->posted, 1, __ATOMIC_RELAXED);
+   if (old & SRV1_MAILBOX_FRESH)
+      {
+         __atomic_add_fetch(&m->coalesced, 1, __ATOMIC_RELAXED);
+         return 1;
+      }
+   return 0;
+}
+
+int
+srv1_mailbox_take(srv1_mailbox_t *m, void *elem)
+{
+   if (!(__atomic_load_n(&m->middle, __ATOMIC_RELAXED) & SRV1_MAILBOX_FRESH))
+      {
+         return 0;
+      }
+
+   int old = __atomic_exchange_n(&m->middle, m->front, __ATOMIC_ACQ_REL);
+   m->front = old & ~SRV1_MAILBOX_FRESH;
+
+   memcpy(elem, m->bufs + (size_t) m->front * m->elem_size, m->elem_size);
+   return 1;
+}
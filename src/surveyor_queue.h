@@ -0,0 +1,136 @@
+/*
+ * surveyor_queue.h
+ *
+ * Lock-free single-producer/single-consumer queue used to pass commands
+ * and events between the Player thread and the serial link thread.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_QUEUE_H_
+#define SURVEYOR_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#define SRV1_CACHELINE 64
+
+   /**
+    * @brief Fixed-size element queue with exactly one pushing thread and one
+    * popping thread. Neither side ever takes a lock or waits on the other.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         unsigned char *slots; ///< capacity * elem_size bytes of storage
+         uint32_t elem_size; ///< Size of one element in bytes
+         uint32_t mask; ///< capacity - 1 (capacity is a power of two)
+
+         // Each index is written by one side only; keep them on separate
+         // cache lines so the two threads don't keep stealing the line.
+         char pad0[SRV1_CACHELINE];
+         uint32_t head; ///< Next slot to push (producer owned)
+         char pad1[SRV1_CACHELINE];
+         uint32_t tail; ///< Next slot to pop (consumer owned)
+         char pad2[SRV1_CACHELINE];
+   } srv1_spsc_t;
+
+   /**
+    * @brief Single-slot "latest wins" mailbox for one producer and one
+    * consumer. A post overwrites any value the consumer has not taken yet,
+    * so the consumer only ever sees the newest one. Implemented as a triple
+    * buffer: each side owns one buffer and they swap through the third with
+    * an atomic exchange, so neither side waits.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         unsigned char *bufs; ///< Three elem_size buffers
+         uint32_t elem_size; ///< Size of one element in bytes
+         int back; ///< Buffer the producer writes next (producer owned)
+         int front; ///< Buffer the consumer read last (consumer owned)
+         int middle; ///< Exchange buffer index | SRV1_MAILBOX_FRESH (atomic)
+         uint32_t posted; ///< Values posted so far (atomic)
+         uint32_t coalesced; ///< Values overwritten before being taken (atomic)
+   } srv1_mailbox_t;
+
+#define SRV1_MAILBOX_FRESH 4
+
+   /*
+    * Allocates storage for capacity elements (rounded up to a power of two).
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_spsc_init(srv1_spsc_t *q, uint32_t elem_size, uint32_t capacity);
+
+   /*
+    * Frees the storage. Neither thread may use the queue afterwards.
+    */
+   void
+   srv1_spsc_destroy(srv1_spsc_t *q);
+
+   /*
+    * Copies elem into the queue. Producer thread only.
+    * \return 1 for success, 0 if the queue is full.
+    */
+   int
+   srv1_spsc_push(srv1_spsc_t *q, const void *elem);
+
+   /*
+    * Copies the oldest element out of the queue. Consumer thread only.
+    * \return 1 for success, 0 if the queue is empty.
+    */
+   int
+   srv1_spsc_pop(srv1_spsc_t *q, void *elem);
+
+   /*
+    * Allocates the three buffers.
+    * \return 1 for success, 0 for failure.
+    */
+   int
+   srv1_mailbox_init(srv1_mailbox_t *m, uint32_t elem_size);
+
+   /*
+    * Frees the buffers. Neither thread may use the mailbox afterwards.
+    */
+   void
+   srv1_mailbox_destroy(srv1_mailbox_t *m);
+
+   /*
+    * Stores elem, replacing any value not yet taken. Producer thread only.
+    * \return 1 if an untaken value was replaced, 0 otherwise.
+    */
+   int
+   srv1_mailbox_post(srv1_mailbox_t *m, const void *elem);
+
+   /*
+    * Copies out the newest value if one was posted since the last take.
+    * Consumer thread only.
+    * \return 1 if elem was filled in, 0 if there was nothing new.
+    */
+   int
+   srv1_mailbox_take(srv1_mailbox_t *m, void *elem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_QUEUE_H_ */
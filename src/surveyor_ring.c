@@ -0,0 +1,106 @@
+/*
+ * surveyor_ring.c
+ *
+ * Byte ring buffer used to stage data received from a SRV-1 robot.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_ring.h"
+
+#include <string.h>
+
+#define RING_MASK (SRV1_RING_SIZE - 1)
+
+void
+srv1_ring_reset(srv1_ring_t *r)
+{
+   r->head = 0;
+   r->tail = 0;
+}
+
+uint32_t
+srv1_ring_used(const srv1_ring_t *r)
+{
+   return r->head - r->tail;
+}
+
+uint32_t
+srv1_ring_read(srv1_ring_t *r, char *dst, uint32_t n)
+{
+   uint32_t used = srv1_ring_used(r);
+   if (n > used)
+      {
+         n = used;
+      }
+
+   // Copy in at most two pieces: up to the end of the array, then the wrap.
+   uint32_t start = r->tail & RING_MASK;
+   uint32_t first = SRV1_RING_SIZE - start;
+   if (first > n)
+      {
+         first = n;
+      }
+   memcpy(dst, r->data + start, first);
+   memcpy(dst + first, r->data, n - first);
+
+   r->tail += n;
+   return n;
+}
+
+const unsigned char *
+srv1_ring_read_span(const srv1_ring_t *r, uint32_t *len)
+{
+   uint32_t start = r->tail & RING_MASK;
+   uint32_t used = srv1_ring_used(r);
+   uint32_t contiguous = SRV1_RING_SIZE - start;
+
+   *len = (used < contiguous ? used : contiguous);
+   return r->data + start;
+}
+
+void
+srv1_ring_consume(srv1_ring_t *r, uint32_t n)
+{
+   r->tail += n;
+}
+
+unsigned char *
+srv1_ring_write_span(srv1_ring_t *r, uint32_t *len)
+{
+   uint32_t start = r->head & RING_MASK;
+   uint32_t space = SRV1_RING_SIZE - srv1_ring_used(r);
+   uint32_t contiguous = SRV1_RING_SIZE - start;
+
+   *len = (space < contiguous ? space : contiguous);
+   return r->data + start;
+}
+
+void
+srv1_ring_commit(srv1_ring_t *r, uint32_t n)
+{
+   r->head += n;
+}
+
+uint32_t
+srv1_ring_discard(srv1_ring_t *r)
+{
+   uint32_t n = srv1_ring_used(r);
+   r->tail = r->head;
+   return n;
+}
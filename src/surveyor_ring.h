@@ -0,0 +1,106 @@
+/*
+ * surveyor_ring.h
+ *
+ * Byte ring buffer used to stage data received from a SRV-1 robot.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_RING_H_
+#define SURVEYOR_RING_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/* Must be a power of two so indices can be masked instead of wrapped. */
+#define SRV1_RING_SIZE 4096
+
+   /**
+    * @brief Receive ring buffer. Head and tail are free-running counters,
+    * only masked when indexing into the data array.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         unsigned char data[SRV1_RING_SIZE]; ///< Storage
+         uint32_t head; ///< Total bytes ever written
+         uint32_t tail; ///< Total bytes ever read
+   } srv1_ring_t;
+
+   /*
+    * Empties the ring.
+    */
+   void
+   srv1_ring_reset(srv1_ring_t *r);
+
+   /*
+    * \return number of bytes waiting to be read.
+    */
+   uint32_t
+   srv1_ring_used(const srv1_ring_t *r);
+
+   /*
+    * Copies up to n bytes out of the ring.
+    * \return number of bytes copied.
+    */
+   uint32_t
+   srv1_ring_read(srv1_ring_t *r, char *dst, uint32_t n);
+
+   /*
+    * Largest contiguous readable region, for looking at data in place.
+    * \param len set to the size of the region (0 if the ring is empty).
+    * \return pointer to the start of the region.
+    */
+   const unsigned char *
+   srv1_ring_read_span(const srv1_ring_t *r, uint32_t *len);
+
+   /*
+    * Drops n bytes from the front of the ring (after srv1_ring_read_span()).
+    */
+   void
+   srv1_ring_consume(srv1_ring_t *r, uint32_t n);
+
+   /*
+    * Largest contiguous free region, suitable for handing to read(2).
+    * \param len set to the size of the region (0 if the ring is full).
+    * \return pointer to the start of the region.
+    */
+   unsigned char *
+   srv1_ring_write_span(srv1_ring_t *r, uint32_t *len);
+
+   /*
+    * Marks n bytes of the region returned by srv1_ring_write_span() as filled.
+    */
+   void
+   srv1_ring_commit(srv1_ring_t *r, uint32_t n);
+
+   /*
+    * Drops everything waiting in the ring.
+    * \return number of bytes discarded.
+    */
+   uint32_t
+   srv1_ring_discard(srv1_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_RING_H_ */
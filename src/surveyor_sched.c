@@ -0,0 +1,104 @@
+/*
+ * surveyor_sched.c
+ *
+ * Deadline-based periodic timer on the monotonic clock, with jitter and
+ * overrun statistics.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_sched.h"
+
+#include <string.h>
+#include <time.h>
+
+int64_t
+srv1_sched_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+void
+srv1_sched_init(srv1_sched_t *s, int64_t period_usec)
+{
+   memset(s, 0, sizeof(*s));
+   s->period = period_usec > 0 ? period_usec : 1;
+   s->deadline = srv1_sched_now();
+}
+
+int
+srv1_sched_due(const srv1_sched_t *s, int64_t now)
+{
+   return now >= s->deadline;
+}
+
+void
+srv1_sched_begin(srv1_sched_t *s, int64_t now)
+{
+   int64_t late = now - s->deadline;
+   if (late < 0)
+      {
+         late = 0;
+      }
+
+   s->stats.cycles++;
+   s->stats.jitter_sum += late;
+   if (late > s->stats.jitter_max)
+      {
+         s->stats.jitter_max = late;
+      }
+
+   // Stay on the original grid, but never owe more than one cycle.
+   s->deadline += s->period;
+   if (s->deadline <= now)
+      {
+         int64_t missed = (now - s->deadline) / s->period + 1;
+         s->stats.skipped += (uint32_t) missed;
+         s->deadline += missed * s->period;
+      }
+}
+
+void
+srv1_sched_end(srv1_sched_t *s, int64_t now)
+{
+   int64_t over = now - s->deadline;
+   if (over >= 0)
+      {
+         s->stats.overruns++;
+         if (over > s->stats.overrun_max)
+            {
+               s->stats.overrun_max = over;
+            }
+      }
+}
+
+int64_t
+srv1_sched_remaining(const srv1_sched_t *s, int64_t now)
+{
+   int64_t left = s->deadline - now;
+   return left > 0 ? left : 0;
+}
+
+void
+srv1_sched_take_stats(srv1_sched_t *s, srv1_sched_stats_t *out)
+{
+   *out = s->stats;
+   memset(&s->stats, 0, sizeof(s->stats));
+}
@@ -0,0 +1,110 @@
+/*
+ * surveyor_sched.h
+ *
+ * Deadline-based periodic timer on the monotonic clock, with jitter and
+ * overrun statistics.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_SCHED_H_
+#define SURVEYOR_SCHED_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+   /**
+    * @brief How well a periodic timer has kept its schedule.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         uint32_t cycles; ///< Cycles started
+         uint32_t overruns; ///< Cycles whose work ran past the next deadline
+         uint32_t skipped; ///< Whole periods dropped to catch up after overruns
+         int64_t jitter_max; ///< Worst lateness of a cycle start (usec)
+         int64_t jitter_sum; ///< Sum of cycle start lateness (usec)
+         int64_t overrun_max; ///< Worst time past the deadline a cycle ended (usec)
+   } srv1_sched_stats_t;
+
+   /**
+    * @brief A fixed-period timer. Cycles are due on absolute deadlines, so
+    * time spent doing the work does not make the period drift.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int64_t period; ///< Target period (usec)
+         int64_t deadline; ///< When the next cycle is due (monotonic usec)
+         srv1_sched_stats_t stats; ///< Since srv1_sched_init() or the last reset
+   } srv1_sched_t;
+
+   /*
+    * \return microseconds on the monotonic clock.
+    */
+   int64_t
+   srv1_sched_now(void);
+
+   /*
+    * Sets the period; the first cycle is due immediately.
+    */
+   void
+   srv1_sched_init(srv1_sched_t *s, int64_t period_usec);
+
+   /*
+    * \return 1 if a cycle is due at time now.
+    */
+   int
+   srv1_sched_due(const srv1_sched_t *s, int64_t now);
+
+   /*
+    * Starts a due cycle: records how late it is and moves the deadline on by
+    * one period. Periods that were missed entirely are dropped rather than
+    * run back to back.
+    */
+   void
+   srv1_sched_begin(srv1_sched_t *s, int64_t now);
+
+   /*
+    * Ends the cycle started last; counts an overrun if the next deadline
+    * has already passed.
+    */
+   void
+   srv1_sched_end(srv1_sched_t *s, int64_t now);
+
+   /*
+    * \return microseconds left until the next cycle is due; 0 if it is due
+    * already, meaning the caller should not sleep at all.
+    */
+   int64_t
+   srv1_sched_remaining(const srv1_sched_t *s, int64_t now);
+
+   /*
+    * Copies the statistics out and starts counting afresh.
+    */
+   void
+   srv1_sched_take_stats(srv1_sched_t *s, srv1_sched_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_SCHED_H_ */
@@ -0,0 +1,169 @@
+/*
+ * surveyor_stats.c
+ *
+ * Latency histograms and error counters for the serial link.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_stats.h"
+
+#include <string.h>
+
+#define SUB (1 << SRV1_HIST_SUB_BITS)
+
+/* The only writer is the link thread, so a plain increment stored
+ * atomically is enough; it just mustn't tear for a concurrent reader. */
+#define BUMP(field, n) \
+   __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+void
+srv1_stats_reset(srv1_stats_t *s)
+{
+   memset(s, 0, sizeof(*s));
+}
+
+void
+srv1_stats_count(uint32_t *counter, uint32_t n)
+{
+   BUMP(*counter, n);
+}
+
+int
+srv1_hist_bucket(int64_t usec)
+{
+   uint32_t v;
+   int msb;
+
+   if (usec < SUB)
+      {
+         return usec < 0 ? 0 : (int) usec;
+      }
+   if (usec >= ((int64_t) 1 << SRV1_HIST_MAX_BITS))
+      {
+         return SRV1_HIST_BUCKETS - 1;
+      }
+   v = (uint32_t) usec;
+   msb = 31 - __builtin_clz(v);
+   return SUB + (msb - SRV1_HIST_SUB_BITS) * SUB + ((v >> (msb
+         - SRV1_HIST_SUB_BITS)) & (SUB - 1));
+}
+
+uint32_t
+srv1_hist_floor(int i)
+{
+   int shift;
+
+   if (i < SUB)
+      {
+         return i;
+      }
+   shift = (i - SUB) / SUB;
+   return (uint32_t) (SUB + (i - SUB) % SUB) << shift;
+}
+
+void
+srv1_stats_latency(srv1_stats_t *s, int txn, int64_t usec)
+{
+   srv1_hist_t *h;
+
+   if (txn < 1 || txn > SRV1_STATS_TXNS)
+      {
+         return;
+      }
+   if (usec < 0)
+      {
+         usec = 0;
+      }
+   h = &s->latency[txn - 1];
+   BUMP(h->buckets[srv1_hist_bucket(usec)], 1);
+   BUMP(h->sum, (uint64_t) usec);
+   if (usec > h->max)
+      {
+         __atomic_store_n(&h->max, usec > UINT32_MAX ? UINT32_MAX
+               : (uint32_t) usec, __ATOMIC_RELAXED);
+      }
+   // Last, so that a reader never sees more transactions than bucket counts.
+   __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+}
+
+static void
+copy_counters(const uint32_t *from, uint32_t *to, int n)
+{
+   int i;
+   for (i = 0; i < n; i++)
+      {
+         to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+      }
+}
+
+void
+srv1_stats_snapshot(const srv1_stats_t *s, srv1_stats_t *copy)
+{
+   int t;
+
+   for (t = 0; t < SRV1_STATS_TXNS; t++)
+      {
+         const srv1_hist_t *h = &s->latency[t];
+         srv1_hist_t *c = &copy->latency[t];
+         c->count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+         c->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+         c->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+         copy_counters(h->buckets, c->buckets, SRV1_HIST_BUCKETS);
+      }
+   copy->timeouts = __atomic_load_n(&s->timeouts, __ATOMIC_RELAXED);
+   copy->image_retries = __atomic_load_n(&s->image_retries, __ATOMIC_RELAXED);
+   copy->flushed_bytes = __atomic_load_n(&s->flushed_bytes, __ATOMIC_RELAXED);
+   copy->skipped_bytes = __atomic_load_n(&s->skipped_bytes, __ATOMIC_RELAXED);
+   copy->truncated_frames = __atomic_load_n(&s->truncated_frames,
+         __ATOMIC_RELAXED);
+   copy->drained_bytes = __atomic_load_n(&s->drained_bytes, __ATOMIC_RELAXED);
+   copy->bad_frames = __atomic_load_n(&s->bad_frames, __ATOMIC_RELAXED);
+   copy->version = SRV1_STATS_VERSION;
+   copy->sub_bits = SRV1_HIST_SUB_BITS;
+}
+
+uint32_t
+srv1_hist_percentile(const srv1_hist_t *h, double percent)
+{
+   uint64_t want;
+   uint64_t seen = 0;
+   int i;
+
+   if (h->count == 0)
+      {
+         return 0;
+      }
+   want = (uint64_t) (percent / 100.0 * h->count + 0.5);
+   if (want < 1)
+      {
+         want = 1;
+      }
+   for (i = 0; i < SRV1_HIST_BUCKETS; i++)
+      {
+         seen += h->buckets[i];
+         if (seen >= want)
+            {
+               // Top of the bucket, but never more than was actually seen.
+               uint32_t top = (i + 1 < SRV1_HIST_BUCKETS) ? srv1_hist_floor(i
+                     + 1) - 1 : h->max;
+               return top < h->max ? top : h->max;
+            }
+      }
+   return h->max;
+}
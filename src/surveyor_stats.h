@@ -0,0 +1,132 @@
+/*
+ * surveyor_stats.h
+ *
+ * Latency histograms and error counters for the serial link.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_STATS_H_
+#define SURVEYOR_STATS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/* Layout of srv1_stats_t; bump it whenever the structure changes. */
+#define SRV1_STATS_VERSION 2
+
+/*
+ * Histogram buckets are log-linear like HdrHistogram's: values below
+ * 2^SRV1_HIST_SUB_BITS get a bucket each, and every power of two above
+ * is split into 2^SRV1_HIST_SUB_BITS equal buckets, so a value is known to
+ * within 12.5%. Values of 2^SRV1_HIST_MAX_BITS usec (about 4.5 minutes)
+ * and more share the last bucket.
+ */
+#define SRV1_HIST_SUB_BITS 3
+#define SRV1_HIST_MAX_BITS 28
+#define SRV1_HIST_BUCKETS ((1 << SRV1_HIST_SUB_BITS) \
+      * (SRV1_HIST_MAX_BITS - SRV1_HIST_SUB_BITS + 1))
+
+/* Transactions with a histogram: SRV1_TXN_MOTORS..SRV1_TXN_IR. */
+#define SRV1_STATS_TXNS 4
+
+   /**
+    * @brief Latency histogram of one kind of transaction (usec).
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         uint32_t count; ///< Transactions recorded
+         uint32_t max; ///< Slowest one
+         uint64_t sum; ///< Total of all of them
+         uint32_t buckets[SRV1_HIST_BUCKETS]; ///< Counts; see srv1_hist_floor()
+   } srv1_hist_t;
+
+   /**
+    * @brief Everything the link measures. Only the thread that talks to the
+    * robot updates it; others read it with srv1_stats_snapshot(). A snapshot
+    * is also what the driver sends in reply to an opaque request, in host
+    * byte order.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         uint32_t version; ///< SRV1_STATS_VERSION (set by srv1_stats_snapshot())
+         uint32_t sub_bits; ///< SRV1_HIST_SUB_BITS (set by srv1_stats_snapshot())
+         srv1_hist_t latency[SRV1_STATS_TXNS]; ///< Request to complete reply, indexed by SRV1_TXN_* - 1
+         uint32_t timeouts; ///< Replies that didn't arrive in time
+         uint32_t image_retries; ///< Image requests sent again after a timeout
+         uint32_t flushed_bytes; ///< Bytes thrown away by srv1_flush_input()
+         uint32_t skipped_bytes; ///< Bytes skipped to resynchronize on a reply
+         uint32_t truncated_frames; ///< Images whose body timed out
+         uint32_t drained_bytes; ///< Bytes of those bodies discarded after the timeout
+         uint32_t bad_frames; ///< Complete images that weren't a whole JPEG (SOI/EOI)
+   } srv1_stats_t;
+
+   /*
+    * Zeroes all counters.
+    */
+   void
+   srv1_stats_reset(srv1_stats_t *s);
+
+   /*
+    * Adds n to one of the counters of a srv1_stats_t.
+    */
+   void
+   srv1_stats_count(uint32_t *counter, uint32_t n);
+
+   /*
+    * Records how long a transaction of type txn (SRV1_TXN_*) took.
+    */
+   void
+   srv1_stats_latency(srv1_stats_t *s, int txn, int64_t usec);
+
+   /*
+    * Copies s while the link may be updating it. Each counter is read
+    * atomically; the copy as a whole may straddle an update.
+    */
+   void
+   srv1_stats_snapshot(const srv1_stats_t *s, srv1_stats_t *copy);
+
+   /*
+    * \return the bucket of h that a value falls into.
+    */
+   int
+   srv1_hist_bucket(int64_t usec);
+
+   /*
+    * \return the smallest value that falls into bucket i.
+    */
+   uint32_t
+   srv1_hist_floor(int i);
+
+   /*
+    * \return the value below which percent of h's values lie, to within
+    * the bucket's width (0 if h is empty).
+    */
+   uint32_t
+   srv1_hist_percentile(const srv1_hist_t *h, double percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_STATS_H_ */
@@ -0,0 +1,530 @@
+/*
+ * surveyor_transport.c
+ *
+ * How bytes move between a srv1_comm_t and its serial port: plain POSIX
+ * read()/write()/poll(), or io_uring.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_transport.h"
+#include "surveyor_comms.h"
+#include "surveyor_log.h"
+#include "surveyor_sched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ---- POSIX ---- */
+
+/*
+ * Sleeps until fd is ready for the given poll events or the deadline passes.
+ * \return 1 if ready, 0 on timeout, -1 on error.
+ */
+static int
+wait_fd(srv1_comm_t *x, short events, int64_t deadline)
+{
+   struct pollfd pfd;
+   pfd.fd = x->fd;
+   pfd.events = events;
+
+   for (;;)
+      {
+         int64_t left = deadline - srv1_sched_now();
+         if (left <= 0)
+            {
+               return 0;
+            }
+
+         // Round up so we never wake a hair early and spin on a 0 ms poll.
+         x->io_calls++;
+         int res = poll(&pfd, 1, (int) ((left + 999) / 1000));
+         if (res > 0)
+            {
+               return 1;
+            }
+         if (res < 0 && errno != EINTR)
+            {
+               perror("wait_fd():poll()");
+               return -1;
+            }
+      }
+}
+
+static int
+posix_attach(srv1_comm_t *x)
+{
+   return 1;
+}
+
+static void
+posix_detach(srv1_comm_t *x)
+{
+}
+
+static int
+posix_read(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   x->io_calls++;
+   return read(x->fd, buf, len);
+}
+
+static int
+posix_write(srv1_comm_t *x, const void *buf, uint32_t len, int64_t deadline)
+{
+   const char *p = (const char *) buf;
+   uint32_t done = 0;
+
+   while (done < len)
+      {
+         x->io_calls++;
+         int res = write(x->fd, p + done, len - done);
+         if (res < 0)
+            {
+               if (errno != EAGAIN && errno != EINTR)
+                  {
+                     perror("posix_write():write()");
+                     return -1;
+                  }
+               // The output queue is backed up; wait for room.
+               if (wait_fd(x, POLLOUT, deadline) <= 0)
+                  {
+                     return -1;
+                  }
+               continue;
+            }
+         done += res;
+      }
+
+   return done;
+}
+
+static int
+posix_wait(srv1_comm_t *x, int64_t deadline)
+{
+   return wait_fd(x, POLLIN, deadline);
+}
+
+static void
+posix_prefetch(srv1_comm_t *x, void *buf, uint32_t len)
+{
+}
+
+static void
+posix_cancel(srv1_comm_t *x)
+{
+}
+
+static int
+posix_poll_fd(srv1_comm_t *x)
+{
+   return x->fd;
+}
+
+static int
+posix_flush(srv1_comm_t *x)
+{
+   return 0;
+}
+
+static int
+posix_ready(srv1_comm_t *x)
+{
+   return 0;
+}
+
+const srv1_transport_t srv1_posix_transport =
+   { "posix", posix_attach, posix_detach, posix_read, posix_write, posix_wait,
+         posix_prefetch, posix_cancel, posix_poll_fd, posix_flush,
+         posix_ready, NULL };
+
+/* ---- io_uring ---- */
+
+/* Low bits of user_data: what the completion belongs to. */
+#define TAG_READ 0
+#define TAG_WRITE 1
+#define TAG_CANCEL 2
+#define TAG_MASK 3
+
+/*
+ * Per-robot state of the io_uring transport. At most one read and one write
+ * are in flight per robot.
+ */
+typedef struct
+{
+      srv1_uring_t *ring; ///< Possibly shared with other robots
+      int read_busy; ///< A read is in the kernel
+      int read_done; ///< A read completed and read() has not returned it yet
+      int read_res; ///< Its result
+      void *read_buf; ///< Where the read goes
+      int write_busy; ///< A write is in the kernel
+      int write_res; ///< Result of the last write
+} uring_io_t;
+
+static uint64_t
+user_data(uring_io_t *st, int tag)
+{
+   return (uint64_t) (uintptr_t) st | tag;
+}
+
+/*
+ * Takes every completion on the ring and files it with the robot it belongs
+ * to; the ring may be shared, so some are other robots'.
+ */
+static void
+uring_dispatch(srv1_uring_t *ring)
+{
+   struct io_uring_cqe cqe;
+   while (srv1_uring_reap(ring, &cqe))
+      {
+         uring_io_t *st = (uring_io_t *) (uintptr_t) (cqe.user_data
+               & ~(uint64_t) TAG_MASK);
+         switch (cqe.user_data & TAG_MASK)
+            {
+         case TAG_READ:
+            st->read_busy = 0;
+            st->read_done = 1;
+            st->read_res = cqe.res;
+            break;
+         case TAG_WRITE:
+            st->write_busy = 0;
+            st->write_res = cqe.res;
+            break;
+         default:
+            // The cancelled operation completes on its own.
+            break;
+            }
+      }
+}
+
+/*
+ * Submits and waits for one completion, counting the system call against x.
+ */
+static int
+uring_wait_one(srv1_comm_t *x, int64_t timeout_usec)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   uint32_t before = st->ring->enters;
+   int res = srv1_uring_enter(st->ring, 1, timeout_usec);
+   x->io_calls += st->ring->enters - before;
+   uring_dispatch(st->ring);
+   return res;
+}
+
+/*
+ * Queues a read into buf. No system call; the next enter submits it.
+ */
+static int
+uring_queue_read(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   struct io_uring_sqe *sqe = srv1_uring_get_sqe(st->ring);
+   if (sqe == NULL)
+      {
+         return 0;
+      }
+
+   sqe->opcode = IORING_OP_READ;
+   sqe->fd = x->fd;
+   sqe->addr = (uint64_t) (uintptr_t) buf;
+   sqe->len = len;
+   sqe->off = (uint64_t) -1; // a tty has no offset
+   sqe->user_data = user_data(st, TAG_READ);
+
+   st->read_busy = 1;
+   st->read_buf = buf;
+   return 1;
+}
+
+/*
+ * Cancels the operation with the given tag and waits until it is gone.
+ */
+static void
+uring_cancel_op(srv1_comm_t *x, int tag, int *busy)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+
+   if (*busy)
+      {
+         struct io_uring_sqe *sqe = srv1_uring_get_sqe(st->ring);
+         if (sqe != NULL)
+            {
+               sqe->opcode = IORING_OP_ASYNC_CANCEL;
+               sqe->fd = -1;
+               sqe->addr = user_data(st, tag);
+               sqe->user_data = user_data(st, TAG_CANCEL);
+            }
+      }
+   // The buffer must not be touched by the kernel once we return.
+   while (*busy)
+      {
+         if (uring_wait_one(x, -1) < 0)
+            {
+               break;
+            }
+      }
+}
+
+static int
+uring_attach(srv1_comm_t *x)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   if (st == NULL || st->ring == NULL || st->ring->fd < 0)
+      {
+         return 0;
+      }
+
+   // io_uring completes a read on a non-blocking descriptor with EAGAIN
+   // instead of waiting for data; let the kernel do the waiting.
+   int flags = fcntl(x->fd, F_GETFL);
+   if (flags < 0 || fcntl(x->fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+      {
+         perror("uring_attach():fcntl()");
+         return 0;
+      }
+   return 1;
+}
+
+static void
+uring_detach(srv1_comm_t *x)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   uring_cancel_op(x, TAG_READ, &st->read_busy);
+   st->read_done = 0;
+
+   int flags = fcntl(x->fd, F_GETFL);
+   if (flags >= 0)
+      {
+         fcntl(x->fd, F_SETFL, flags | O_NONBLOCK);
+      }
+}
+
+static int
+uring_read(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+
+   uring_dispatch(st->ring);
+
+   if (st->read_done)
+      {
+         st->read_done = 0;
+         if (st->read_buf != buf)
+            {
+               // Only happens if the caller changed buffers without
+               // cancelling.
+               SRV1_LOG1(SRV1_LOG_WARN,
+                     "srv1: dropped %d bytes read into a stale buffer\n",
+                     st->read_res);
+            }
+         // A read queued by a thread that has exited since (the reactor,
+         // once it is stopped) is cancelled with it; queue it again.
+         else if (st->read_res != -ECANCELED)
+            {
+               if (st->read_res < 0)
+                  {
+                     errno = -st->read_res;
+                     return -1;
+                  }
+               return st->read_res;
+            }
+      }
+
+   if (st->read_busy && st->read_buf != buf)
+      {
+         uring_cancel_op(x, TAG_READ, &st->read_busy);
+         st->read_done = 0;
+      }
+
+   if (!st->read_busy && !uring_queue_read(x, buf, len))
+      {
+         return -1;
+      }
+
+   errno = EAGAIN;
+   return -1;
+}
+
+static int
+uring_write(srv1_comm_t *x, const void *buf, uint32_t len, int64_t deadline)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   const char *p = (const char *) buf;
+   uint32_t done = 0;
+
+   while (done < len)
+      {
+         struct io_uring_sqe *sqe = srv1_uring_get_sqe(st->ring);
+         if (sqe == NULL)
+            {
+               return -1;
+            }
+         sqe->opcode = IORING_OP_WRITE;
+         sqe->fd = x->fd;
+         sqe->addr = (uint64_t) (uintptr_t) (p + done);
+         sqe->len = len - done;
+         sqe->off = (uint64_t) -1;
+         sqe->user_data = user_data(st, TAG_WRITE);
+         st->write_busy = 1;
+
+         // Goes in with any read queued by prefetch(): one system call for
+         // the request and the read of its reply.
+         while (st->write_busy)
+            {
+               int64_t left = deadline - srv1_sched_now();
+               if (left <= 0 || uring_wait_one(x, left) < 0)
+                  {
+                     uring_cancel_op(x, TAG_WRITE, &st->write_busy);
+                     return -1;
+                  }
+            }
+
+         // The kernel worker doing a tty write can be interrupted (when a
+         // read on the same port is cancelled, say) before writing anything.
+         if (st->write_res == -EINTR)
+            {
+               continue;
+            }
+         if (st->write_res < 0)
+            {
+               errno = -st->write_res;
+               perror("uring_write()");
+               return -1;
+            }
+         done += st->write_res;
+      }
+
+   return done;
+}
+
+static int
+uring_wait(srv1_comm_t *x, int64_t deadline)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+
+   for (;;)
+      {
+         uring_dispatch(st->ring);
+         if (st->read_done || !st->read_busy)
+            {
+               // Nothing queued means read() has to be called to queue one.
+               return 1;
+            }
+
+         int64_t left = deadline - srv1_sched_now();
+         if (left <= 0)
+            {
+               return 0;
+            }
+         if (uring_wait_one(x, left) < 0)
+            {
+               return -1;
+            }
+      }
+}
+
+static void
+uring_prefetch(srv1_comm_t *x, void *buf, uint32_t len)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   if (!st->read_busy && !st->read_done)
+      {
+         uring_queue_read(x, buf, len);
+      }
+}
+
+static void
+uring_cancel(srv1_comm_t *x)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   uring_cancel_op(x, TAG_READ, &st->read_busy);
+   st->read_done = 0;
+}
+
+static int
+uring_poll_fd(srv1_comm_t *x)
+{
+   return ((uring_io_t *) x->io_state)->ring->fd;
+}
+
+static int
+uring_flush(srv1_comm_t *x)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   uint32_t before = st->ring->enters;
+   int res = srv1_uring_enter(st->ring, 0, 0);
+   x->io_calls += st->ring->enters - before;
+   return res;
+}
+
+static int
+uring_ready(srv1_comm_t *x)
+{
+   uring_io_t *st = (uring_io_t *) x->io_state;
+   uring_dispatch(st->ring);
+   return st->read_done;
+}
+
+const srv1_transport_t srv1_uring_transport =
+   { "uring", uring_attach, uring_detach, uring_read, uring_write, uring_wait,
+         uring_prefetch, uring_cancel, uring_poll_fd, uring_flush,
+         uring_ready, NULL };
+
+const srv1_transport_t *
+srv1_transport_find(const char *name)
+{
+   if (strcmp(name, srv1_posix_transport.name) == 0)
+      {
+         return &srv1_posix_transport;
+      }
+   if (strcmp(name, srv1_uring_transport.name) == 0)
+      {
+         return &srv1_uring_transport;
+      }
+   if (strcmp(name, srv1_replay_transport.name) == 0)
+      {
+         return &srv1_replay_transport;
+      }
+   return NULL;
+}
+
+int
+srv1_use_uring(srv1_comm_t *x, srv1_uring_t *ring)
+{
+   if (x->fd != -1 || ring == NULL || ring->fd < 0)
+      {
+         return 0;
+      }
+
+   uring_io_t *st = (uring_io_t *) calloc(1, sizeof(uring_io_t));
+   if (st == NULL)
+      {
+         return 0;
+      }
+   st->ring = ring;
+
+   free(x->io_state);
+   x->io_state = st;
+   x->io = &srv1_uring_transport;
+   return 1;
+}
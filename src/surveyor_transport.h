@@ -0,0 +1,142 @@
+/*
+ * surveyor_transport.h
+ *
+ * How bytes move between a srv1_comm_t and its serial port: plain POSIX
+ * read()/write()/poll(), or io_uring.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_TRANSPORT_H_
+#define SURVEYOR_TRANSPORT_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#include "surveyor_uring.h"
+
+   struct srv1_comm;
+
+   /**
+    * @brief Operations of a serial transport. All of them act on x->fd and
+    * the per-robot state in x->io_state.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         const char *name; ///< As given in the configuration file
+
+         /* Called once the port is open. \return 1 for success. */
+         int
+         (*attach)(struct srv1_comm *x);
+         /* Called before the port is closed. */
+         void
+         (*detach)(struct srv1_comm *x);
+
+         /* Like read() on a non-blocking descriptor: bytes read, or -1 with
+          * errno EAGAIN when nothing has arrived yet. */
+         int
+         (*read)(struct srv1_comm *x, void *buf, uint32_t len);
+         /* Writes all of buf, waiting no later than deadline (monotonic
+          * usec). \return bytes written, or -1 on error or timeout. */
+         int
+         (*write)(struct srv1_comm *x, const void *buf, uint32_t len,
+               int64_t deadline);
+         /* Sleeps until read() has something or the deadline passes.
+          * \return 1 if ready, 0 on timeout, -1 on error. */
+         int
+         (*wait)(struct srv1_comm *x, int64_t deadline);
+
+         /* Hint: the next read() will be into buf; it may start now. */
+         void
+         (*prefetch)(struct srv1_comm *x, void *buf, uint32_t len);
+         /* Stops any read in flight; the buffer it had is free again. */
+         void
+         (*cancel)(struct srv1_comm *x);
+
+         /* Descriptor to poll() for readability from an event loop. */
+         int
+         (*poll_fd)(struct srv1_comm *x);
+         /* Hands queued work to the kernel before the event loop sleeps.
+          * \return 0, or -1 on error. */
+         int
+         (*flush)(struct srv1_comm *x);
+         /* \return 1 if read() would return data now without poll_fd()
+          * having said so. */
+         int
+         (*ready)(struct srv1_comm *x);
+
+         /* Opens x->port and sets x->fd, for transports that don't talk to
+          * a serial port; NULL if srv1_open() should open the tty.
+          * \return 1 for success. */
+         int
+         (*open)(struct srv1_comm *x);
+   } srv1_transport_t;
+
+   /** read(), write() and poll() on the port. The default. */
+   extern const srv1_transport_t srv1_posix_transport;
+
+   /** io_uring: reads stay queued in the kernel and complete into the
+    * caller's buffer, and a request is submitted together with the read of
+    * its reply. One ring may be shared by every robot on a thread. */
+   extern const srv1_transport_t srv1_uring_transport;
+
+   /** Plays a capture file (named by the port) back instead of talking to
+    * a robot: received bytes arrive on the recorded timeline, writes are
+    * discarded. See surveyor_capture.h. */
+   extern const srv1_transport_t srv1_replay_transport;
+
+   /*
+    * Finds a transport by name ("posix", "uring" or "replay").
+    * \return the transport, or NULL if there is none by that name.
+    */
+   const srv1_transport_t *
+   srv1_transport_find(const char *name);
+
+   /*
+    * Switches x, which must not be open yet, to the io_uring transport on
+    * ring. If the ring can't be used when the port opens, x falls back to
+    * the POSIX transport.
+    * \return 1 for success, 0 on failure (x keeps its transport).
+    */
+   int
+   srv1_use_uring(struct srv1_comm *x, srv1_uring_t *ring);
+
+   /*
+    * Switches x, which must not be open yet, to replaying the capture file
+    * named by its port. speed scales the recorded timeline: 1 replays in
+    * real time, 0 hands out every byte as soon as it is asked for.
+    * \return 1 for success, 0 on failure (x keeps its transport).
+    */
+   int
+   srv1_use_replay(struct srv1_comm *x, double speed);
+
+   /*
+    * \return 1 once x replays and every received byte has been handed out.
+    */
+   int
+   srv1_replay_finished(struct srv1_comm *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_TRANSPORT_H_ */
@@ -0,0 +1,245 @@
+/*
+ * surveyor_uring.c
+ *
+ * Minimal io_uring wrapper (raw system calls, no liburing) used by the
+ * io_uring serial transport.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "surveyor_uring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int
+uring_setup(unsigned entries, struct io_uring_params *p)
+{
+   return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+      void *arg, size_t argsz)
+{
+   return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+         flags, arg, argsz);
+}
+
+int
+srv1_uring_init(srv1_uring_t *u, unsigned entries)
+{
+   struct io_uring_params p;
+
+   memset(u, 0, sizeof(*u));
+   memset(&p, 0, sizeof(p));
+   u->fd = -1;
+
+   int fd = uring_setup(entries, &p);
+   if (fd < 0)
+      {
+         perror("srv1_uring_init():io_uring_setup()");
+         return 0;
+      }
+   if (!(p.features & IORING_FEAT_EXT_ARG))
+      {
+         printf("srv1_uring_init(): kernel can't wait with a timeout\n");
+         close(fd);
+         return 0;
+      }
+
+   u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+         if (u->cq_map_len > u->sq_map_len)
+            {
+               u->sq_map_len = u->cq_map_len;
+            }
+         u->cq_map_len = u->sq_map_len;
+      }
+
+   u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED
+         | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+   if (u->sq_map == MAP_FAILED)
+      {
+         perror("srv1_uring_init():mmap()");
+         close(fd);
+         return 0;
+      }
+
+   if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+         u->cq_map = u->sq_map;
+      }
+   else
+      {
+         u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+         if (u->cq_map == MAP_FAILED)
+            {
+               perror("srv1_uring_init():mmap()");
+               munmap(u->sq_map, u->sq_map_len);
+               close(fd);
+               return 0;
+            }
+      }
+
+   u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+   u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqes_len, PROT_READ
+         | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   if (u->sqes == MAP_FAILED)
+      {
+         perror("srv1_uring_init():mmap()");
+         if (u->cq_map != u->sq_map)
+            {
+               munmap(u->cq_map, u->cq_map_len);
+            }
+         munmap(u->sq_map, u->sq_map_len);
+         close(fd);
+         return 0;
+      }
+
+   char *sq = (char *) u->sq_map;
+   char *cq = (char *) u->cq_map;
+   u->sq_head = (unsigned *) (sq + p.sq_off.head);
+   u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+   u->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+   u->sq_array = (unsigned *) (sq + p.sq_off.array);
+   u->cq_head = (unsigned *) (cq + p.cq_off.head);
+   u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+   u->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+   u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+   u->entries = p.sq_entries;
+   u->fd = fd;
+
+   return 1;
+}
+
+void
+srv1_uring_destroy(srv1_uring_t *u)
+{
+   if (u->fd < 0)
+      {
+         return;
+      }
+   munmap(u->sqes, u->sqes_len);
+   if (u->cq_map != u->sq_map)
+      {
+         munmap(u->cq_map, u->cq_map_len);
+      }
+   munmap(u->sq_map, u->sq_map_len);
+   close(u->fd);
+   u->fd = -1;
+}
+
+struct io_uring_sqe *
+srv1_uring_get_sqe(srv1_uring_t *u)
+{
+   unsigned tail = *u->sq_tail;
+   unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+   if (tail - head >= u->entries)
+      {
+         if (srv1_uring_enter(u, 0, 0) < 0)
+            {
+               return NULL;
+            }
+         head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+         if (tail - head >= u->entries)
+            {
+               return NULL;
+            }
+      }
+
+   unsigned idx = tail & u->sq_mask;
+   struct io_uring_sqe *sqe = &u->sqes[idx];
+   memset(sqe, 0, sizeof(*sqe));
+   u->sq_array[idx] = idx;
+   // The kernel only looks at it once the tail moves past it.
+   __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   u->queued++;
+   return sqe;
+}
+
+int
+srv1_uring_enter(srv1_uring_t *u, unsigned min_complete, int64_t timeout_usec)
+{
+   if (u->queued == 0 && min_complete == 0)
+      {
+         return 0;
+      }
+
+   struct __kernel_timespec ts;
+   struct io_uring_getevents_arg arg;
+   unsigned flags = 0;
+   void *argp = NULL;
+   size_t argsz = 0;
+
+   if (min_complete > 0)
+      {
+         flags |= IORING_ENTER_GETEVENTS;
+         if (timeout_usec >= 0)
+            {
+               memset(&arg, 0, sizeof(arg));
+               ts.tv_sec = timeout_usec / 1000000;
+               ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+               arg.ts = (uint64_t) (uintptr_t) &ts;
+               flags |= IORING_ENTER_EXT_ARG;
+               argp = &arg;
+               argsz = sizeof(arg);
+            }
+      }
+
+   for (;;)
+      {
+         u->enters++;
+         int res = uring_enter(u->fd, u->queued, min_complete, flags, argp,
+               argsz);
+         // A timed out wait still submitted; the kernel's head says how much.
+         if (res >= 0 || errno == ETIME)
+            {
+               u->queued = *u->sq_tail - __atomic_load_n(u->sq_head,
+                     __ATOMIC_ACQUIRE);
+               return 0;
+            }
+         if (errno != EINTR)
+            {
+               perror("srv1_uring_enter():io_uring_enter()");
+               return -1;
+            }
+      }
+}
+
+int
+srv1_uring_reap(srv1_uring_t *u, struct io_uring_cqe *cqe)
+{
+   unsigned head = *u->cq_head;
+   if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+      {
+         return 0;
+      }
+
+   *cqe = u->cqes[head & u->cq_mask];
+   __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+   return 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * surveyor_uring.h
+ *
+ * Minimal io_uring wrapper (raw system calls, no liburing) used by the
+ * io_uring serial transport.
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SURVEYOR_URING_H_
+#define SURVEYOR_URING_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+   /**
+    * @brief One io_uring instance: the mapped submission and completion
+    * queues. Not thread safe; one thread uses it at a time.
+    * @ingroup driver_surveyor
+    */
+   typedef struct
+   {
+         int fd; ///< Ring descriptor (-1 = not set up); pollable for completions
+
+         unsigned *sq_head; ///< Kernel's submission queue head
+         unsigned *sq_tail; ///< Our submission queue tail
+         unsigned sq_mask; ///< Submission queue index mask
+         unsigned *sq_array; ///< Submission queue indirection array
+         struct io_uring_sqe *sqes; ///< Submission queue entries
+
+         unsigned *cq_head; ///< Our completion queue head
+         unsigned *cq_tail; ///< Kernel's completion queue tail
+         unsigned cq_mask; ///< Completion queue index mask
+         struct io_uring_cqe *cqes; ///< Completion queue entries
+
+         void *sq_map; ///< Mapping of the submission ring
+         size_t sq_map_len; ///< Its length
+         void *cq_map; ///< Mapping of the completion ring (may equal sq_map)
+         size_t cq_map_len; ///< Its length
+         size_t sqes_len; ///< Length of the sqes mapping
+
+         unsigned entries; ///< Submission queue size
+         unsigned queued; ///< Entries filled in but not yet submitted
+         uint32_t enters; ///< io_uring_enter() calls made
+   } srv1_uring_t;
+
+   /*
+    * Sets up a ring. Needs a kernel that can wait with a timeout
+    * (IORING_FEAT_EXT_ARG, Linux 5.11).
+    * \return 1 for success, 0 if io_uring is unavailable.
+    */
+   int
+   srv1_uring_init(srv1_uring_t *u, unsigned entries);
+
+   /*
+    * Tears the ring down; anything in flight is cancelled by the kernel.
+    */
+   void
+   srv1_uring_destroy(srv1_uring_t *u);
+
+   /*
+    * Takes a cleared submission entry; it is submitted by the next
+    * srv1_uring_enter(). Submits queued entries first if the queue is full.
+    * \return the entry, or NULL on failure.
+    */
+   struct io_uring_sqe *
+   srv1_uring_get_sqe(srv1_uring_t *u);
+
+   /*
+    * Submits whatever is queued and, if min_complete > 0, waits until that
+    * many completions are available or timeout_usec passes (< 0 = no limit).
+    * Does nothing, and makes no system call, if there is nothing to submit
+    * or wait for.
+    * \return 0 for success (including a timeout), -1 on error.
+    */
+   int
+   srv1_uring_enter(srv1_uring_t *u, unsigned min_complete,
+         int64_t timeout_usec);
+
+   /*
+    * Takes the next completion, if any, without a system call.
+    * \return 1 if cqe was filled in, 0 if the completion queue is empty.
+    */
+   int
+   srv1_uring_reap(srv1_uring_t *u, struct io_uring_cqe *cqe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURVEYOR_URING_H_ */
@@ -0,0 +1,242 @@
+/*
+ * lut_bench.c
+ *
+ * Microbenchmark for the lookup tables in surveyor_lut.c.
+ * Checks that srv1_lut_speed()/srv1_lut_rot() agree with the original
+ * calc_speed_hackish()/calc_rot_hackish() searches over a dense sweep of
+ * commands, then times both. Does the same for srv1_lut_ir_ranges() against
+ * srv1_range_to_distance(), over a buffer of calibrated IR samples.
+ *
+ * The original searches print on every step; their output goes to
+ * /dev/null so the timing includes formatting but not the terminal.
+ *
+ * Usage: lut_bench [iterations]
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "../surveyor_comms.h"
+#include "../surveyor_lut.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The original searches, from surveyor_comms.c. */
+signed char
+calc_speed_hackish(double dx);
+void
+calc_rot_hackish(double dx, signed char *left, signed char *right);
+
+#define SWEEP_VX 400
+#define SWEEP_VA 400
+
+/* IR samples converted per call, like a few seconds of history. */
+#define IR_SAMPLES 1024
+
+static double
+now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Command number i of the sweep; covers both directions and past the limits. */
+static void
+sweep(int i, double *vx, double *va)
+{
+   *vx = -0.35 + 0.70 * (i / SWEEP_VA) / (SWEEP_VX - 1);
+   *va = -2.90 + 5.80 * (i % SWEEP_VA) / (SWEEP_VA - 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+   int iterations = (argc > 1 ? atoi(argv[1]) : 20000);
+   int total = SWEEP_VX * SWEEP_VA;
+   int mismatches = 0;
+   volatile int sink = 0;
+
+   if (freopen("/dev/null", "w", stdout) == NULL)
+      {
+         perror("freopen");
+         return 1;
+      }
+
+   srv1_lut_init();
+
+   for (int i = 0; i < total; i++)
+      {
+         double vx, va;
+         sweep(i, &vx, &va);
+
+         signed char l0 = calc_speed_hackish(vx);
+         signed char r0 = l0;
+         calc_rot_hackish(va, &l0, &r0);
+
+         signed char l1, r1;
+         srv1_lut_rot(va, srv1_lut_speed(vx), &l1, &r1);
+
+         if (l0 != l1 || r0 != r1)
+            {
+               if (mismatches++ < 10)
+                  {
+                     fprintf(stderr, "mismatch at vx=%f va=%f: (%d,%d) vs (%d,%d)\n",
+                           vx, va, l0, r0, l1, r1);
+                  }
+            }
+      }
+   fprintf(stderr, "checked %d commands, %d mismatches\n", total, mismatches);
+
+   // Far outside the sweep: huge turn rates must saturate like the search
+   // does, and non-finite commands must not index outside the tables.
+   static const double huge_va[] = { 1e8, 1e9, -1e9, 1e300, -1e300 };
+   static const double huge_vx[] = { 0.0, 0.1, -0.2, 0.3 };
+   int extremes = 0;
+   for (int i = 0; i < (int) (sizeof(huge_vx) / sizeof(huge_vx[0])); i++)
+      {
+         for (int j = 0; j < (int) (sizeof(huge_va) / sizeof(huge_va[0])); j++)
+            {
+               signed char l0 = calc_speed_hackish(huge_vx[i]);
+               signed char r0 = l0;
+               calc_rot_hackish(huge_va[j], &l0, &r0);
+
+               signed char l1, r1;
+               srv1_lut_rot(huge_va[j], srv1_lut_speed(huge_vx[i]), &l1, &r1);
+               if (l0 != l1 || r0 != r1)
+                  {
+                     fprintf(stderr, "mismatch at vx=%f va=%g: (%d,%d) vs "
+                           "(%d,%d)\n", huge_vx[i], huge_va[j], l0, r0, l1, r1);
+                     mismatches++;
+                  }
+               extremes++;
+            }
+      }
+   static const double bad[] = { NAN, INFINITY, -INFINITY };
+   for (int i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i++)
+      {
+         signed char l, r;
+         signed char speed = srv1_lut_speed(0.1);
+         if (srv1_lut_speed(bad[i]) != 0)
+            {
+               fprintf(stderr, "speed for vx=%f isn't 0\n", bad[i]);
+               mismatches++;
+            }
+         if (!srv1_lut_rot(bad[i], speed, &l, &r) || l != speed || r != speed)
+            {
+               fprintf(stderr, "rotation for va=%f isn't rejected\n", bad[i]);
+               mismatches++;
+            }
+         extremes += 2;
+      }
+   fprintf(stderr, "checked %d extreme commands\n", extremes);
+
+   double t0 = now_sec();
+   for (int i = 0; i < iterations; i++)
+      {
+         double vx, va;
+         sweep((i * 7919) % total, &vx, &va);
+         signed char l = calc_speed_hackish(vx);
+         signed char r = l;
+         calc_rot_hackish(va, &l, &r);
+         sink += l + r;
+      }
+   double search = now_sec() - t0;
+
+   t0 = now_sec();
+   for (int i = 0; i < iterations; i++)
+      {
+         double vx, va;
+         sweep((i * 7919) % total, &vx, &va);
+         signed char l, r;
+         srv1_lut_rot(va, srv1_lut_speed(vx), &l, &r);
+         sink += l + r;
+      }
+   double table = now_sec() - t0;
+
+   fprintf(stderr, "search: %10.1f ns/command\n", search * 1e9 / iterations);
+   fprintf(stderr, "table:  %10.1f ns/command\n", table * 1e9 / iterations);
+   fprintf(stderr, "speedup: %.0fx\n", search / table);
+
+   // IR: every reading through the table, against the polynomial.
+   static int readings[IR_SAMPLES * SRV1_IR_BEAMS];
+   static float ranges[IR_SAMPLES * SRV1_IR_BEAMS];
+   srv1_ir_cal_t cal;
+   int ir_mismatches = 0;
+
+   for (int i = 0; i < IR_SAMPLES * SRV1_IR_BEAMS; i++)
+      {
+         readings[i] = (i * 37) % 300 - 20;
+      }
+   for (int b = 0; b < SRV1_IR_BEAMS; b++)
+      {
+         cal.scale[b] = 0.9f + 0.05f * b;
+         cal.offset[b] = 0.01f * b;
+      }
+   srv1_lut_ir_ranges(readings, ranges, IR_SAMPLES, &cal);
+   for (int i = 0; i < IR_SAMPLES * SRV1_IR_BEAMS; i++)
+      {
+         int r = readings[i] < 0 ? 0 : readings[i] > 255 ? 255 : readings[i];
+         double cm = srv1_range_to_distance(r);
+         float m = (float) (cm > 0.0 ? cm / 100.0 : 0.0);
+         float v = m * cal.scale[i % SRV1_IR_BEAMS] + cal.offset[i
+               % SRV1_IR_BEAMS];
+         if (ranges[i] != (v > 0.0f ? v : 0.0f) && ir_mismatches++ < 10)
+            {
+               fprintf(stderr, "IR mismatch at reading %d: %f vs %f\n",
+                     readings[i], ranges[i], v);
+            }
+      }
+   fprintf(stderr, "checked %d IR readings, %d mismatches\n",
+         IR_SAMPLES * SRV1_IR_BEAMS, ir_mismatches);
+
+   int ir_iterations = iterations / 10 + 1;
+   float fsink = 0.0f;
+   t0 = now_sec();
+   for (int k = 0; k < ir_iterations; k++)
+      {
+         for (int i = 0; i < IR_SAMPLES * SRV1_IR_BEAMS; i++)
+            {
+               double cm = srv1_range_to_distance(readings[i] + k % 2);
+               float v = (float) (cm / 100.0) * cal.scale[i % SRV1_IR_BEAMS]
+                     + cal.offset[i % SRV1_IR_BEAMS];
+               ranges[i] = (v > 0.0f ? v : 0.0f);
+            }
+         fsink += ranges[k % IR_SAMPLES];
+      }
+   double poly = now_sec() - t0;
+
+   t0 = now_sec();
+   for (int k = 0; k < ir_iterations; k++)
+      {
+         readings[k % IR_SAMPLES] += k % 2;
+         srv1_lut_ir_ranges(readings, ranges, IR_SAMPLES, &cal);
+         fsink += ranges[k % IR_SAMPLES];
+      }
+   double batch = now_sec() - t0;
+   sink += (int) fsink;
+
+   double per = 1e9 / ((double) ir_iterations * IR_SAMPLES * SRV1_IR_BEAMS);
+   fprintf(stderr, "IR polynomial: %6.2f ns/reading\n", poly * per);
+   fprintf(stderr, "IR batch:      %6.2f ns/reading\n", batch * per);
+   fprintf(stderr, "speedup: %.1fx\n", poly / batch);
+
+   return (mismatches == 0 && ir_mismatches == 0 ? 0 : 1);
+}
@@ -0,0 +1,624 @@
+/*
+ * srv1_bench.c
+ *
+ * End-to-end benchmark of the comms layer against srv1_emu (or real
+ * robots). Streams images and sends velocity commands for a while, then
+ * reports frames per second, per-transaction round-trip percentiles from
+ * the link statistics, I/O system calls and host CPU time per frame.
+ *
+ * Without ports, it starts srv1_emu (from the same directory, or -e) with
+ * the -b/-d/-c/-g/-k options and benchmarks the terminals it opens. With -R
+ * it replays a capture instead, until the capture ends. With -D the frames
+ * are also decoded to RGB888 and shrunk to 1/2 and 1/4, as for the driver's
+ * decoded cameras; a real JPEG for the emulator to send (-j) makes that
+ * meaningful.
+ *
+ * Usage: srv1_bench [-n robots] [-t seconds] [-m motor_hz] [-s a|b|c]
+ *                   [-P] [-u] [-B] [-L baud] [-e emulator] [-b baud]
+ *                   [-d reply_usec]
+ *                   [-c capture_usec] [-g noise_percent] [-k stall_percent]
+ *                   [-w capture]
+ *                   [-R capture [-x speed]] [-D threads [-j jpeg]] [-S seconds]
+ *                   [-f image_hz] [-i ir_hz] [-K keepalive [-H]]
+ *                   [port ...]
+ *
+ *   -n  robots (default 1, or the number of ports)
+ *   -t  how long to run, in seconds (default 10)
+ *   -m  velocity commands per second and robot (default 10)
+ *   -s  image mode (default b, 160x128)
+ *   -P  don't pipeline image requests
+ *   -u  use the io_uring transport
+ *   -B  drive the blocking calls (srv1_set_speed()/srv1_fill_image()) in
+ *       one loop over the robots instead of the reactor
+ *   -L  line rate of the ports, 0 to probe for it (default 115200)
+ *   -w  record the traffic (of robot i to capture.i if there are several)
+ *   -R  replay this capture as one robot
+ *   -x  replay speed: 1 as recorded, 0 as fast as possible (default 0)
+ *   -S  switch to the next image mode this often (reactor only), and count
+ *       the frames that still arrive in the old one
+ *   -D  decode every frame, and build its pyramid, with this many threads
+ *       (reactor only)
+ *   -f  request images at this rate (reactor only; default as fast as the
+ *       link goes)
+ *   -i  poll the IR readings at this rate, between images (reactor only)
+ *   -K  don't resend unchanged wheel speeds for this long, in seconds
+ *       (reactor only; default 0, send every command)
+ *   -H  repeat one velocity command, like a joystick held still
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "../surveyor_comms.h"
+#include "../surveyor_decode.h"
+#include "../surveyor_link.h"
+#include "../surveyor_sched.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *txn_names[SRV1_STATS_TXNS] =
+   { "motors", "mode", "image", "IR" };
+
+static int wake[2] = { -1, -1 };
+
+static double switch_sec;
+static uint32_t switches;
+static uint32_t stale_frames;
+
+static double image_hz;
+static double ir_hz;
+static srv1_sched_stats_t image_polls;
+static srv1_sched_stats_t ir_polls;
+
+static int hold_command;
+static uint32_t unchanged_speeds;
+static uint32_t combined_writes;
+
+static srv1_decode_pool_t decoder;
+static int decoding;
+static uint32_t decoded_frames;
+
+static void
+notify(void *arg)
+{
+   char c = 0;
+   (void) arg;
+   if (write(wake[1], &c, 1) < 0)
+      {
+         // Full: a wakeup is pending anyway.
+      }
+}
+
+static double
+cpu_sec(void)
+{
+   struct rusage ru;
+   getrusage(RUSAGE_SELF, &ru);
+   return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+/*
+ * Starts the emulator with n robots and reads their terminal names.
+ * \return its pid, or -1.
+ */
+static pid_t
+start_emulator(const char *path, char *const *args, char ports[][64], int n)
+{
+   int out[2];
+   pid_t pid;
+   FILE *f;
+
+   if (pipe(out) < 0)
+      {
+         perror("pipe");
+         return -1;
+      }
+   pid = fork();
+   if (pid < 0)
+      {
+         perror("fork");
+         return -1;
+      }
+   if (pid == 0)
+      {
+         dup2(out[1], STDOUT_FILENO);
+         close(out[0]);
+         close(out[1]);
+         execv(path, args);
+         perror(path);
+         _exit(127);
+      }
+   close(out[1]);
+   f = fdopen(out[0], "r");
+   for (int i = 0; i < n; i++)
+      {
+         if (fgets(ports[i], 64, f) == NULL)
+            {
+               fprintf(stderr, "srv1_bench: emulator didn't start\n");
+               kill(pid, SIGTERM);
+               waitpid(pid, NULL, 0);
+               return -1;
+            }
+         ports[i][strcspn(ports[i], "\n")] = '\0';
+      }
+   fclose(f);
+   return pid;
+}
+
+/* Alternating commands, so that none of them is redundant (unless -H). */
+static void
+motor_command(int k, double *vx, double *va)
+{
+   if (hold_command)
+      k = 0;
+   *vx = (k & 1) ? 0.10 : 0.05;
+   *va = (k & 2) ? 0.5 : -0.5;
+}
+
+/* \return 1 if every robot replays a capture that has run out. */
+static int
+replays_finished(srv1_comm_t **x, int n)
+{
+   for (int i = 0; i < n; i++)
+      {
+         if (!srv1_replay_finished(x[i]))
+            return 0;
+      }
+   return 1;
+}
+
+/* \return seconds it ran for. */
+static double
+run_reactor(srv1_comm_t **x, int n, double seconds, double motor_hz,
+      uint32_t *frames)
+{
+   srv1_reactor_t *r = srv1_reactor_create();
+   srv1_link_t *links[SRV1_REACTOR_MAX];
+   int64_t period = (int64_t) (1e6 / motor_hz);
+   int64_t end, next_cmd, next_switch;
+   char want = x[0]->image_mode;
+   int k = 0;
+
+   if (r == NULL || pipe(wake) < 0)
+      {
+         fprintf(stderr, "srv1_bench: can't create reactor\n");
+         exit(1);
+      }
+   fcntl(wake[0], F_SETFL, O_NONBLOCK);
+   fcntl(wake[1], F_SETFL, O_NONBLOCK);
+   for (int i = 0; i < n; i++)
+      {
+         links[i] = srv1_reactor_add(r, x[i], notify, NULL);
+         srv1_link_set_polling(links[i], image_hz > 0.0
+               ? (int64_t) (1e6 / image_hz) : 0, ir_hz > 0.0
+               ? (int64_t) (1e6 / ir_hz) : 0);
+      }
+   if (!srv1_reactor_start(r))
+      {
+         fprintf(stderr, "srv1_bench: can't start reactor\n");
+         exit(1);
+      }
+
+   int64_t start = srv1_sched_now();
+   end = start + (int64_t) (seconds * 1e6);
+   next_cmd = start;
+   next_switch = switch_sec > 0.0 ? start + (int64_t) (switch_sec * 1e6) : end;
+   for (;;)
+      {
+         int64_t now = srv1_sched_now();
+         if (now >= end || replays_finished(x, n))
+            break;
+         if (now >= next_cmd)
+            {
+               double vx, va;
+               motor_command(k++, &vx, &va);
+               for (int i = 0; i < n; i++)
+                  srv1_link_set_speed(links[i], vx, va);
+               next_cmd += period;
+            }
+
+         for (int i = 0; i < n; i++)
+            {
+               srv1_event_t e;
+               while (srv1_link_poll(links[i], &e))
+                  {
+                     if (e.type == SRV1_EVT_FRAME)
+                        {
+                           frames[i]++;
+                           if (e.frame->mode != want)
+                              stale_frames++;
+                           if (decoding)
+                              srv1_decode_submit(&decoder, e.frame->data,
+                                    e.frame->size, i, e.frame->seq,
+                                    SRV1_PYRAMID_LEVELS);
+                           srv1_link_release_frame(links[i], e.frame);
+                        }
+                  }
+            }
+
+         // After taking the frames already queued, so that only those
+         // that were under way count against the switch.
+         if (srv1_sched_now() >= next_switch)
+            {
+               want = (want == SRV1_IMAGE_SMALL ? SRV1_IMAGE_MED
+                     : want == SRV1_IMAGE_MED ? SRV1_IMAGE_BIG
+                           : SRV1_IMAGE_SMALL);
+               for (int i = 0; i < n; i++)
+                  srv1_link_set_image_mode(links[i], want);
+               switches++;
+               next_switch += (int64_t) (switch_sec * 1e6);
+            }
+
+         srv1_decode_job_t *job;
+         while (decoding && (job = srv1_decode_take(&decoder)) != NULL)
+            {
+               decoded_frames += job->ok;
+               srv1_decode_release(&decoder, job);
+            }
+
+         struct pollfd pfd;
+         int64_t until = next_cmd < end ? next_cmd : end;
+         if (next_switch < until)
+            until = next_switch;
+         char drain[64];
+         pfd.fd = wake[0];
+         pfd.events = POLLIN;
+         now = srv1_sched_now();
+         poll(&pfd, 1, until > now ? (int) ((until - now + 999) / 1000) : 0);
+         while (read(wake[0], drain, sizeof(drain)) > 0)
+            ;
+      }
+
+   // Robot 0's schedules: how late image requests and IR polls went out.
+   image_polls = links[0]->image_sched.stats;
+   ir_polls = links[0]->ir_sched.stats;
+   for (int i = 0; i < n; i++)
+      {
+         unchanged_speeds += links[i]->unchanged_speeds;
+         combined_writes += links[i]->combined_writes;
+      }
+   srv1_reactor_destroy(r);
+   return (srv1_sched_now() - start) / 1e6;
+}
+
+/* \return seconds it ran for. */
+static double
+run_blocking(srv1_comm_t **x, int n, double seconds, uint32_t *frames)
+{
+   int64_t start = srv1_sched_now();
+   int64_t end = start + (int64_t) (seconds * 1e6);
+   int k = 0;
+
+   while (srv1_sched_now() < end && !replays_finished(x, n))
+      {
+         double vx, va;
+         motor_command(k++, &vx, &va);
+         for (int i = 0; i < n; i++)
+            {
+               // Settling the link before a command may finish an image too.
+               uint32_t seq = x[i]->frame_seq;
+               srv1_set_speed(x[i], vx, va);
+               srv1_read_sensors(x[i]);
+               frames[i] += x[i]->frame_seq - seq;
+            }
+      }
+   return (srv1_sched_now() - start) / 1e6;
+}
+
+static void
+report(srv1_comm_t **x, int n, double seconds, const uint32_t *frames,
+      double cpu)
+{
+   uint32_t total = 0;
+   uint32_t calls = 0;
+
+   for (int i = 0; i < n; i++)
+      {
+         srv1_stats_t st;
+         srv1_stats_snapshot(&x[i]->stats, &st);
+         printf("robot %d (%s): %u frames, %.1f fps\n", i, x[i]->port,
+               frames[i], frames[i] / seconds);
+         for (int t = 0; t < SRV1_STATS_TXNS; t++)
+            {
+               const srv1_hist_t *h = &st.latency[t];
+               if (h->count == 0)
+                  continue;
+               printf("  %-6s %6u done  p50 %7u  p90 %7u  p99 %7u  max %7u usec\n",
+                     txn_names[t], h->count, srv1_hist_percentile(h, 50.0),
+                     srv1_hist_percentile(h, 90.0),
+                     srv1_hist_percentile(h, 99.0), h->max);
+            }
+         printf("  %u timeouts, %u image retries, %u bytes flushed, "
+               "%u skipped\n", st.timeouts, st.image_retries,
+               st.flushed_bytes, st.skipped_bytes);
+         if (st.truncated_frames > 0 || st.bad_frames > 0)
+            printf("  %u truncated images (%u bytes drained), %u malformed\n",
+                  st.truncated_frames, st.drained_bytes, st.bad_frames);
+         total += frames[i];
+         calls += x[i]->io_calls;
+      }
+   printf("total: %.1f fps, %.1f I/O calls/frame, %.1f usec CPU/frame "
+         "(%.1f%% of a core)\n", total / seconds,
+         total ? (double) calls / total : 0.0,
+         total ? cpu * 1e6 / total : 0.0, 100.0 * cpu / seconds);
+   if (switches > 0)
+      printf("%u image mode switches, %u frames in the old mode after one\n",
+            switches, stale_frames);
+   if (image_hz > 0.0 && image_polls.cycles > 0)
+      printf("robot 0 image requests: %u, %.1f ms late on average, "
+            "worst %.1f ms\n", image_polls.cycles,
+            image_polls.jitter_sum / 1e3 / image_polls.cycles,
+            image_polls.jitter_max / 1e3);
+   if (ir_hz > 0.0)
+      printf("robot 0 IR polls: %u, %.1f ms late on average, worst %.1f ms\n",
+            ir_polls.cycles, ir_polls.cycles ? ir_polls.jitter_sum / 1e3
+                  / ir_polls.cycles : 0.0, ir_polls.jitter_max / 1e3);
+   if (x[0]->motor_keepalive > 0 || combined_writes > 0)
+      printf("velocity commands: %u unchanged ones not sent, %u sent with "
+            "an image request\n", unchanged_speeds, combined_writes);
+   if (decoding)
+      {
+         printf("decoded: %u frames, %.1f usec each, %u failed, "
+               "%u superseded\n", decoded_frames,
+               decoder.decoded ? (double) decoder.decode_usec
+                     / decoder.decoded : 0.0, decoder.failed,
+               decoder.superseded);
+      }
+}
+
+int
+main(int argc, char *argv[])
+{
+   static char ports[SRV1_REACTOR_MAX][64];
+   static srv1_uring_t ring;
+   srv1_comm_t *x[SRV1_REACTOR_MAX];
+   uint32_t frames[SRV1_REACTOR_MAX];
+   int n = 1;
+   double seconds = 10.0;
+   double motor_hz = 10.0;
+   char mode = SRV1_IMAGE_MED;
+   int pipeline = 1;
+   int uring = 0;
+   int blocking = 0;
+   long line_baud = SRV1_DEFAULT_BAUD;
+   const char *emu = NULL;
+   const char *record = NULL;
+   const char *replay = NULL;
+   double replay_speed = 0.0;
+   int decode_threads = 0;
+   double keepalive = 0.0;
+   char *emu_args[24];
+   int nargs = 0;
+   char flags[8][3];
+   int nflags = 0;
+   char emu_path[4096];
+   char nbuf[16];
+   pid_t emu_pid = -1;
+   int opt;
+
+   emu_args[nargs++] = (char *) "srv1_emu";
+   while ((opt = getopt(argc, argv, "n:t:m:s:PuBL:e:b:d:c:g:k:j:w:R:x:D:S:f:i:K:H")) != -1)
+      {
+         switch (opt)
+            {
+            case 'n':
+               n = atoi(optarg);
+               break;
+            case 't':
+               seconds = atof(optarg);
+               break;
+            case 'm':
+               motor_hz = atof(optarg);
+               break;
+            case 's':
+               mode = optarg[0];
+               break;
+            case 'P':
+               pipeline = 0;
+               break;
+            case 'u':
+               uring = 1;
+               break;
+            case 'B':
+               blocking = 1;
+               break;
+            case 'L':
+               line_baud = atol(optarg);
+               break;
+            case 'e':
+               emu = optarg;
+               break;
+            case 'w':
+               record = optarg;
+               break;
+            case 'R':
+               replay = optarg;
+               break;
+            case 'x':
+               replay_speed = atof(optarg);
+               break;
+            case 'D':
+               decode_threads = atoi(optarg);
+               break;
+            case 'S':
+               switch_sec = atof(optarg);
+               break;
+            case 'f':
+               image_hz = atof(optarg);
+               break;
+            case 'i':
+               ir_hz = atof(optarg);
+               break;
+            case 'K':
+               keepalive = atof(optarg);
+               break;
+            case 'H':
+               hold_command = 1;
+               break;
+            case 'b':
+            case 'd':
+            case 'c':
+            case 'g':
+            case 'k':
+            case 'j':
+               if (nflags < 8)
+                  {
+                     char *flag = flags[nflags++];
+                     flag[0] = '-';
+                     flag[1] = (char) opt;
+                     flag[2] = '\0';
+                     emu_args[nargs++] = flag;
+                     emu_args[nargs++] = optarg;
+                  }
+               break;
+            default:
+               fprintf(stderr, "usage: %s [-n robots] [-t seconds] [-m motor_hz] "
+                     "[-s a|b|c] [-P] [-u] [-B] [-L baud] [-e emulator] [-b baud] "
+                     "[-d reply_usec] [-c capture_usec] [-g noise_percent] "
+                     "[-k stall_percent] "
+                     "[-w capture] [-R capture [-x speed]] [-D threads [-j jpeg]] "
+                     "[-S seconds] [-f image_hz] [-i ir_hz] [-K keepalive [-H]] "
+                     "[port ...]\n",
+                     argv[0]);
+               return 1;
+            }
+      }
+   if (replay != NULL)
+      {
+         n = 1;
+      }
+   else if (optind < argc)
+      {
+         n = argc - optind;
+      }
+   if (n < 1 || n > SRV1_REACTOR_MAX || seconds <= 0.0 || motor_hz <= 0.0
+         || (line_baud != 0 && !srv1_baud_supported(line_baud))
+         || (mode != SRV1_IMAGE_SMALL && mode != SRV1_IMAGE_MED && mode
+               != SRV1_IMAGE_BIG))
+      {
+         fprintf(stderr, "srv1_bench: bad arguments\n");
+         return 1;
+      }
+
+   if (replay != NULL)
+      {
+         snprintf(ports[0], sizeof(ports[0]), "%s", replay);
+      }
+   else if (optind < argc)
+      {
+         for (int i = 0; i < n; i++)
+            snprintf(ports[i], sizeof(ports[i]), "%s", argv[optind + i]);
+      }
+   else
+      {
+         if (emu == NULL)
+            {
+               snprintf(emu_path, sizeof(emu_path), "%s/srv1_emu",
+                     dirname(strdup(argv[0])));
+               emu = emu_path;
+            }
+         snprintf(nbuf, sizeof(nbuf), "%d", n);
+         emu_args[nargs++] = (char *) "-n";
+         emu_args[nargs++] = nbuf;
+         emu_args[nargs] = NULL;
+         emu_pid = start_emulator(emu, emu_args, ports, n);
+         if (emu_pid < 0)
+            return 1;
+      }
+
+   if (uring && replay == NULL && !srv1_uring_init(&ring, 4 * n))
+      {
+         fprintf(stderr, "srv1_bench: io_uring unavailable\n");
+         return 1;
+      }
+   for (int i = 0; i < n; i++)
+      {
+         x[i] = srv1_create(ports[i]);
+         if (x[i] == NULL)
+            return 1;
+         x[i]->baud = line_baud;
+         if (replay != NULL)
+            srv1_use_replay(x[i], replay_speed);
+         else if (uring)
+            srv1_use_uring(x[i], &ring);
+         if (record != NULL)
+            {
+               char path[4096];
+               if (n > 1)
+                  snprintf(path, sizeof(path), "%s.%d", record, i);
+               else
+                  snprintf(path, sizeof(path), "%s", record);
+               if (!srv1_record(x[i], path))
+                  return 1;
+            }
+         if (!srv1_init(x[i]))
+            return 1;
+         x[i]->image_mode = mode;
+         x[i]->pipeline = pipeline;
+         x[i]->motor_keepalive = (int64_t) (keepalive * 1e6);
+         frames[i] = 0;
+      }
+
+   printf("%d robot(s), mode '%c', %s, %s transport, %ld baud, "
+         "%.0f commands/s, %.0f s\n", n, mode, blocking ? "blocking calls"
+               : pipeline ? "reactor, pipelined" : "reactor", x[0]->io->name,
+         x[0]->baud, motor_hz, seconds);
+
+   if (decode_threads > 0 && !blocking)
+      {
+         if (!srv1_decode_init(&decoder, decode_threads, notify, NULL))
+            {
+               fprintf(stderr, "srv1_bench: can't start decoder threads\n");
+               return 1;
+            }
+         decoding = 1;
+      }
+
+   double cpu = cpu_sec();
+   if (blocking)
+      seconds = run_blocking(x, n, seconds, frames);
+   else
+      seconds = run_reactor(x, n, seconds, motor_hz, frames);
+   cpu = cpu_sec() - cpu;
+
+   report(x, n, seconds, frames, cpu);
+   if (decoding)
+      srv1_decode_destroy(&decoder);
+
+   for (int i = 0; i < n; i++)
+      {
+         srv1_destroy(x[i]);
+      }
+   if (uring && replay == NULL)
+      srv1_uring_destroy(&ring);
+   if (emu_pid > 0)
+      {
+         kill(emu_pid, SIGTERM);
+         waitpid(emu_pid, NULL, 0);
+      }
+   return 0;
+}
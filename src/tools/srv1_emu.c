@@ -0,0 +1,457 @@
+/*
+ * srv1_emu.c
+ *
+ * SRV-1 emulator: answers the firmware commands the driver uses on one or
+ * more pseudo-terminals, so the comms layer can be exercised and measured
+ * without a robot.
+ *
+ *   V      -> ##Version - SRV-1 emulator
+ *   Mabc   -> #M
+ *   a/b/c  -> #a/#b/#c (image mode)
+ *   I      -> ##IMJ<mode><length> and a JPEG
+ *   B      -> ##BounceIR - followed by four readings
+ *
+ * Replies go out no faster than the configured baud rate would carry them,
+ * and while the driver has its terminal set to another rate the commands it
+ * sends are noise to the robot, which doesn't answer them.
+ * The path of each robot's terminal is printed on a line of its own; give
+ * it to the driver as the port. Runs until killed.
+ *
+ * Usage: srv1_emu [-n robots] [-b baud] [-d reply_usec] [-c capture_usec]
+ *                 [-g noise_percent] [-k stall_percent] [-j file.jpg]
+ *
+ *   -n  robots to emulate, each on its own terminal (default 1)
+ *   -b  baud rate of the robot's line, 0 for no pacing and any rate
+ *       (default 115200)
+ *   -d  delay before every reply, in usec (default 0)
+ *   -c  extra delay before an image, for the capture, in usec (default 50000)
+ *   -g  percentage of replies preceded by a few bytes of garbage (default 0)
+ *   -k  percentage of images that stall halfway for longer than the driver
+ *       waits for a body (default 0)
+ *   -j  send this JPEG as every image instead of synthetic ones
+ *
+ * Copyright (C) 2009 -  Carlos Jaramillo (current maintainer)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EMU_MAX_ROBOTS 16
+#define EMU_CHUNK 64
+
+typedef struct
+{
+      int master; ///< Our end of the terminal
+      int slave; ///< Kept open so the master survives the driver closing it
+      char mode; ///< Image mode: 'a', 'b' or 'c'
+      uint32_t frames; ///< Images sent so far
+      int64_t line_free; ///< When the last byte written is off the wire (usec)
+      unsigned int seed; ///< For the garbage
+} emu_robot_t;
+
+static long baud = 115200;
+/* Set if termios has a speed for baud; line_speed is then that speed. */
+static int rate_known;
+static speed_t line_speed;
+static long reply_delay;
+static long capture_delay = 50000;
+static int noise;
+static int stalls;
+
+/* How long a stalled image pauses; the driver gives up after 1.5 s. */
+#define EMU_STALL_USEC 2000000
+static unsigned char *jpeg_file;
+static uint32_t jpeg_file_size;
+
+static int64_t
+now_usec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void
+sleep_until(int64_t when)
+{
+   struct timespec ts;
+   ts.tv_sec = when / 1000000;
+   ts.tv_nsec = (when % 1000000) * 1000;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+}
+
+static void
+write_all(int fd, const unsigned char *buf, size_t len)
+{
+   while (len > 0)
+      {
+         ssize_t n = write(fd, buf, len);
+         if (n < 0)
+            {
+               if (errno == EINTR)
+                  continue;
+               perror("srv1_emu: write");
+               exit(1);
+            }
+         buf += n;
+         len -= n;
+      }
+}
+
+/* Writes as a serial line at baud would: ten bits a byte. */
+static void
+paced_write(emu_robot_t *r, const unsigned char *buf, size_t len)
+{
+   while (len > 0)
+      {
+         size_t n = len < EMU_CHUNK ? len : EMU_CHUNK;
+         if (baud > 0)
+            {
+               int64_t now = now_usec();
+               if (r->line_free > now)
+                  sleep_until(r->line_free);
+               else
+                  r->line_free = now;
+               r->line_free += (int64_t) n * 10 * 1000000 / baud;
+            }
+         write_all(r->master, buf, n);
+         buf += n;
+         len -= n;
+      }
+}
+
+static void
+reply(emu_robot_t *r, const void *buf, size_t len)
+{
+   if (reply_delay > 0)
+      sleep_until(now_usec() + reply_delay);
+   if (noise > 0 && (int) (rand_r(&r->seed) % 100) < noise)
+      {
+         static const unsigned char junk[] = "#zq";
+         unsigned char g[5];
+         int n = 1 + rand_r(&r->seed) % 5;
+         for (int i = 0; i < n; i++)
+            g[i] = junk[rand_r(&r->seed) % 4];
+         paced_write(r, g, n);
+      }
+   paced_write(r, (const unsigned char *) buf, len);
+}
+
+/*
+ * A JPEG-shaped payload: SOI, the start of an APP0 marker, filler that
+ * changes with every frame and never contains 0xFF, EOI. Roughly the size
+ * the real camera produces.
+ */
+static uint32_t
+synth_jpeg(unsigned char *buf, char mode, uint32_t frame)
+{
+   uint32_t size = (mode == 'a' ? 1600 : mode == 'b' ? 5000 : 12000);
+   uint32_t x = frame * 2654435761u + 1;
+   buf[0] = 0xFF;
+   buf[1] = 0xD8;
+   buf[2] = 0xFF;
+   buf[3] = 0xE0;
+   for (uint32_t i = 4; i < size - 2; i++)
+      {
+         x = x * 1103515245u + 12345u;
+         buf[i] = (x >> 16) & 0x7F;
+      }
+   buf[size - 2] = 0xFF;
+   buf[size - 1] = 0xD9;
+   return size;
+}
+
+static void
+send_image(emu_robot_t *r)
+{
+   static __thread unsigned char synth[12000];
+   unsigned char hdr[10];
+   const unsigned char *body;
+   uint32_t size;
+
+   if (capture_delay > 0)
+      sleep_until(now_usec() + capture_delay);
+   if (jpeg_file != NULL)
+      {
+         body = jpeg_file;
+         size = jpeg_file_size;
+      }
+   else
+      {
+         size = synth_jpeg(synth, r->mode, r->frames);
+         body = synth;
+      }
+   r->frames++;
+
+   memcpy(hdr, "##IMJ", 5);
+   hdr[5] = (r->mode == 'a' ? '1' : r->mode == 'b' ? '3' : '5');
+   hdr[6] = size & 0xFF;
+   hdr[7] = (size >> 8) & 0xFF;
+   hdr[8] = (size >> 16) & 0xFF;
+   hdr[9] = (size >> 24) & 0xFF;
+
+   // Header and body back to back, as the firmware sends them.
+   unsigned char *msg = (unsigned char *) malloc(sizeof(hdr) + size);
+   memcpy(msg, hdr, sizeof(hdr));
+   memcpy(msg + sizeof(hdr), body, size);
+   if (stalls > 0 && (int) (rand_r(&r->seed) % 100) < stalls)
+      {
+         size_t half = sizeof(hdr) + size / 2;
+         reply(r, msg, half);
+         sleep_until(now_usec() + EMU_STALL_USEC);
+         paced_write(r, msg + half, sizeof(hdr) + size - half);
+      }
+   else
+      {
+         reply(r, msg, sizeof(hdr) + size);
+      }
+   free(msg);
+}
+
+/* \return 1 unless the driver set the terminal to a rate other than baud. */
+static int
+rate_matches(emu_robot_t *r)
+{
+   struct termios tio;
+
+   if (!rate_known || tcgetattr(r->slave, &tio) < 0)
+      return 1;
+   return cfgetospeed(&tio) == line_speed;
+}
+
+static void *
+serve(void *arg)
+{
+   emu_robot_t *r = (emu_robot_t *) arg;
+   unsigned char buf[256];
+   int motor_args = 0;
+
+   for (;;)
+      {
+         ssize_t n = read(r->master, buf, sizeof(buf));
+         if (n < 0 && (errno == EINTR || errno == EIO))
+            {
+               // EIO: nobody has the terminal open; wait for the next user.
+               if (errno == EIO)
+                  usleep(10000);
+               continue;
+            }
+         if (n <= 0)
+            {
+               perror("srv1_emu: read");
+               exit(1);
+            }
+         if (!rate_matches(r))
+            {
+               motor_args = 0;
+               continue;
+            }
+         for (ssize_t i = 0; i < n; i++)
+            {
+               unsigned char c = buf[i];
+               if (motor_args > 0)
+                  {
+                     if (--motor_args == 0)
+                        reply(r, "#M", 2);
+                     continue;
+                  }
+               switch (c)
+                  {
+                  case 'V':
+                     reply(r, "##Version - SRV-1 emulator\n", 27);
+                     break;
+                  case 'M':
+                     motor_args = 3;
+                     break;
+                  case 'a':
+                  case 'b':
+                  case 'c':
+                     {
+                        char ack[2] = { '#', (char) c };
+                        r->mode = c;
+                        reply(r, ack, 2);
+                        break;
+                     }
+                  case 'I':
+                     send_image(r);
+                     break;
+                  case 'B':
+                     {
+                        char ir[64];
+                        int len = snprintf(ir, sizeof(ir),
+                              "##BounceIR - %8x%8x%8x%8x\n", 0x10, 0x20,
+                              0x30, 0x40);
+                        reply(r, ir, len);
+                        break;
+                     }
+                  default:
+                     break;
+                  }
+            }
+      }
+   return NULL;
+}
+
+static int
+open_robot(emu_robot_t *r, int i)
+{
+   struct termios tio;
+
+   memset(r, 0, sizeof(*r));
+   r->mode = 'b';
+   r->seed = 1234 + i;
+   r->master = posix_openpt(O_RDWR | O_NOCTTY);
+   if (r->master < 0 || grantpt(r->master) < 0 || unlockpt(r->master) < 0)
+      {
+         perror("srv1_emu: posix_openpt");
+         return 0;
+      }
+   r->slave = open(ptsname(r->master), O_RDWR | O_NOCTTY);
+   if (r->slave < 0)
+      {
+         perror("srv1_emu: open");
+         return 0;
+      }
+   // Raw from the start, so nothing is echoed before the driver sets it up.
+   tcgetattr(r->slave, &tio);
+   cfmakeraw(&tio);
+   tcsetattr(r->slave, TCSANOW, &tio);
+   return 1;
+}
+
+static int
+load_jpeg(const char *path)
+{
+   FILE *f = fopen(path, "rb");
+   long size;
+
+   if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0)
+      {
+         perror(path);
+         return 0;
+      }
+   rewind(f);
+   jpeg_file = (unsigned char *) malloc(size);
+   jpeg_file_size = (uint32_t) size;
+   if (fread(jpeg_file, 1, size, f) != (size_t) size)
+      {
+         perror(path);
+         return 0;
+      }
+   fclose(f);
+   return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+   static emu_robot_t robots[EMU_MAX_ROBOTS];
+   pthread_t threads[EMU_MAX_ROBOTS];
+   int nrobots = 1;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:b:d:c:g:k:j:")) != -1)
+      {
+         switch (opt)
+            {
+            case 'n':
+               nrobots = atoi(optarg);
+               break;
+            case 'b':
+               baud = atol(optarg);
+               break;
+            case 'd':
+               reply_delay = atol(optarg);
+               break;
+            case 'c':
+               capture_delay = atol(optarg);
+               break;
+            case 'g':
+               noise = atoi(optarg);
+               break;
+            case 'k':
+               stalls = atoi(optarg);
+               break;
+            case 'j':
+               if (!load_jpeg(optarg))
+                  return 1;
+               break;
+            default:
+               fprintf(stderr, "usage: %s [-n robots] [-b baud] [-d reply_usec] "
+                     "[-c capture_usec] [-g noise_percent] [-k stall_percent] "
+                     "[-j file.jpg]\n",
+                     argv[0]);
+               return 1;
+            }
+      }
+   if (nrobots < 1 || nrobots > EMU_MAX_ROBOTS)
+      {
+         fprintf(stderr, "srv1_emu: 1 to %d robots\n", EMU_MAX_ROBOTS);
+         return 1;
+      }
+
+   rate_known = 1;
+   switch (baud)
+      {
+      case 115200:
+         line_speed = B115200;
+         break;
+      case 230400:
+         line_speed = B230400;
+         break;
+      case 460800:
+         line_speed = B460800;
+         break;
+      case 921600:
+         line_speed = B921600;
+         break;
+      default:
+         rate_known = 0;
+         break;
+      }
+
+   for (int i = 0; i < nrobots; i++)
+      {
+         if (!open_robot(&robots[i], i))
+            return 1;
+         printf("%s\n", ptsname(robots[i].master));
+      }
+   fflush(stdout);
+
+   for (int i = 0; i < nrobots; i++)
+      {
+         if (pthread_create(&threads[i], NULL, serve, &robots[i]) != 0)
+            {
+               fprintf(stderr, "srv1_emu: can't start robot %d\n", i);
+               return 1;
+            }
+      }
+   for (int i = 0; i < nrobots; i++)
+      pthread_join(threads[i], NULL);
+   return 0;
+}